@@ -0,0 +1,240 @@
+#include "enigma/corpus.h"
+#include "enigma/solver.h"
+#include "enigma/thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Runs solver modes over synthetic intercepts of several lengths and reports how often and how fast they crack them:
+//   enigma_bench [-lengths 50,100,200] [-count 5] [-orders 4] [-seed 1945] [-modes plaintext,bitsliced,tiled,prescreen,crib,staged]
+// Each intercept is searched over its own rotor order and orders - 1 other random ones (a full sweep per message
+// would take hours), so times are comparable between modes and lengths rather than with a real run.
+
+namespace
+{
+	using namespace enigma;
+
+	struct run_result
+	{
+		bool m_solved = false;
+		double m_seconds = 0;
+		std::size_t m_false_positives = 0;
+	};
+
+	struct benchmark_options
+	{
+		std::vector<std::size_t> m_lengths = { 50, 100, 200 };
+		std::size_t m_count = 5;
+		std::size_t m_orders = 4;
+		std::uint64_t m_seed = 1945;
+		std::vector<std::string> m_modes = { "plaintext", "bitsliced", "tiled", "prescreen", "crib", "staged" };
+	};
+
+	constexpr std::array<std::string_view, 6> known_modes = { "plaintext", "bitsliced", "tiled", "prescreen", "crib", "staged" };
+
+	std::vector<std::string> split( std::string_view list )
+	{
+		std::vector<std::string> items;
+		for ( std::size_t start = 0; start <= list.size(); )
+		{
+			const auto end = std::min( list.find( ',', start ), list.size() );
+			items.emplace_back( list.substr( start, end - start ) );
+			start = end + 1;
+		}
+		return items;
+	}
+
+	// The right rotor order among others - 1 random M4 orders, in random order
+	std::vector<std::array<int, 4>> search_orders( const std::array<int, 4>& answer, std::size_t orders, std::mt19937_64& random )
+	{
+		std::vector<std::array<int, 4>> result = { answer };
+		std::uniform_int_distribution<int> greek( 9, 10 );
+		while ( result.size() < orders )
+		{
+			std::array<int, 8> wheels = { 1, 2, 3, 4, 5, 6, 7, 8 };
+			std::shuffle( begin( wheels ), end( wheels ), random );
+			const std::array order = { greek( random ), wheels[ 0 ], wheels[ 1 ], wheels[ 2 ] };
+			if ( std::find( begin( result ), end( result ), order ) == end( result ) )
+			{
+				result.push_back( order );
+			}
+		}
+		std::shuffle( begin( result ), end( result ), random );
+		return result;
+	}
+
+	run_result run( std::string_view mode, const corpus::intercept& intercept, m4_solver::options options )
+	{
+		std::atomic<std::size_t> candidates = 0;
+		options.m_on_candidate = [ & ]( const m4_solver::settings& ) { ++candidates; };
+
+		const auto plugs = intercept.plugs();
+		const auto& plaintext = intercept.m_plaintext;
+		const auto& message = intercept.m_message;
+
+		// A 20 letter crib a quarter into the message, its location known give or take 16 letters
+		const auto crib_start = plaintext.size() / 4;
+		const auto crib = std::string_view( plaintext ).substr( crib_start, std::min<std::size_t>( 20, plaintext.size() / 2 ) );
+
+		const auto start = std::chrono::steady_clock::now();
+		std::optional<m4_solver::settings> settings;
+		if ( mode == "crib" || mode == "staged" )
+		{
+			options.m_right_rotor_first = mode == "staged";
+			auto locations = find_potential_crib_location( message, crib );
+			std::erase_if( locations,
+						   [ & ]( std::size_t location ) { return location + 16 < crib_start || location > crib_start + 16; } );
+			settings = m4_solver::crack_settings_with_crib( message, intercept.m_reflector, plugs, crib, locations, {}, options );
+		}
+		else
+		{
+			if ( mode == "bitsliced" )
+			{
+				options.m_kernel = m4_solver::kernel::bitsliced_256;
+			}
+			else if ( mode == "tiled" )
+			{
+				options.m_kernel = m4_solver::kernel::tiled;
+			}
+			else if ( mode == "prescreen" )
+			{
+				options.m_priorities.m_prescreen_length = 16;
+			}
+			settings = m4_solver::crack_settings( message, intercept.m_reflector, plugs, plaintext, {}, options );
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		run_result result;
+		result.m_seconds = elapsed.count();
+		if ( settings && settings->m_rotors == intercept.m_settings.m_rotors )
+		{
+			const auto& order = settings->m_rotors;
+			const m4_machine machine( { rotors[ order[ 0 ] ], rotors[ order[ 1 ] ], rotors[ order[ 2 ] ], rotors[ order[ 3 ] ] },
+									  settings->m_ring_settings,
+									  intercept.m_reflector,
+									  plugs );
+			const auto decoded = machine.decode( message, settings->m_key );
+			result.m_solved = mode == "crib" || mode == "staged" ? decoded.substr( crib_start, crib.size() ) == crib : decoded == plaintext;
+		}
+		result.m_false_positives = candidates - ( result.m_solved ? 1 : 0 );
+		return result;
+	}
+
+	double percentile( std::vector<double> values, double fraction )
+	{
+		if ( values.empty() )
+		{
+			return 0;
+		}
+		std::sort( begin( values ), end( values ) );
+		const auto rank = static_cast<std::size_t>( fraction * static_cast<double>( values.size() - 1 ) + 0.5 );
+		return values[ rank ];
+	}
+}
+
+int main( int argc, char** argv )
+{
+	using namespace std::literals;
+
+	benchmark_options options;
+	for ( int i = 1; i < argc; i += 2 )
+	{
+		if ( i + 1 == argc )
+		{
+			std::cerr << std::format( "Missing value for option {}\n", argv[ i ] );
+			return 1;
+		}
+		if ( argv[ i ] == "-lengths"sv )
+		{
+			options.m_lengths.clear();
+			for ( const auto& length : split( argv[ i + 1 ] ) )
+			{
+				options.m_lengths.push_back( std::stoul( length ) );
+			}
+		}
+		else if ( argv[ i ] == "-count"sv )
+		{
+			options.m_count = std::stoul( argv[ i + 1 ] );
+		}
+		else if ( argv[ i ] == "-orders"sv )
+		{
+			options.m_orders = std::max<std::size_t>( std::stoul( argv[ i + 1 ] ), 1 );
+		}
+		else if ( argv[ i ] == "-seed"sv )
+		{
+			options.m_seed = std::stoull( argv[ i + 1 ] );
+		}
+		else if ( argv[ i ] == "-modes"sv )
+		{
+			options.m_modes = split( argv[ i + 1 ] );
+			for ( const auto& mode : options.m_modes )
+			{
+				if ( std::ranges::find( known_modes, mode ) == end( known_modes ) )
+				{
+					std::cerr << std::format( "Unknown mode {}\n", mode );
+					return 1;
+				}
+			}
+		}
+		else
+		{
+			std::cerr << std::format( "Unknown option {}\n", argv[ i ] );
+			return 1;
+		}
+	}
+
+	std::cout << std::format( "{} intercepts per length, {} rotor orders searched each, {} threads\n",
+							  options.m_count,
+							  options.m_orders,
+							  default_thread_pool().concurrency() );
+	std::cout << std::format(
+		"{:<10} {:>6} {:>8} {:>9} {:>9} {:>9} {:>16}\n", "mode", "length", "solved", "p50 (s)", "p90 (s)", "max (s)", "false pos / msg" );
+
+	for ( const auto length : options.m_lengths )
+	{
+		const auto intercepts
+			= corpus::generate( { .m_count = options.m_count, .m_length = length, .m_seed = options.m_seed + length } );
+
+		for ( const auto& mode : options.m_modes )
+		{
+			// Same search orders for every mode
+			std::mt19937_64 random( options.m_seed );
+
+			std::size_t solved = 0;
+			std::size_t false_positives = 0;
+			std::vector<double> seconds;
+			for ( const auto& intercept : intercepts )
+			{
+				m4_solver::options solver_options;
+				solver_options.m_rotor_orders = search_orders( intercept.m_settings.m_rotors, options.m_orders, random );
+
+				const auto result = run( mode, intercept, solver_options );
+				solved += result.m_solved ? 1 : 0;
+				false_positives += result.m_false_positives;
+				seconds.push_back( result.m_seconds );
+			}
+
+			std::cout << std::format( "{:<10} {:>6} {:>4}/{:<3} {:>9.2f} {:>9.2f} {:>9.2f} {:>16.1f}\n",
+									  mode,
+									  length,
+									  solved,
+									  intercepts.size(),
+									  percentile( seconds, 0.5 ),
+									  percentile( seconds, 0.9 ),
+									  percentile( seconds, 1.0 ),
+									  static_cast<double>( false_positives ) / static_cast<double>( intercepts.size() ) );
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "enigma/m4.h"
+#include "enigma/mapped_file.h"
+#include "enigma/solver.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace enigma
+{
+	// Known plaintext of an archived intercept
+	struct archived_crib
+	{
+		static constexpr std::size_t no_location = 0xFFFFFFFF;
+
+		std::string_view m_text;
+		// Position in the message, no_location when it could be anywhere it fits
+		std::size_t m_location = no_location;
+	};
+
+	// Intercepts stored for bulk processing, with their net, date and known cribs. Letters are normalized when the archive
+	// is written, the file is then mapped in memory and messages, nets and cribs are handed out as views into the mapping:
+	// opening an archive reads its header, and nothing is parsed or allocated per intercept.
+	//
+	// Layout, in the byte order of the machine that wrote it: header, letters of all messages, cribs and net names, padding
+	// to 8 bytes, then message records, crib records and net records.
+	class intercept_archive
+	{
+	public:
+		struct header
+		{
+			std::array<char, 8> m_magic;
+			std::uint32_t m_version;
+			std::uint32_t m_reserved;
+			// Letters section, padded to 8 bytes in the file
+			std::uint64_t m_text_size;
+			std::uint64_t m_messages;
+			std::uint64_t m_cribs;
+			std::uint64_t m_nets;
+		};
+		static_assert( sizeof( header ) == 48 );
+
+		// Letters from the text section, offsets are relative to its start
+		struct text_record
+		{
+			std::uint64_t m_offset;
+			std::uint32_t m_length;
+			// Crib location (or archived_crib::no_location), unused for nets
+			std::uint32_t m_location;
+		};
+		static_assert( sizeof( text_record ) == 16 );
+
+		struct message_record
+		{
+			std::uint64_t m_offset;
+			std::uint32_t m_length;
+			// YYYYMMDD, 0 when unknown
+			std::uint32_t m_date;
+			std::uint32_t m_net;
+			std::uint32_t m_first_crib;
+			std::uint32_t m_crib_count;
+			std::uint32_t m_reserved;
+		};
+		static_assert( sizeof( message_record ) == 32 );
+
+		static constexpr std::array<char, 8> magic = { 'E', 'N', 'I', 'G', 'A', 'R', 'C', 'H' };
+		static constexpr std::uint32_t version = 1;
+
+		// Intercept read in place, only valid as long as the archive is
+		class view
+		{
+		public:
+			// Only upper case letters, as solvers and machines take them
+			[[nodiscard]] std::string_view message() const;
+			// Empty when unknown
+			[[nodiscard]] std::string_view net() const;
+			// YYYYMMDD, 0 when unknown
+			[[nodiscard]] std::uint32_t date() const { return m_record->m_date; }
+			[[nodiscard]] std::size_t crib_count() const { return m_record->m_crib_count; }
+			[[nodiscard]] archived_crib crib( std::size_t index ) const;
+
+		private:
+			friend class intercept_archive;
+			view( const intercept_archive& archive, const message_record& record );
+
+			const intercept_archive* m_archive;
+			const message_record* m_record;
+		};
+
+		// Throws std::runtime_error if path cannot be read or is not an intercept archive
+		explicit intercept_archive( const std::string& path );
+
+		[[nodiscard]] std::size_t size() const { return m_messages.size(); }
+		[[nodiscard]] view operator[]( std::size_t index ) const { return view( *this, m_messages[ index ] ); }
+
+	private:
+		// Throws std::runtime_error if the record points outside of the text section
+		[[nodiscard]] std::string_view text( std::uint64_t offset, std::uint32_t length ) const;
+
+		mapped_file m_file;
+		std::string_view m_text;
+		std::span<const message_record> m_messages;
+		std::span<const text_record> m_cribs;
+		std::span<const text_record> m_nets;
+	};
+
+	// Writes an intercept archive, the letters as they are added and the records once closed. Only the records (32 bytes
+	// per message and 16 per crib) are kept in memory.
+	class archive_writer
+	{
+	public:
+		// Creates or truncates path, throws std::runtime_error if it cannot
+		explicit archive_writer( const std::string& path );
+		// Closes the archive if close was not called
+		~archive_writer();
+
+		archive_writer( const archive_writer& ) = delete;
+		archive_writer& operator=( const archive_writer& ) = delete;
+
+		// Lower case letters are upper cased and anything else left out, of the message and cribs alike. Throws
+		// std::invalid_argument if a crib has no letters or does not fit in the message at its location.
+		void add( std::string_view message, std::string_view net, std::uint32_t date, std::span<const archived_crib> cribs = {} );
+		// Writes the records and header, throws std::runtime_error if writing failed
+		void close();
+
+		[[nodiscard]] std::size_t size() const { return m_messages.size(); }
+
+	private:
+		std::uint64_t write_text( std::string_view text );
+
+		std::ofstream m_file;
+		std::string m_path;
+		std::string m_letters;
+		std::uint64_t m_text_size = 0;
+		std::vector<intercept_archive::message_record> m_messages;
+		std::vector<intercept_archive::text_record> m_cribs;
+		std::vector<intercept_archive::text_record> m_nets;
+		std::map<std::string, std::uint32_t, std::less<>> m_net_indices;
+	};
+
+	// Cribs as solvers take them, those without a location at every position they fit (see find_potential_crib_location)
+	std::vector<m4_solver::crib> solver_cribs( const intercept_archive::view& intercept );
+
+	// Decodes intercepts each with its key, back to back into output which must hold all their letters
+	void decode_intercepts( const m4_machine& machine,
+							std::span<const intercept_archive::view> intercepts,
+							std::span<const key> keys,
+							std::span<char> output );
+
+	// Text form, one intercept per line: net, date as YYYY-MM-DD, message, then cribs as TEXT or TEXT@LOCATION, separated by
+	// spaces. A - stands for an unknown net or date, empty lines and lines starting with # are skipped.
+	// Returns the number of intercepts added, throws std::runtime_error naming the first malformed line.
+	std::size_t import_intercepts( std::istream& input, archive_writer& archive );
+	void export_intercepts( const intercept_archive& archive, std::ostream& output );
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "enigma/solver.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace enigma::m4_solver
+{
+	// Runs crack jobs in the background, one per worker at a time. Several jobs can share an executor,
+	// pending ones wait for a free worker (highest priority first, then in submission order).
+	// Destruction waits for all submitted jobs to complete.
+	class executor
+	{
+	public:
+		explicit executor( std::size_t workers = 1 );
+		~executor();
+
+		executor( const executor& ) = delete;
+		executor& operator=( const executor& ) = delete;
+
+		void submit( std::function<void()> task, int priority = 0 );
+
+	private:
+		struct pending_task
+		{
+			int m_priority;
+			std::function<void()> m_function;
+		};
+
+		void run( std::stop_token stop_token );
+
+		std::mutex m_mutex;
+		std::condition_variable_any m_task_ready;
+		// Sorted by decreasing priority
+		std::deque<pending_task> m_tasks;
+		std::vector<std::jthread> m_workers;
+	};
+
+	// Handle to a crack running on an executor
+	class crack_job
+	{
+	public:
+		// Candidates kept for next_candidate, older unread ones are dropped past that
+		static constexpr std::size_t candidate_capacity = 1024;
+
+		// Blocks until the search is over
+		[[nodiscard]] std::optional<settings> get() const;
+		[[nodiscard]] bool ready() const;
+
+		// Potential settings found by the sweep (before verification), in the order they were found.
+		// Blocks until the next one is available, returns nothing once the search is over and all have been read.
+		[[nodiscard]] std::optional<settings> next_candidate();
+		// Candidates dropped so far because candidate_capacity were waiting to be read
+		[[nodiscard]] std::size_t dropped_candidates() const;
+
+		// Ask the search to stop, get() will return nothing unless settings were already found
+		void cancel();
+
+	private:
+		friend crack_job crack_settings_async(
+			executor&, std::string_view, reflector, std::span<const char* const>, std::string_view, const options& );
+		friend crack_job crack_settings_with_crib_async( executor&,
+														 std::string_view,
+														 reflector,
+														 std::span<const char* const>,
+														 std::string_view,
+														 std::span<const std::size_t>,
+														 const options& );
+
+		struct state;
+
+		template <typename crack_type>
+		static crack_job start( executor& executor, std::span<const char* const> plugs, crack_type crack, const options& options );
+
+		std::shared_ptr<state> m_state;
+		std::shared_future<std::optional<settings>> m_result;
+	};
+
+	// Same as crack_settings and crack_settings_with_crib, inputs are copied so they don't have to outlive the job
+	crack_job crack_settings_async( executor& executor,
+									std::string_view message,
+									reflector reflector,
+									std::span<const char* const> plugs,
+									std::string_view plaintext,
+									const options& options = {} );
+
+	crack_job crack_settings_with_crib_async( executor& executor,
+											  std::string_view message,
+											  reflector reflector,
+											  std::span<const char* const> plugs,
+											  std::string_view crib,
+											  std::span<const std::size_t> crib_locations,
+											  const options& options = {} );
+}
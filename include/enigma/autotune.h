@@ -0,0 +1,42 @@
+#pragma once
+
+#include "enigma/solver.h"
+
+#include <array>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace enigma::m4_solver
+{
+	// Kernel picked by autotune_kernel
+	struct kernel_choice
+	{
+		kernel m_kernel = kernel::scalar;
+		// Seconds taken on the sample by each kernel (indexed by kernel), 0 if not timed or failing validation
+		std::array<double, 5> m_seconds = {};
+		// Read back from the cache file instead of timed
+		bool m_cached = false;
+	};
+
+	struct autotune_options
+	{
+		// Keys each kernel decodes, from AAAA on (at most one greek wheel position)
+		std::size_t m_sample_keys = 26 * 26 * 26;
+		// Choices are looked up in and appended to this file per host and message length if set
+		std::string m_cache_path;
+	};
+
+	// Fastest kernel for crack_settings( message, reflector, plugs, plaintext ) on this machine, timed on a sample of keys.
+	// Kernels must flag the same keys as the scalar one to be picked, which stays the fallback (and the only choice without plugs).
+	kernel_choice autotune_kernel( std::string_view message,
+								   reflector reflector,
+								   std::span<const char* const> plugs,
+								   std::string_view plaintext,
+								   const autotune_options& options = {} );
+
+	// $XDG_CACHE_HOME/enigma/kernels or ~/.cache/enigma/kernels, empty if neither variable is set
+	std::string default_kernel_cache_path();
+
+	std::string_view kernel_name( kernel kernel );
+}
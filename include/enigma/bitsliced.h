@@ -0,0 +1,125 @@
+#pragma once
+
+#include "enigma/m4.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace enigma
+{
+	// One bit per lane, 64 lanes per word (wider sizes are meant to be vectorized by the compiler)
+	template <std::size_t words>
+	struct lane_mask
+	{
+		std::array<std::uint64_t, words> m_words;
+
+		[[nodiscard]] bool test( std::size_t lane ) const { return ( m_words[ lane / 64 ] >> ( lane % 64 ) ) & 1; }
+		[[nodiscard]] bool any() const
+		{
+			std::uint64_t result = 0;
+			for ( const auto word : m_words )
+			{
+				result |= word;
+			}
+			return result != 0;
+		}
+
+		[[nodiscard]] static constexpr lane_mask filled( bool value )
+		{
+			lane_mask result;
+			result.m_words.fill( value ? ~std::uint64_t( 0 ) : 0 );
+			return result;
+		}
+
+		[[nodiscard]] constexpr lane_mask operator~() const
+		{
+			lane_mask result;
+			for ( std::size_t i = 0; i < words; ++i )
+			{
+				result.m_words[ i ] = ~m_words[ i ];
+			}
+			return result;
+		}
+
+		[[nodiscard]] constexpr lane_mask operator&( const lane_mask& other ) const
+		{
+			lane_mask result;
+			for ( std::size_t i = 0; i < words; ++i )
+			{
+				result.m_words[ i ] = m_words[ i ] & other.m_words[ i ];
+			}
+			return result;
+		}
+
+		[[nodiscard]] constexpr lane_mask operator|( const lane_mask& other ) const
+		{
+			lane_mask result;
+			for ( std::size_t i = 0; i < words; ++i )
+			{
+				result.m_words[ i ] = m_words[ i ] | other.m_words[ i ];
+			}
+			return result;
+		}
+
+		[[nodiscard]] constexpr lane_mask operator^( const lane_mask& other ) const
+		{
+			lane_mask result;
+			for ( std::size_t i = 0; i < words; ++i )
+			{
+				result.m_words[ i ] = m_words[ i ] ^ other.m_words[ i ];
+			}
+			return result;
+		}
+	};
+
+	// Bit sliced M4 machine: runs the same message through many keys at once, each letter being stored
+	// as 5 bit planes holding one bit per key (lane) so that rotor and reflector substitutions become
+	// boolean circuits shared by all lanes. Keys processed together must share their leftmost letter
+	// (the greek wheel never moves, which allows folding it with the reflector).
+	template <std::size_t words>
+	class bitsliced_m4_machine
+	{
+	public:
+		static constexpr std::size_t lanes = words * 64;
+
+		bitsliced_m4_machine( const std::array<rotor, 4>& rotors,
+							  std::array<int, 4> ring_settings,
+							  reflector reflector,
+							  std::span<const char* const> plugs );
+
+		// Decode message with count (at most lanes) consecutive keys starting at first_key (AAAA, AAAB, ...)
+		void decode( std::string_view message, key first_key, std::size_t count, std::span<std::string> outputs ) const;
+
+		// Lanes for which partial_match_score( plaintext, decode( message, key ) ) >= threshold
+		[[nodiscard]] lane_mask<words> partial_match( std::string_view message,
+													  key first_key,
+													  std::size_t count,
+													  std::string_view plaintext,
+													  std::size_t threshold ) const;
+
+	private:
+		using table = std::array<char, 26>;
+
+		struct state;
+
+		state load( key first_key, std::size_t count ) const;
+		void step( state& state ) const;
+		void encode( state& state, char input, std::array<lane_mask<words>, 5>& output ) const;
+
+		// Rotor wirings as 0-25 tables, forward and reversed, right rotor last
+		std::array<table, 4> m_forward;
+		std::array<table, 4> m_backward;
+		// Greek wheel, reflector and greek wheel again, for each position of the greek wheel
+		std::array<table, 26> m_folded_reflector;
+		std::array<std::array<int, 2>, 4> m_turnovers;
+		std::array<int, 4> m_ring_settings;
+		table m_plugboard;
+	};
+
+	extern template class bitsliced_m4_machine<1>;
+	extern template class bitsliced_m4_machine<4>;
+	extern template class bitsliced_m4_machine<8>;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace enigma
+{
+	// Fixed capacity multi producer multi consumer queue without locks (D. Vyukov's bounded queue): each cell carries a
+	// sequence number telling producers and consumers whether it is theirs to fill or empty on the current lap.
+	// Neither push nor pop ever block, callers decide what to do when the queue is full or empty.
+	template <typename value_type>
+	class bounded_queue
+	{
+	public:
+		static_assert( std::is_trivially_copyable_v<value_type> );
+
+		// Capacity is rounded up to a power of two
+		explicit bounded_queue( std::size_t capacity )
+			: m_cells( std::make_unique<cell[]>( std::bit_ceil( std::max<std::size_t>( capacity, 2 ) ) ) )
+			, m_mask( std::bit_ceil( std::max<std::size_t>( capacity, 2 ) ) - 1 )
+		{
+			for ( std::size_t i = 0; i <= m_mask; ++i )
+			{
+				m_cells[ i ].m_sequence.store( i, std::memory_order_relaxed );
+			}
+		}
+
+		bounded_queue( const bounded_queue& ) = delete;
+		bounded_queue& operator=( const bounded_queue& ) = delete;
+
+		[[nodiscard]] std::size_t capacity() const { return m_mask + 1; }
+
+		// False if the queue is full
+		bool try_push( const value_type& value )
+		{
+			auto position = m_enqueue.load( std::memory_order_relaxed );
+			for ( ;; )
+			{
+				auto& cell = m_cells[ position & m_mask ];
+				const auto sequence = cell.m_sequence.load( std::memory_order_acquire );
+				const auto difference = static_cast<std::ptrdiff_t>( sequence ) - static_cast<std::ptrdiff_t>( position );
+				if ( difference == 0 )
+				{
+					if ( m_enqueue.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+					{
+						cell.m_value = value;
+						cell.m_sequence.store( position + 1, std::memory_order_release );
+						return true;
+					}
+				}
+				else if ( difference < 0 )
+				{
+					return false;
+				}
+				else
+				{
+					position = m_enqueue.load( std::memory_order_relaxed );
+				}
+			}
+		}
+
+		// False if the queue is empty
+		bool try_pop( value_type& value )
+		{
+			auto position = m_dequeue.load( std::memory_order_relaxed );
+			for ( ;; )
+			{
+				auto& cell = m_cells[ position & m_mask ];
+				const auto sequence = cell.m_sequence.load( std::memory_order_acquire );
+				const auto difference = static_cast<std::ptrdiff_t>( sequence ) - static_cast<std::ptrdiff_t>( position + 1 );
+				if ( difference == 0 )
+				{
+					if ( m_dequeue.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+					{
+						value = cell.m_value;
+						cell.m_sequence.store( position + m_mask + 1, std::memory_order_release );
+						return true;
+					}
+				}
+				else if ( difference < 0 )
+				{
+					return false;
+				}
+				else
+				{
+					position = m_dequeue.load( std::memory_order_relaxed );
+				}
+			}
+		}
+
+	private:
+		// Producers and consumers each hammer their own index, and neighbouring cells are filled and emptied by different
+		// threads at once: keep indices and cells each on their own cache line
+		static constexpr std::size_t cache_line = 64;
+
+		struct alignas( cache_line ) cell
+		{
+			std::atomic<std::size_t> m_sequence;
+			value_type m_value;
+		};
+
+		std::unique_ptr<cell[]> m_cells;
+		std::size_t m_mask;
+		alignas( cache_line ) std::atomic<std::size_t> m_enqueue = 0;
+		alignas( cache_line ) std::atomic<std::size_t> m_dequeue = 0;
+	};
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "enigma/m4.h"
+#include "enigma/solver.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace enigma::corpus
+{
+	struct options
+	{
+		std::size_t m_count = 10;
+		std::size_t m_length = 100;
+		// Same seed, same corpus
+		std::uint64_t m_seed = 1945;
+		std::size_t m_plug_pairs = 10;
+		// Reflector B or C at random, always C otherwise
+		bool m_random_reflector = false;
+	};
+
+	// Synthetic intercept along with the settings it was encrypted with
+	struct intercept
+	{
+		std::string m_plaintext;
+		std::string m_message;
+		m4_solver::settings m_settings;
+		reflector m_reflector = reflectors::C;
+		// Pairs such as "AE"
+		std::vector<std::string> m_plug_pairs;
+
+		// Plugboard as the machine and solver take it, only valid as long as this intercept is
+		[[nodiscard]] std::vector<const char*> plugs() const;
+	};
+
+	// Words from a navy flavoured German vocabulary separated by X, the way messages were typed
+	std::string german_like_text( std::size_t length, std::mt19937_64& random );
+
+	// Random M4 rotor orders (greek wheel on the left), rings, plugs and keys
+	std::vector<intercept> generate( const options& options );
+}
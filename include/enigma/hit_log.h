@@ -0,0 +1,107 @@
+#pragma once
+
+#include "enigma/mapped_file.h"
+#include "enigma/thread_buffers.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace enigma
+{
+	// Keys passing a solver's screening heuristic along with what verification made of them, appended to a binary file
+	// so that thresholds and filters can be tuned offline from real traffic. Each thread fills its own buffer without
+	// locking, full buffers are written under a lock and the rest on flush or destruction.
+	class hit_log
+	{
+	public:
+		// Heuristic the key passed
+		enum class stage : std::uint8_t
+		{
+			plaintext,
+			crib,
+			// Crib sweep restricted to the right letters surviving m_right_rotor_first
+			crib_staged,
+			day_key,
+			batch
+		};
+		static constexpr std::size_t stage_count = 5;
+
+		enum class outcome : std::uint8_t
+		{
+			confirmed,
+			rejected,
+			// Another candidate was confirmed or the search stopped first
+			unverified
+		};
+		static constexpr std::size_t outcome_count = 3;
+
+		// One record of the file, in the byte order of the machine that wrote it
+		struct hit
+		{
+			std::array<std::uint8_t, 4> m_rotors;
+			// key::index() of the message key at rings 0, rolled back from the first crib location for crib sweeps
+			std::uint32_t m_key;
+			std::uint32_t m_score;
+			stage m_stage;
+			outcome m_outcome;
+			// Index in the reflectors given to the solver, 0 with a single one
+			std::uint8_t m_reflector;
+			std::uint8_t m_reserved;
+		};
+		static_assert( sizeof( hit ) == 16 );
+
+		// File header: magic, format version and record size (records follow up to the end of the file)
+		static constexpr std::array<char, 8> magic = { 'E', 'N', 'I', 'G', 'H', 'I', 'T', 'S' };
+		static constexpr std::uint32_t version = 1;
+		static constexpr std::size_t header_size = 16;
+
+		// Creates or truncates path, throws std::runtime_error if it cannot
+		explicit hit_log( const std::string& path );
+		// Flushes what is left, which must not happen while hits are still being recorded
+		~hit_log();
+
+		hit_log( const hit_log& ) = delete;
+		hit_log& operator=( const hit_log& ) = delete;
+
+		void record( const hit& hit );
+		// Writes hits buffered by all threads, must not happen while hits are being recorded
+		void flush();
+
+		// Hits recorded so far, written or not
+		[[nodiscard]] std::size_t size() const;
+
+	private:
+		using hit_buffer = std::vector<hit>;
+
+		void write( std::span<const hit> hits );
+
+		std::ofstream m_file;
+		std::mutex m_file_mutex;
+		thread_buffers<hit_buffer> m_buffers;
+		std::atomic<std::size_t> m_size = 0;
+	};
+
+	// Hit log file mapped in memory, records are read in place
+	class hit_log_reader
+	{
+	public:
+		// Throws std::runtime_error if path cannot be read or is not a hit log
+		explicit hit_log_reader( const std::string& path );
+
+		[[nodiscard]] std::span<const hit_log::hit> hits() const;
+
+	private:
+		mapped_file m_file;
+	};
+
+	// Counts by stage and outcome, and for each stage the highest threshold keeping every confirmed hit with the share
+	// of rejected hits it would have screened out
+	void write_hit_report( std::span<const hit_log::hit> hits, std::ostream& output );
+}
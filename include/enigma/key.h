@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+namespace enigma
+{
+	// Rotor start positions from left to right (e.g. "YOSZ"), trivially copyable so it can be passed around without allocating.
+	// Keys are ordered AAAA, AAAB, ..., ZZZZ and map to their index in that order (0 to count - 1).
+	class key
+	{
+	public:
+		static constexpr std::uint32_t count = 26 * 26 * 26 * 26;
+
+		constexpr key() = default;
+		constexpr key( std::string_view letters )
+		{
+			assert( letters.size() == 4 );
+			for ( std::size_t i = 0; i < 4; ++i )
+			{
+				m_letters[ i ] = letters[ i ];
+			}
+		}
+		constexpr key( const char* letters )
+			: key( std::string_view( letters ) )
+		{
+		}
+
+		[[nodiscard]] static constexpr key from_index( std::uint32_t index )
+		{
+			key result;
+			for ( std::size_t i = 4; i-- > 0; index /= 26 )
+			{
+				result.m_letters[ i ] = static_cast<char>( 'A' + index % 26 );
+			}
+			return result;
+		}
+
+		[[nodiscard]] constexpr std::uint32_t index() const
+		{
+			return ( ( ( m_letters[ 0 ] - 'A' ) * 26 + m_letters[ 1 ] - 'A' ) * 26 + m_letters[ 2 ] - 'A' ) * 26 + m_letters[ 3 ] - 'A';
+		}
+
+		constexpr char& operator[]( std::size_t position ) { return m_letters[ position ]; }
+		constexpr char operator[]( std::size_t position ) const { return m_letters[ position ]; }
+
+		[[nodiscard]] constexpr std::string_view view() const { return { m_letters.data(), m_letters.size() }; }
+
+		// Next key in index order (ZZZZ wraps around to AAAA), same as turning the rightmost ring by hand with carries
+		constexpr key& operator++()
+		{
+			for ( std::size_t i = 4; i-- > 0; )
+			{
+				if ( m_letters[ i ] != 'Z' )
+				{
+					++m_letters[ i ];
+					break;
+				}
+				m_letters[ i ] = 'A';
+			}
+			return *this;
+		}
+
+		constexpr key& operator+=( std::int64_t steps )
+		{
+			*this = from_index( static_cast<std::uint32_t>( ( ( index() + steps ) % count + count ) % count ) );
+			return *this;
+		}
+
+		friend constexpr key operator+( key lhs, std::int64_t steps ) { return lhs += steps; }
+		friend constexpr std::int64_t operator-( key lhs, key rhs )
+		{
+			return static_cast<std::int64_t>( lhs.index() ) - static_cast<std::int64_t>( rhs.index() );
+		}
+
+		friend constexpr bool operator==( const key& lhs, const key& rhs ) = default;
+		friend constexpr auto operator<=>( const key& lhs, const key& rhs ) = default;
+
+	private:
+		std::array<char, 4> m_letters = { 'A', 'A', 'A', 'A' };
+	};
+
+	// Half open range of keys in index order, can be split to share a sweep between workers
+	class key_range
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = key;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const key*;
+			using reference = const key&;
+
+			constexpr iterator() = default;
+			constexpr explicit iterator( std::uint32_t index )
+				: m_key( key::from_index( index % key::count ) )
+				, m_index( index )
+			{
+			}
+
+			constexpr reference operator*() const { return m_key; }
+			constexpr pointer operator->() const { return &m_key; }
+
+			constexpr iterator& operator++()
+			{
+				++m_key;
+				++m_index;
+				return *this;
+			}
+			constexpr iterator operator++( int )
+			{
+				auto previous = *this;
+				++*this;
+				return previous;
+			}
+
+			friend constexpr bool operator==( const iterator& lhs, const iterator& rhs ) { return lhs.m_index == rhs.m_index; }
+
+		private:
+			key m_key;
+			// Kept along the key so that end() (one past ZZZZ) differs from begin()
+			std::uint32_t m_index = 0;
+		};
+
+		// All keys
+		constexpr key_range() = default;
+		constexpr key_range( std::uint32_t first, std::uint32_t last )
+			: m_first( first )
+			, m_last( last )
+		{
+			assert( first <= last && last <= key::count );
+		}
+
+		[[nodiscard]] constexpr iterator begin() const { return iterator( m_first ); }
+		[[nodiscard]] constexpr iterator end() const { return iterator( m_last ); }
+		[[nodiscard]] constexpr std::size_t size() const { return m_last - m_first; }
+		[[nodiscard]] constexpr bool empty() const { return m_first == m_last; }
+		[[nodiscard]] constexpr std::uint32_t first() const { return m_first; }
+		[[nodiscard]] constexpr std::uint32_t last() const { return m_last; }
+
+		// One of parts consecutive ranges of (nearly) the same size covering this one
+		[[nodiscard]] constexpr key_range split( std::size_t part, std::size_t parts ) const
+		{
+			assert( part < parts );
+			return { static_cast<std::uint32_t>( m_first + size() * part / parts ),
+					 static_cast<std::uint32_t>( m_first + size() * ( part + 1 ) / parts ) };
+		}
+
+	private:
+		std::uint32_t m_first = 0;
+		std::uint32_t m_last = key::count;
+	};
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include "enigma/key.h"
+
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <memory>
 #include <span>
 #include <string>
 #include <string_view>
@@ -71,6 +75,25 @@ namespace enigma
 	}
 
 
+	// Plugboard, right and middle rotors folded into one substitution for each pair of their offsets, towards the left rotor
+	// and back, along with their stepping. Those only depend on the two fast rotors, their rings and the plugboard: rotor
+	// orders differing in their greek and left rotors can share one copy, read by every worker sweeping them.
+	struct fast_rotor_tables
+	{
+		fast_rotor_tables( const rotor& middle, const rotor& right, std::array<int, 2> ring_settings, std::span<const char* const> plugs );
+
+		using table = std::array<std::uint8_t, 26>;
+		// Tables are indexed by middle offset * 26 + right offset
+		static constexpr std::uint16_t left_step = 0x8000;
+
+		std::array<int, 2> m_ring_settings;
+		// Typed letter to the contact it reaches on the left of the middle rotor (relative to the machine) and back
+		std::array<table, 26 * 26> m_inward;
+		std::array<table, 26 * 26> m_outward;
+		// Index after the next key stroke, with left_step set if the left rotor moves along
+		std::array<std::uint16_t, 26 * 26> m_next;
+	};
+
 	class m4_machine
 	{
 	public:
@@ -78,18 +101,69 @@ namespace enigma
 					std::array<int, 4> ring_settings,
 					reflector reflector,
 					std::span<const char* const> plugs );
+		// Same machine decoding through fast_tables, which must have been built from rotors[ 2 ], rotors[ 3 ] and plugs
+		// (ignored if built for other ring settings)
+		m4_machine( const std::array<rotor, 4>& rotors,
+					std::array<int, 4> ring_settings,
+					reflector reflector,
+					std::span<const char* const> plugs,
+					std::shared_ptr<const fast_rotor_tables> fast_tables );
 
-		void decode( std::string_view message, std::string_view key, std::string& output ) const;
+		void decode( std::string_view message, key key, std::string& output ) const;
+		// Output must be at least as large as message
+		void decode( std::string_view message, key key, std::span<char> output ) const;
+		// Decode message as if position letters had already been typed since rotors were set to key
+		void decode_from( std::string_view message, key key, std::size_t position, std::span<char> output ) const;
 		// Convenience method for one shot decodes (no ouput buffer reuse)
-		[[nodiscard]] std::string decode( std::string_view message, std::string_view key ) const;
+		[[nodiscard]] std::string decode( std::string_view message, key key ) const;
+		// For each reflector (in place of the machine's own), which letters of message decode to the same letter of plaintext:
+		// output gets that letter where they do and '?' elsewhere, message.size() letters per reflector one after the other.
+		// The machine being reciprocal, both letters only need to go as far as the reflector, once for all reflectors.
+		void match_plaintext( std::string_view message,
+							  std::string_view plaintext,
+							  key key,
+							  std::span<const reflector> reflectors,
+							  std::span<char> output ) const;
+		// Index of coincidence (as index_of_coincidence) of the decodes with the 26 keys sharing key's first three letters,
+		// right letter A to Z. The rotors left of the right one are folded into one table per position they take, shared by
+		// all 26 keys, and letters are counted as they come out instead of being decoded first.
+		void coincidence_by_right_letter( std::string_view message, key key, std::span<float, 26> output ) const;
+
+		// Tables the machine decodes through, null without
+		[[nodiscard]] const std::shared_ptr<const fast_rotor_tables>& fast_tables() const { return m_fast_tables; }
 
-		[[nodiscard]] std::string advance_key( std::string_view key, std::size_t position ) const;
-		[[nodiscard]] std::string rollback_key( std::string_view key, std::size_t position ) const;
+		[[nodiscard]] key advance_key( key key, std::size_t position ) const;
+		[[nodiscard]] key rollback_key( key key, std::size_t position ) const;
+
+		// Rotor positions relative to their ring settings, letters are encoded the same for a given position
+		// whatever the ring settings (those only change when rotors turn over)
+		using offsets = std::array<int, 4>;
+
+		// Rotor positions used for each of the next output.size() letters typed from key
+		void trace( key key, std::span<offsets> output ) const;
+		// Decode letters whose rotor positions differ from reference_trace, copy the others from reference_output
+		void decode_trace( std::string_view message,
+						   std::span<const offsets> trace,
+						   std::span<const offsets> reference_trace,
+						   std::span<const char> reference_output,
+						   std::span<char> output ) const;
 
 	private:
+		offsets key_offsets( key key ) const;
+		key offsets_key( const offsets& offsets ) const;
+		void step( offsets& offsets ) const;
+		void step_back( offsets& offsets ) const;
+		char encode( char input, const offsets& offsets ) const;
+		// Both halves of encode, through the plugboard and rotors up to the reflector and back
+		char encode_forward( char input, const offsets& offsets ) const;
+		char encode_backward( char input, const offsets& offsets ) const;
+		// Same as encode with tables standing for the plugboard, right and middle rotors at index
+		char encode( char input, std::size_t index, int left_offset, int greek_offset, const fast_rotor_tables& tables ) const;
+
 		std::array<rotor, 4> m_rotors;
 		std::array<int, 4> m_rings_settings;
 		reflector m_reflector;
 		std::array<char, 26> m_plugboard;
+		std::shared_ptr<const fast_rotor_tables> m_fast_tables;
 	};
 }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+
+namespace enigma
+{
+	// Whole file mapped read only in memory, for binary formats read in place
+	class mapped_file
+	{
+	public:
+		// Throws std::runtime_error if path cannot be opened or mapped
+		explicit mapped_file( const std::string& path );
+		~mapped_file();
+
+		mapped_file( const mapped_file& ) = delete;
+		mapped_file& operator=( const mapped_file& ) = delete;
+
+		// Empty for an empty file
+		[[nodiscard]] std::span<const std::byte> bytes() const { return { m_data, m_size }; }
+
+	private:
+		void unmap();
+
+		const std::byte* m_data = nullptr;
+		std::size_t m_size = 0;
+		// File mapping handle, Windows only
+		void* m_mapping = nullptr;
+	};
+}
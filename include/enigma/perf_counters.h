@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+
+namespace enigma
+{
+	// Hardware counters (Linux perf_event_open) summed over all threads for each phase of a crack, telling whether a kernel
+	// waits on memory or on mispredicted branches. Each thread only counts itself, opening its counters on first use.
+	// Counters the system refuses (perf_event_paranoid, virtual machines, other platforms) are reported as unavailable.
+	class perf_counters
+	{
+	public:
+		enum class phase
+		{
+			// Scoring random keys to fit thresholds
+			calibration,
+			prescreen,
+			screening,
+			fine_tune
+		};
+		static constexpr std::size_t phase_count = 4;
+
+		enum class event
+		{
+			cycles,
+			instructions,
+			l1d_misses,
+			llc_misses,
+			branch_misses
+		};
+		static constexpr std::size_t event_count = 5;
+
+		struct totals
+		{
+			std::array<std::uint64_t, event_count> m_events = {};
+			// Keys decoded and scored, if the phase counts them
+			std::uint64_t m_keys = 0;
+			std::uint64_t m_scopes = 0;
+		};
+
+		// Raw count of one event along with the time it was enabled and actually counting, which differ when the kernel
+		// multiplexes more events than the PMU holds
+		struct sample
+		{
+			std::uint64_t m_value = 0;
+			std::uint64_t m_enabled = 0;
+			std::uint64_t m_running = 0;
+		};
+		using samples = std::array<sample, event_count>;
+
+		// Count between two samples, scaled up by the share of that interval the event was not counting (0 if it never was)
+		[[nodiscard]] static std::uint64_t scaled_delta( const sample& start, const sample& end );
+
+		// Counts the calling thread from construction to destruction, does nothing without counters
+		class scope
+		{
+		public:
+			scope( perf_counters* counters, phase phase );
+			~scope();
+
+			scope( const scope& ) = delete;
+			scope& operator=( const scope& ) = delete;
+
+			void add_keys( std::uint64_t keys );
+
+		private:
+			perf_counters* m_counters;
+			phase m_phase;
+			samples m_start = {};
+			std::uint64_t m_keys = 0;
+		};
+
+		perf_counters() = default;
+		perf_counters( const perf_counters& ) = delete;
+		perf_counters& operator=( const perf_counters& ) = delete;
+
+		// False if any thread failed to open this counter
+		[[nodiscard]] bool available( event event ) const;
+		[[nodiscard]] totals phase_totals( phase phase ) const;
+
+		// Instructions per cycle, cycles and misses per key (or per scope for phases not counting keys) of each phase that ran
+		void write_report( std::ostream& output ) const;
+
+	private:
+		struct phase_counts
+		{
+			std::array<std::atomic<std::uint64_t>, event_count> m_events = {};
+			std::atomic<std::uint64_t> m_keys = 0;
+			std::atomic<std::uint64_t> m_scopes = 0;
+		};
+
+		void add( phase phase, const samples& start, std::uint64_t keys );
+
+		std::array<phase_counts, phase_count> m_phases;
+		// One bit per event
+		std::atomic<std::uint32_t> m_unavailable = 0;
+	};
+}
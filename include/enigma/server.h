@@ -0,0 +1,142 @@
+#pragma once
+
+#include "enigma/async.h"
+#include "enigma/m4.h"
+#include "enigma/solver.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace enigma::server
+{
+	// Text protocol, one request per line and one response line per request. A request is a command followed by
+	// name=value fields separated by spaces (rotors as indices, rings as 0-25, plugs as AE,BF,... or nothing):
+	//   DECODE reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AE,BF key=YOSZ message=LANOT...
+	//   BULK-DECODE reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AE,BF messages=YOSZ:LANOT...,QBFM:...
+	//   CRACK reflector=C plugs=AE,BF message=LANOT... plaintext=KRKR... [priority=1] [orders=9/5/6/8,...]
+	//   CRACK reflector=C plugs=AE,BF message=LANOT... crib=XGEZX... [crib_start=279] [priority=1] [orders=9/5/6/8,...]
+	//   STATUS job=1
+	//   CANCEL job=1
+	//   SHUTDOWN
+	// Responses start with OK or ERROR:
+	//   OK KRKRALLE... (decode), OK KRKR...,VONVON... (bulk decode), OK job=1 (crack),
+	//   OK running | OK found rotors=9,5,6,8 rings=0,0,4,11 key=YOSZ | OK failed | OK cancelled (status, jobs are forgotten
+	//   once it was reported they are no longer running)
+	//   ERROR <reason>
+	struct handler_options
+	{
+		// Crack jobs running at once, they share the default thread pool for their rotor orders
+		std::size_t m_crack_workers = 1;
+		// Machines and crack calibrations kept between requests
+		std::size_t m_cache_size = 64;
+	};
+
+	// Handles protocol requests, independently of how they are received. Keeps machines and crack calibrations
+	// from one request to the next. Safe to call from several threads.
+	class request_handler
+	{
+	public:
+		explicit request_handler( const handler_options& options = {} );
+		~request_handler();
+
+		request_handler( const request_handler& ) = delete;
+		request_handler& operator=( const request_handler& ) = delete;
+
+		[[nodiscard]] std::string handle( std::string_view request );
+
+		// Responses in the same order as requests, decodes sharing settings are grouped to set the machine up once
+		[[nodiscard]] std::vector<std::string> handle_batch( std::span<const std::string> requests );
+
+		// Set once a SHUTDOWN request was handled
+		[[nodiscard]] bool shutdown_requested() const { return m_shutdown_requested; }
+
+	private:
+		struct job_entry
+		{
+			m4_solver::crack_job m_job;
+			bool m_cancelled = false;
+		};
+
+		std::shared_ptr<const m4_machine> machine( const std::string& description,
+												   const std::array<int, 4>& rotors,
+												   const std::array<int, 4>& ring_settings,
+												   reflector reflector,
+												   std::span<const char* const> plugs );
+		m4_solver::calibration calibration( const std::string& description, const std::function<m4_solver::calibration()>& calibrate );
+
+		std::string handle_crack( std::string_view request );
+		std::string handle_job( std::string_view request );
+
+		handler_options m_options;
+
+		std::mutex m_machines_mutex;
+		std::unordered_map<std::string, std::shared_ptr<const m4_machine>> m_machines;
+
+		std::mutex m_calibrations_mutex;
+		std::unordered_map<std::string, m4_solver::calibration> m_calibrations;
+
+		std::mutex m_jobs_mutex;
+		std::map<std::size_t, job_entry> m_jobs;
+		std::size_t m_next_job = 1;
+
+		std::atomic_bool m_shutdown_requested = false;
+
+		// Last so that running jobs are done before the rest goes away
+		m4_solver::executor m_executor;
+	};
+
+	// Serves requests from local clients on a Unix domain socket (e.g. socat - UNIX-CONNECT:/tmp/enigma.sock).
+	// Decode requests from all connections go through a single queue and get handled in batches.
+	class unix_socket_server
+	{
+	public:
+		// Binds and listens on path (replacing a stale socket file), throws std::system_error on failure
+		unix_socket_server( std::string path, request_handler& handler );
+		~unix_socket_server();
+
+		unix_socket_server( const unix_socket_server& ) = delete;
+		unix_socket_server& operator=( const unix_socket_server& ) = delete;
+
+		// Accepts connections until stop() is called or a SHUTDOWN request is received
+		void run();
+		void stop();
+
+	private:
+		struct pending_request;
+
+		void serve_connection( std::intptr_t connection );
+		std::string queue_decode( std::string line );
+		void run_batches( std::stop_token stop_token );
+
+		std::string m_path;
+		request_handler& m_handler;
+		std::intptr_t m_listener;
+		std::atomic_bool m_stopping = false;
+
+		// Connections are served by their own (detached) thread, destruction waits for all of them to be done
+		std::mutex m_connections_mutex;
+		std::condition_variable m_connections_done;
+		std::vector<std::intptr_t> m_connections;
+		std::size_t m_active_connections = 0;
+
+		std::mutex m_queue_mutex;
+		std::condition_variable_any m_request_ready;
+		std::vector<std::shared_ptr<pending_request>> m_queue;
+		std::jthread m_batch_thread;
+	};
+
+	// Sends a single request to a server and waits for its response, throws std::system_error on failure
+	std::string send_request( const std::string& path, std::string_view request );
+}
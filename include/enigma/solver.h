@@ -3,15 +3,26 @@
 #include "enigma/m4.h"
 
 #include <array>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <numeric>
 #include <optional>
+#include <span>
+#include <stop_token>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace enigma
 {
+	class hit_log;
+	class perf_counters;
+	class thread_pool;
+	class trace_recorder;
+
 	// Declarations
 
 	std::size_t partial_match_score( std::string_view plaintext, std::string_view candidate );
@@ -20,29 +31,266 @@ namespace enigma
 	float index_of_coincidence( std::string_view text );
 	std::vector<std::size_t> find_potential_crib_location( std::string_view cyphertext, std::string_view crib );
 
+	// Best partial_match_score of a crib over a set of locations, computed for all locations at once
+	// by indexing each decoded letter only once and counting matches in bit planes (one bit per location)
+	class crib_match_scorer
+	{
+	public:
+		crib_match_scorer( std::string_view crib, std::span<const std::size_t> locations, std::size_t message_length );
+
+		[[nodiscard]] std::size_t operator()( std::string_view candidate ) const;
+
+	private:
+		static constexpr std::size_t max_words = 32;
+		static constexpr std::size_t max_crib_size = 255;
+		static constexpr std::size_t max_planes = 16;
+
+		std::size_t scalar_score( std::string_view candidate ) const;
+
+		std::string m_crib;
+		std::vector<std::size_t> m_locations;
+		std::size_t m_words;
+		std::size_t m_match_planes;
+		std::size_t m_score_planes;
+		std::size_t m_first_word;
+		bool m_bit_sliced;
+		std::array<std::uint64_t, max_words> m_location_mask;
+	};
+
+	// Finds all occurrences of several patterns in a single pass over a text (Aho-Corasick automaton)
+	class pattern_matcher
+	{
+	public:
+		explicit pattern_matcher( std::span<const std::string_view> patterns );
+
+		// Calls on_match( pattern index, position ) for each occurrence, in order of end position
+		template <typename callback_type>
+		void find( std::string_view text, const callback_type& on_match ) const;
+
+	private:
+		// Transitions with failure links already followed, state 0 is the root
+		std::vector<std::array<std::uint32_t, 26>> m_transitions;
+		// Patterns ending at each state (including through failure links), as ranges in m_outputs
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> m_state_outputs;
+		std::vector<std::uint32_t> m_outputs;
+		std::vector<std::size_t> m_lengths;
+	};
+
 	namespace m4_solver
 	{
+		// Plain data, cheap to copy around and to hand over between threads
 		struct settings
 		{
 			std::array<int, 4> m_rotors;
 			std::array<int, 4> m_ring_settings;
-			std::string m_key;
+			key m_key;
+		};
+		static_assert( std::is_trivially_copyable_v<settings> );
+
+		// Settings found by a sweep over several reflectors, along with the index of the one that matched
+		struct reflector_settings
+		{
+			settings m_settings;
+			std::size_t m_reflector;
+		};
+
+		// Heuristic threshold fitted on the score distribution of random wrong keys for a given message
+		struct calibration
+		{
+			std::size_t m_threshold;
+			// Estimated probability for a wrong key to reach m_threshold
+			double m_false_positive_rate;
+			// Over a full sweep of all rotor orders and keys
+			double m_expected_false_positives;
+			double m_expected_fine_tune_decodes;
+			double m_mean_score;
+			double m_score_deviation;
+			std::size_t m_samples;
+			// Exponential fit of the top percentile: P( score >= s ) = m_tail_probability * exp( -( s - 1 - m_tail_start ) / m_tail_scale )
+			std::size_t m_tail_start;
+			double m_tail_probability;
+			double m_tail_scale;
+		};
+
+		// How keys are screened during the sweep
+		enum class kernel
+		{
+			scalar,
+			// Bit sliced over 64, 256 or 512 keys at once (known plaintext with plugboard only, others fall back to scalar)
+			bitsliced_64,
+			bitsliced_256,
+			bitsliced_512,
+			// Blocks of keys sharing middle and right rotor positions, a chunk of the message at a time (known plaintext with
+			// plugboard only, as above)
+			tiled
+		};
+
+		// Which rotor orders to search first. Every order still gets searched unless a solution turns up before, so this
+		// only changes the time to the first hit, not coverage.
+		struct priority_model
+		{
+			// Score all keys of each rotor order on the first letters of the known plaintext before the sweep, then search
+			// orders by decreasing best score (0 to skip). Costs that many letters of decoding per key, the right order
+			// usually comes out first. Not used by crib attacks.
+			std::size_t m_prescreen_length = 0;
+			// E.g. how often each order was seen in past day keys, for orders with the same prescreen score (0 if not listed)
+			std::map<std::array<int, 4>, double> m_rotor_order_weights;
+		};
+
+		struct options
+		{
+			double m_false_positive_rate = 1e-6;
+			std::size_t m_calibration_samples = 20'000;
+			// Skip calibration and use this one instead (if set)
+			std::optional<calibration> m_calibration;
+			kernel m_kernel = kernel::scalar;
+			// Crib attacks only: before sweeping a rotor order, rank right rotor positions on how well each crib window can be
+			// explained with the other rotors standing still, then sweep only keys with a right letter allowing at most
+			// m_right_rotor_contradictions (more if cribs may be slightly wrong). Cuts the sweep by an order of magnitude or so.
+			bool m_right_rotor_first = false;
+			std::size_t m_right_rotor_contradictions = 0;
+			// Rotor orders (as rotor indices, leftmost first) to search, all of them if empty
+			std::vector<std::array<int, 4>> m_rotor_orders;
+			priority_model m_priorities;
+			// Runs rotor orders in parallel, default_thread_pool() if null
+			thread_pool* m_thread_pool = nullptr;
+			// Threads dedicated to verifying candidates found by the sweep, fed through a queue of m_verify_queue_size
+			// (sweep workers verify their own candidates if 0, or when the queue is full)
+			std::size_t m_verify_threads = 0;
+			std::size_t m_verify_queue_size = 256;
+			// Checked between rotor orders, the search gives up once a stop is requested
+			std::stop_token m_stop_token;
+			// Called from worker threads with each potential setting found by the sweep, before it gets verified
+			std::function<void( const settings& )> m_on_candidate;
+			// Best keys kept for each message and rotor order by crack_day_key
+			std::size_t m_day_key_candidates = 4;
+			// Async jobs with a higher priority leave the executor queue first
+			int m_priority = 0;
+			// Records spans for rotor orders, screening, fine tuning and progress callbacks if set
+			trace_recorder* m_trace = nullptr;
+			// Hardware counters for calibration, screening and fine tuning if set (Linux only)
+			perf_counters* m_perf_counters = nullptr;
+			// Every candidate of the sweeps with its screening score and whether it verified, if set
+			hit_log* m_hit_log = nullptr;
+		};
+
+		// A message sent with the same day key (rotor order, rings and plugs) as the others given to crack_day_key
+		struct intercept
+		{
+			std::string_view m_message;
+			// Optional, messages without a crib are only solved once the day key is known (by index of coincidence)
+			std::string_view m_crib;
+			std::vector<std::size_t> m_crib_locations;
+		};
+
+		// One of several cribs expected in the same message
+		struct crib
+		{
+			std::string_view m_text;
+			std::vector<std::size_t> m_locations;
+		};
+
+		struct day_key
+		{
+			std::array<int, 4> m_rotors;
+			std::array<int, 4> m_ring_settings;
+			// Message key of each intercept, in the same order
+			std::vector<std::optional<key>> m_keys;
+		};
+
+		// A message with its own day key (rotor order, rings and plugs) given to crack_batch_with_cribs
+		struct batch_intercept
+		{
+			std::string_view m_message;
+			std::span<const char* const> m_plugs;
+			std::vector<crib> m_cribs;
+		};
+
+		// Settings found from the message alone, with the index of coincidence of the decode they give
+		struct coincidence_candidate
+		{
+			settings m_settings;
+			float m_index;
 		};
 
 		using progress_fn = std::function<void( std::size_t, std::size_t, std::size_t )>;
 
+		calibration calibrate( std::string_view message,
+							   reflector reflector,
+							   std::span<const char* const> plugs,
+							   std::string_view plaintext,
+							   const options& options = {} );
+
+		calibration calibrate_with_crib( std::string_view message,
+										 reflector reflector,
+										 std::span<const char* const> plugs,
+										 std::string_view crib,
+										 std::span<const std::size_t> crib_locations,
+										 const options& options = {} );
+
+		// Scores keys on the sum of each crib's best match
+		calibration calibrate_with_cribs( std::string_view message,
+										  reflector reflector,
+										  std::span<const char* const> plugs,
+										  std::span<const crib> cribs,
+										  const options& options = {} );
+
 		std::optional<settings> crack_settings( std::string_view message,
 												reflector reflector,
 												std::span<const char* const> plugs,
 												std::string_view plaintext,
-												progress_fn progress = {} );
+												progress_fn progress = {},
+												const options& options = {} );
+
+		// Same for an unknown reflector: sweeps all candidates in a single pass over rotor orders and keys, stepping
+		// rotors and walking them up to the reflector once for all of them
+		std::optional<reflector_settings> crack_settings( std::string_view message,
+														  std::span<const reflector> reflectors,
+														  std::span<const char* const> plugs,
+														  std::string_view plaintext,
+														  progress_fn progress = {},
+														  const options& options = {} );
 
 		std::optional<settings> crack_settings_with_crib( std::string_view message,
 														  reflector reflector,
 														  std::span<const char* const> plugs,
 														  std::string_view crib,
 														  std::span<const std::size_t> crib_locations,
-														  progress_fn progress = {} );
+														  progress_fn progress = {},
+														  const options& options = {} );
+
+		// Keys are screened on the joint score of all cribs, a candidate only passes once each crib is found at one of its locations
+		std::optional<settings> crack_settings_with_cribs( std::string_view message,
+														   reflector reflector,
+														   std::span<const char* const> plugs,
+														   std::span<const crib> cribs,
+														   progress_fn progress = {},
+														   const options& options = {} );
+
+		// Sweeps rotor orders once for all intercepts, ranks them by the combined evidence of each message's best keys
+		// then verifies them in that order. Short messages that cannot be cracked alone may be solved that way.
+		std::optional<day_key> crack_day_key( std::span<const intercept> intercepts,
+											  reflector reflector,
+											  std::span<const char* const> plugs,
+											  progress_fn progress = {},
+											  const options& options = {} );
+
+		// Settings of each intercept (empty where not found or without cribs), in the same order. Rotor orders and keys are
+		// swept once for the whole batch: rotor positions from each key are stepped once and every message not solved yet
+		// scores its crib windows at them, leaving the batch once a candidate verifies.
+		std::vector<std::optional<settings>> crack_batch_with_cribs( std::span<const batch_intercept> intercepts,
+																	 reflector reflector,
+																	 progress_fn progress = {},
+																	 const options& options = {} );
+
+		// Ciphertext only: the count settings (rings at 0) over the rotor orders of options whose decodes have the highest index
+		// of coincidence, best first. Far weaker than a crib, meant to pick what heavier solvers look at first. Right and middle
+		// rings other than 0 move turnovers and blur the signal, the right order often still comes out on top.
+		std::vector<coincidence_candidate> screen_by_coincidence( std::string_view message,
+																  reflector reflector,
+																  std::span<const char* const> plugs,
+																  std::size_t count,
+																  const options& options = {} );
 
 		std::optional<settings> fine_tune_key( std::string_view message,
 											   const settings& settings,
@@ -51,12 +299,21 @@ namespace enigma
 											   std::string_view plaintext );
 
 		// For testing, mostly
-		std::vector<std::string> crack_key( std::string_view message,
-											const std::array<rotor, 4>& rotors,
-											const std::array<int, 4> ring_settings,
-											reflector reflector,
-											std::span<const char* const> plugs,
-											std::string_view plaintext );
+		std::vector<key> crack_key( std::string_view message,
+									const std::array<rotor, 4>& rotors,
+									const std::array<int, 4> ring_settings,
+									reflector reflector,
+									std::span<const char* const> plugs,
+									std::string_view plaintext,
+									kernel kernel = kernel::scalar );
+
+		std::vector<key> crack_key_with_crib( std::string_view message,
+											  const std::array<rotor, 4>& rotors,
+											  const std::array<int, 4> ring_settings,
+											  reflector reflector,
+											  std::span<const char* const> plugs,
+											  std::string_view crib,
+											  std::span<const std::size_t> crib_locations );
 	}
 
 	// Inline implementations
@@ -124,4 +381,20 @@ namespace enigma
 		}
 		return static_cast<float>( sum ) * 26 / ( text.size() * ( text.size() - 1 ) );
 	}
+
+	template <typename callback_type>
+	void pattern_matcher::find( std::string_view text, const callback_type& on_match ) const
+	{
+		std::uint32_t state = 0;
+		for ( std::size_t i = 0; i < text.size(); ++i )
+		{
+			state = m_transitions[ state ][ text[ i ] - 'A' ];
+			const auto [ first, last ] = m_state_outputs[ state ];
+			for ( auto output = first; output < last; ++output )
+			{
+				const auto pattern = m_outputs[ output ];
+				on_match( static_cast<std::size_t>( pattern ), i + 1 - m_lengths[ pattern ] );
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace enigma
+{
+	namespace detail
+	{
+		inline std::atomic<std::uint64_t> next_thread_buffers_id = 1;
+
+		// Buffers of the last few owners used by this thread (jobs sharing a thread pool may each have their own)
+		struct thread_buffer_cache
+		{
+			struct entry
+			{
+				std::uint64_t m_owner = 0;
+				void* m_buffer = nullptr;
+			};
+			std::array<entry, 4> m_entries;
+			std::size_t m_next = 0;
+		};
+		inline thread_local thread_buffer_cache local_thread_buffers;
+	}
+
+	// One buffer per thread writing to an owner (trace recorder, hit log...), found without locking through a small thread
+	// local cache. Buffers are published to a lock free list and only freed with the owner. A thread evicted from the cache
+	// by other owners gets a new buffer, so one thread may end up with several. Reading buffers must not happen while
+	// threads are still writing to them.
+	template <typename buffer_type>
+	class thread_buffers
+	{
+	public:
+		thread_buffers() = default;
+		~thread_buffers()
+		{
+			for ( auto node = m_nodes.load(); node; )
+			{
+				delete std::exchange( node, node->m_next );
+			}
+		}
+
+		thread_buffers( const thread_buffers& ) = delete;
+		thread_buffers& operator=( const thread_buffers& ) = delete;
+
+		// Buffer of the calling thread, make() creating it the first time
+		template <typename factory_type>
+		buffer_type& local( const factory_type& make )
+		{
+			auto& cache = detail::local_thread_buffers;
+			for ( const auto& entry : cache.m_entries )
+			{
+				if ( entry.m_owner == m_id )
+				{
+					return *static_cast<buffer_type*>( entry.m_buffer );
+				}
+			}
+
+			auto* node = new buffer_node { make(), m_nodes.load() };
+			while ( !m_nodes.compare_exchange_weak( node->m_next, node ) )
+			{
+			}
+
+			cache.m_entries[ cache.m_next ] = { m_id, &node->m_buffer };
+			cache.m_next = ( cache.m_next + 1 ) % cache.m_entries.size();
+			return node->m_buffer;
+		}
+
+		// Most recently published first
+		template <typename function_type>
+		void for_each( const function_type& function )
+		{
+			for ( auto node = m_nodes.load(); node; node = node->m_next )
+			{
+				function( node->m_buffer );
+			}
+		}
+
+		template <typename function_type>
+		void for_each( const function_type& function ) const
+		{
+			for ( const buffer_node* node = m_nodes.load(); node; node = node->m_next )
+			{
+				function( node->m_buffer );
+			}
+		}
+
+	private:
+		struct buffer_node
+		{
+			buffer_type m_buffer;
+			buffer_node* m_next;
+		};
+
+		// Identifies these buffers in thread local caches, addresses may be reused
+		std::uint64_t m_id = detail::next_thread_buffers_id++;
+		std::atomic<buffer_node*> m_nodes = nullptr;
+	};
+}
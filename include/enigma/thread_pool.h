@@ -0,0 +1,58 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace enigma
+{
+	struct thread_pool_options
+	{
+		// Worker threads, not counting the caller of parallel_for which also takes part (hardware concurrency - 1 if 0)
+		std::size_t m_workers = 0;
+		// Pin workers to these CPUs (round robin), no pinning if empty
+		std::vector<int> m_cpus;
+		// Pin workers to the CPUs of this NUMA node (if m_cpus is empty)
+		std::optional<int> m_numa_node;
+	};
+
+	// Fixed set of workers reused across calls. Several threads may run parallel_for on the same pool at once,
+	// workers then help with each loop in turn.
+	class thread_pool
+	{
+	public:
+		explicit thread_pool( const thread_pool_options& options = {} );
+		~thread_pool();
+
+		thread_pool( const thread_pool& ) = delete;
+		thread_pool& operator=( const thread_pool& ) = delete;
+
+		// Threads taking part in a parallel_for (workers and caller)
+		[[nodiscard]] std::size_t concurrency() const { return m_workers.size() + 1; }
+
+		// Call body( i ) for each i in [0, count) and return once all are done, rethrows the first exception thrown by body
+		void parallel_for( std::size_t count, const std::function<void( std::size_t )>& body );
+
+	private:
+		struct loop;
+
+		void run_worker();
+		static void run_loop( loop& loop );
+
+		std::mutex m_mutex;
+		std::condition_variable m_work_ready;
+		std::condition_variable m_loop_done;
+		std::deque<loop*> m_loops;
+		bool m_stopping = false;
+		std::vector<std::thread> m_workers;
+	};
+
+	// Shared by all solver calls that don't provide their own
+	thread_pool& default_thread_pool();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "enigma/m4.h"
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace enigma
+{
+	// M4 machine screening blocks of keys against a known plaintext a chunk of the message at a time. Keys sharing their
+	// middle and right letters see the middle and right rotors (and the plugboard) step the same, so those are gone through
+	// once per letter for the whole block with the fast rotor tables, leaving a single folded table lookup per key and
+	// letter for the left rotor, greek wheel and reflector. Each key carries its score from one chunk to the next and drops
+	// out as soon as it can no longer reach the threshold, and the chunk, folded tables and key states all fit in L1.
+	class tiled_m4_machine
+	{
+	public:
+		// Keys sharing middle and right letters, one bit per greek and left letter (greek * 26 + left)
+		using key_block = std::bitset<26 * 26>;
+		// Letters decoded by every key of a block before moving on to the next chunk
+		static constexpr std::size_t chunk_length = 256;
+
+		// fast_tables must have been built from rotors[ 2 ], rotors[ 3 ] and the plugs, throws std::invalid_argument if they
+		// are missing or were built for other ring settings
+		tiled_m4_machine( const std::array<rotor, 4>& rotors,
+						  std::array<int, 4> ring_settings,
+						  reflector reflector,
+						  std::shared_ptr<const fast_rotor_tables> fast_tables );
+
+		// Keys of block, with key's middle and right letters, for which partial_match_score( plaintext, decode( message, key ) )
+		// >= threshold
+		[[nodiscard]] key_block partial_match( std::string_view message,
+											   key key,
+											   const key_block& block,
+											   std::string_view plaintext,
+											   std::size_t threshold ) const;
+
+	private:
+		using table = fast_rotor_tables::table;
+
+		std::array<int, 4> m_ring_settings;
+		std::shared_ptr<const fast_rotor_tables> m_fast_tables;
+		// Contact on the left of the middle rotor to the one it comes back to, for each greek * 26 + left offset
+		std::array<table, 26 * 26> m_folds;
+	};
+}
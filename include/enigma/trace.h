@@ -0,0 +1,79 @@
+#pragma once
+
+#include "enigma/thread_buffers.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace enigma
+{
+	// Records timed spans from any thread and exports them in Chrome trace format (also opened by Perfetto and about:tracing).
+	// Each thread appends to its own buffer without locking, buffers are only read when exporting, which must not
+	// happen while spans are still being recorded.
+	class trace_recorder
+	{
+	public:
+		struct event
+		{
+			// Span names and argument names must be string literals (or otherwise outlive the recorder)
+			const char* m_name;
+			// Nanoseconds since the recorder was created
+			std::int64_t m_start;
+			std::int64_t m_end;
+			std::array<const char*, 2> m_arg_names;
+			std::array<std::int64_t, 2> m_arg_values;
+			// Recording threads are numbered from 0 in order of their first span
+			std::size_t m_thread;
+		};
+
+		// Records a span from construction to destruction, does nothing without a recorder
+		class scope
+		{
+		public:
+			scope( trace_recorder* recorder, const char* name );
+			~scope();
+
+			scope( const scope& ) = delete;
+			scope& operator=( const scope& ) = delete;
+
+			// Up to two arguments shown along the span, further ones are ignored
+			void arg( const char* name, std::int64_t value );
+
+		private:
+			trace_recorder* m_recorder;
+			event m_event;
+			std::size_t m_args = 0;
+		};
+
+		trace_recorder();
+
+		trace_recorder( const trace_recorder& ) = delete;
+		trace_recorder& operator=( const trace_recorder& ) = delete;
+
+		// All spans recorded so far, thread by thread
+		[[nodiscard]] std::vector<event> events() const;
+
+		void write_chrome_trace( std::ostream& output ) const;
+		// Throws std::runtime_error if the file cannot be written
+		void save_chrome_trace( const std::string& path ) const;
+
+	private:
+		struct thread_buffer
+		{
+			std::vector<event> m_events;
+			std::size_t m_thread;
+		};
+
+		std::int64_t now() const;
+		void record( const event& event );
+
+		std::chrono::steady_clock::time_point m_origin;
+		thread_buffers<thread_buffer> m_buffers;
+		std::atomic<std::size_t> m_threads = 0;
+	};
+}
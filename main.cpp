@@ -1,8 +1,16 @@
+#include "enigma/archive.h"
+#include "enigma/autotune.h"
+#include "enigma/hit_log.h"
 #include "enigma/m4.h"
+#include "enigma/perf_counters.h"
+#include "enigma/server.h"
 #include "enigma/solver.h"
+#include "enigma/thread_pool.h"
+#include "enigma/trace.h"
 
 #include <chrono>
 #include <format>
+#include <fstream>
 #include <iostream>
 #include <string_view>
 
@@ -30,7 +38,39 @@ void print_settings( const enigma::m4_solver::settings& settings )
 							  settings.m_ring_settings[ 1 ],
 							  settings.m_ring_settings[ 2 ],
 							  settings.m_ring_settings[ 3 ] );
-	std::cout << std::format( "- Message key: {}\n", settings.m_key );
+	std::cout << std::format( "- Message key: {}\n", settings.m_key.view() );
+}
+
+void print_calibration( const enigma::m4_solver::calibration& calibration )
+{
+	std::cout << std::format( "- Wrong key scores: mean {:.2f}, deviation {:.2f} ({} samples)\n",
+							  calibration.m_mean_score,
+							  calibration.m_score_deviation,
+							  calibration.m_samples );
+	std::cout << std::format(
+		"- Threshold: {} (false positive rate {:.2e})\n", calibration.m_threshold, calibration.m_false_positive_rate );
+	std::cout << std::format( "- Expected false positives: {:.0f} ({:.0f} fine tuning decodes)\n",
+							  calibration.m_expected_false_positives,
+							  calibration.m_expected_fine_tune_decodes );
+}
+
+void print_kernel( const enigma::m4_solver::kernel_choice& choice )
+{
+	if ( choice.m_cached )
+	{
+		std::cout << std::format( "- Kernel: {} (cached for this host)\n", enigma::m4_solver::kernel_name( choice.m_kernel ) );
+		return;
+	}
+	std::cout << std::format( "- Kernel: {} (", enigma::m4_solver::kernel_name( choice.m_kernel ) );
+	for ( std::size_t i = 0; i < choice.m_seconds.size(); ++i )
+	{
+		const auto seconds = choice.m_seconds[ i ];
+		std::cout << std::format( "{}{} {}",
+								  i > 0 ? ", " : "",
+								  enigma::m4_solver::kernel_name( static_cast<enigma::m4_solver::kernel>( i ) ),
+								  seconds > 0 ? std::format( "{:.1f} ms", seconds * 1000 ) : std::string( "n/a" ) );
+	}
+	std::cout << ")\n";
 }
 
 auto make_cracking_progress_counter()
@@ -68,15 +108,34 @@ auto make_cracking_progress_counter()
 void break_message( std::string_view cyphertext,
 					std::string_view plaintext,
 					enigma::reflector reflector,
-					std::span<const char* const> plugs )
+					std::span<const char* const> plugs,
+					enigma::trace_recorder* trace = nullptr,
+					enigma::perf_counters* counters = nullptr,
+					enigma::hit_log* hits = nullptr )
 {
 	std::cout << std::format( "Cracking message of {} characters with {} threads\n",
 							  cyphertext.size(),
-							  std::thread::hardware_concurrency() );
+							  enigma::default_thread_pool().concurrency() );
+
+	const auto calibration = enigma::m4_solver::calibrate( cyphertext, reflector, plugs, plaintext, { .m_perf_counters = counters } );
+	print_calibration( calibration );
+
+	const auto kernel = enigma::m4_solver::autotune_kernel(
+		cyphertext, reflector, plugs, plaintext, { .m_cache_path = enigma::m4_solver::default_kernel_cache_path() } );
+	print_kernel( kernel );
 
 	auto on_update = make_cracking_progress_counter();
 
-	const auto settings = enigma::m4_solver::crack_settings( cyphertext, reflector, plugs, plaintext, on_update );
+	const auto settings = enigma::m4_solver::crack_settings( cyphertext,
+															 reflector,
+															 plugs,
+															 plaintext,
+															 on_update,
+															 { .m_calibration = calibration,
+															   .m_kernel = kernel.m_kernel,
+															   .m_trace = trace,
+															   .m_perf_counters = counters,
+															   .m_hit_log = hits } );
 
 	if ( settings )
 	{
@@ -87,6 +146,34 @@ void break_message( std::string_view cyphertext,
 	{
 		std::cout << "*** FAILED TO CRACK ENIGMA SETTINGS ***\n";
 	}
+
+	if ( counters )
+	{
+		counters->write_report( std::cout );
+	}
+}
+
+void break_message_unknown_reflector( std::string_view cyphertext, std::string_view plaintext, std::span<const char* const> plugs )
+{
+	constexpr std::array reflectors = { enigma::reflectors::B, enigma::reflectors::C };
+
+	std::cout << std::format( "Cracking message of {} characters with reflectors B and C with {} threads\n",
+							  cyphertext.size(),
+							  enigma::default_thread_pool().concurrency() );
+
+	auto on_update = make_cracking_progress_counter();
+
+	const auto result = enigma::m4_solver::crack_settings( cyphertext, reflectors, plugs, plaintext, on_update );
+
+	if ( result )
+	{
+		std::cout << std::format( "Cracked message with reflector {}!\n", result->m_reflector == 0 ? 'B' : 'C' );
+		print_settings( result->m_settings );
+	}
+	else
+	{
+		std::cout << "*** FAILED TO CRACK ENIGMA SETTINGS ***\n";
+	}
 }
 
 void break_message_with_crib( std::string_view cyphertext,
@@ -112,11 +199,20 @@ void break_message_with_crib( std::string_view cyphertext,
 							  cyphertext_with_hint.size(),
 							  crib,
 							  locations.size(),
-							  std::thread::hardware_concurrency() );
+							  enigma::default_thread_pool().concurrency() );
+
+	const auto calibration = m4_solver::calibrate_with_crib( cyphertext_with_hint, reflector, plugs, crib, locations );
+	print_calibration( calibration );
 
 	auto on_update = make_cracking_progress_counter();
 
-	auto settings = m4_solver::crack_settings_with_crib( cyphertext_with_hint, reflector, plugs, crib, locations, on_update );
+	auto settings = m4_solver::crack_settings_with_crib( cyphertext_with_hint,
+														 reflector,
+														 plugs,
+														 crib,
+														 locations,
+														 on_update,
+														 { .m_calibration = calibration } );
 	if ( !settings )
 	{
 		// No dice, probably wrong crib guess
@@ -165,12 +261,11 @@ void break_message_with_crib( std::string_view cyphertext,
 	std::cout << "*** FAILED TO FIND MATCHING SETTINGS FOR CRIB ***\n";
 }
 
-void compute_partial_scores()
+void calibrate_thresholds( std::string_view crib, std::size_t hint )
 {
 	using namespace enigma;
 
-	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
-	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	constexpr std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
 
 	for ( int i = 1; i <= 10; ++i )
 	{
@@ -178,163 +273,69 @@ void compute_partial_scores()
 		const auto cyphertext = donitz_message.substr( 0, length );
 		const auto plaintext = donitz_decoded_message.substr( 0, length );
 
-		const auto reference_score = [ & ] {
-			m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "AAAA" );
-			return partial_match_score( plaintext, result );
-		}();
-
-		std::cout << std::format( "Message length: {}, Ref: {}, Ref / Length: {:.3f}\n",
-								  length,
-								  reference_score,
-								  static_cast<float>( reference_score ) / length );
-
-		{
-			m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "YAAA" );
-			const auto score = partial_match_score( plaintext, result );
-			std::cout << std::format( "2/1: {} ({:.2f})", score, static_cast<float>( score ) / reference_score );
-		}
-
-		{
-			m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "YOAA" );
-			const auto score = partial_match_score( plaintext, result );
-			std::cout << std::format( ", 2/2: {} ({:.2f})", score, static_cast<float>( score ) / reference_score );
-		}
-
-		{
-			m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "YOOA" );
-			const auto score = partial_match_score( plaintext, result );
-			std::cout << std::format( ", 2/3: {} ({:.2f})", score, static_cast<float>( score ) / reference_score );
-		}
-
-		{
-			m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "YOOO" );
-			const auto score = partial_match_score( plaintext, result );
-			std::cout << std::format( ", 2/4: {} ({:.2f})", score, static_cast<float>( score ) / reference_score );
-		}
-
-		{
-			m4_machine machine( wheels, { 0, 0, 0, 11 }, reflectors::C, plugs );
-			const auto result = machine.decode( cyphertext, "YOOZ" );
-			const auto score = partial_match_score( plaintext, result );
-			std::cout << std::format( ", 3/4: {} ({:.2f})", score, static_cast<float>( score ) / reference_score );
-		}
-
-		std::cout << std::endl;
+		std::cout << std::format( "Message length: {}, with plugboard\n", length );
+		print_calibration( m4_solver::calibrate( cyphertext, reflectors::C, plugs, plaintext ) );
+		std::cout << std::format( "Message length: {}, without plugboard\n", length );
+		print_calibration( m4_solver::calibrate( cyphertext, reflectors::C, {}, plaintext ) );
 	}
-}
 
-std::string partial_decrypt_at( std::string_view key, std::size_t start, std::size_t location, std::size_t length, const std::span<const char* const> plugs )
-{
-	using namespace enigma;
-	constexpr std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
-	constexpr std::array ring_settings = { 0, 0, 4, 11 };
-
-	m4_machine machine( wheels, ring_settings, reflectors::C, plugs );
-	auto new_key = machine.advance_key( key, start );
-
-	for ( int i = 0; i < 4; ++i )
-	{
-		new_key[ i ] = ( new_key[ i ] - 'A' - ring_settings[ i ] ) % 26 + 'A';
-	}
+	const auto cyphertext_with_hint = donitz_message.substr( hint );
+	const auto locations = find_potential_crib_location( cyphertext_with_hint, crib );
 
-	machine = { wheels, { 0, 0, 0, 0 }, reflectors::C, plugs };
-	return machine.decode( donitz_message.substr( start, location - start + length ), new_key ).substr( location - start );
+	std::cout << std::format( "Crib: {}, length: {}, hint: {}, {} potential locations\n", crib, crib.size(), hint, locations.size() );
+	print_calibration( m4_solver::calibrate_with_crib( cyphertext_with_hint, reflectors::C, plugs, crib, locations ) );
 }
 
-std::string format_partial_decrypt( std::string_view plaintext, std::string_view candidate )
-{
-	std::string result;
-	result.reserve( candidate.size() );
-
-	for ( int i = 0; i < candidate.size(); ++i )
-	{
-		result += candidate[ i ] == plaintext[ i ] ? candidate[ i ] : '*';
-	}
-
-	return result;
-}
 
-void display_partial_decrypt_with_crib_at( std::string_view crib, std::size_t start, std::size_t location, std::span<const char* const> plugs )
+int main( int argc, char** argv )
 {
-	using enigma::partial_match_score;
+	using namespace std::literals;
 
-	{
-		const auto crib_out = partial_decrypt_at( "AAAA", start, location, crib.size(), plugs );
-		std::cout << std::format( "0: {} (score: {})\n", format_partial_decrypt( crib, crib_out ), partial_match_score( crib, crib_out ) );
-	}
+	//constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	//constexpr std::size_t hint = donitz_message.size() * 0.75f;
+	constexpr std::string_view crib = "REICHSMARSCHALLSJGOERINGJ";
+	constexpr std::size_t hint = 0;
+	//constexpr std::string_view crib = "REICHSMARSCHALL";
 
+	if ( argc >= 2 && argv[ 1 ] == "-calibrate"sv )
 	{
-		const auto crib_out = partial_decrypt_at( "YAAA", start, location, crib.size(), plugs );
-		std::cout << std::format( "1: {} (score: {})\n", format_partial_decrypt( crib, crib_out ), partial_match_score( crib, crib_out ) );
+		calibrate_thresholds( crib, hint );
 	}
-
+	else if ( argc >= 3 && argv[ 1 ] == "-serve"sv )
 	{
-		const auto crib_out = partial_decrypt_at( "YOAA", start, location, crib.size(), plugs );
-		std::cout << std::format( "2: {} (score: {})\n", format_partial_decrypt( crib, crib_out ), partial_match_score( crib, crib_out ) );
+		// Daemon mode, see enigma/server.h for the protocol
+		enigma::server::request_handler handler;
+		enigma::server::unix_socket_server server( argv[ 2 ], handler );
+		std::cout << std::format( "Listening on {} with {} threads\n", argv[ 2 ], enigma::default_thread_pool().concurrency() );
+		server.run();
 	}
-
+	else if ( argc >= 4 && argv[ 1 ] == "-request"sv )
 	{
-		const auto crib_out = partial_decrypt_at( "YOSA", start, location, crib.size(), plugs );
-		std::cout << std::format( "3: {} (score: {})\n", format_partial_decrypt( crib, crib_out ), partial_match_score( crib, crib_out ) );
+		std::cout << enigma::server::send_request( argv[ 2 ], argv[ 3 ] ) << '\n';
 	}
-
+	else if ( argc >= 3 && argv[ 1 ] == "-hits"sv )
 	{
-		const auto crib_out = partial_decrypt_at( "YOSZ", start, location, crib.size(), plugs );
-		std::cout << std::format( "4: {} (score: {})\n", format_partial_decrypt( crib, crib_out ), partial_match_score( crib, crib_out ) );
+		// Analysis of a log written with -hitlog
+		const enigma::hit_log_reader reader( argv[ 2 ] );
+		enigma::write_hit_report( reader.hits(), std::cout );
 	}
-}
-
-void display_partial_decrypt_with_crib( std::string_view crib, std::size_t hint )
-{
-	using namespace enigma;
-
-	const auto location = donitz_decoded_message.find( crib );
-	auto locations = find_potential_crib_location( donitz_message, crib );
-	std::erase_if( locations, [ hint ]( std::size_t loc ) { return loc < hint; } );
-
-	constexpr std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
-
-
-	std::cout << std::format( "Crib: {}, length: {}, hint: {}, first guess {}, correct location: {}\n",
-							  crib,
-							  crib.size(),
-							  hint,
-							  locations[ 0 ],
-							  location );
-
-	std::cout << std::format( "With plugboard from location (ref score: {})\n", partial_match_reference_score( crib.size() ) );
-	display_partial_decrypt_with_crib_at( crib, location, location, plugs );
-
-	std::cout << std::format( "With plugboard from hint (ref score: {})\n", partial_match_reference_score( crib.size() ) );
-	display_partial_decrypt_with_crib_at( crib, hint, location, plugs );
-
-	std::cout << std::format( "Without plugboard from location (ref score: {})\n", crib.size() / 10 );
-	display_partial_decrypt_with_crib_at( crib, location, location, {} );
-}
-
-
-int main( int argc, char** argv )
-{
-	using namespace std::literals;
-
-	//constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
-	//constexpr std::size_t hint = donitz_message.size() * 0.75f;
-	constexpr std::string_view crib = "REICHSMARSCHALLSJGOERINGJ";
-	constexpr std::size_t hint = 0;
-	//constexpr std::string_view crib = "REICHSMARSCHALL";
-
-	if ( argc >= 2 && argv[ 1 ] == "-scores"sv )
+	else if ( argc >= 4 && argv[ 1 ] == "-import"sv )
 	{
-		compute_partial_scores();
+		// Text intercepts, see enigma/archive.h for the format
+		std::ifstream input( argv[ 2 ] );
+		if ( !input )
+		{
+			std::cerr << std::format( "Cannot open {}\n", argv[ 2 ] );
+			return 1;
+		}
+		enigma::archive_writer archive( argv[ 3 ] );
+		const auto count = enigma::import_intercepts( input, archive );
+		archive.close();
+		std::cout << std::format( "{} intercepts written to {}\n", count, argv[ 3 ] );
 	}
-	else if ( argc >= 2 && argv[ 1 ] == "-partial"sv )
+	else if ( argc >= 3 && argv[ 1 ] == "-export"sv )
 	{
-		display_partial_decrypt_with_crib( crib, hint );
+		enigma::export_intercepts( enigma::intercept_archive( argv[ 2 ] ), std::cout );
 	}
 	else
 	{
@@ -344,6 +345,29 @@ int main( int argc, char** argv )
 		{
 			break_message_with_crib( donitz_message, donitz_decoded_message, enigma::reflectors::C, plugs, crib, hint );
 		}
+		else if ( argc >= 2 && argv[ 1 ] == "-reflector"sv )
+		{
+			break_message_unknown_reflector( donitz_message, donitz_decoded_message, plugs );
+		}
+		else if ( argc >= 3 && argv[ 1 ] == "-trace"sv )
+		{
+			// Open in chrome://tracing or ui.perfetto.dev
+			enigma::trace_recorder trace;
+			break_message( donitz_message, donitz_decoded_message, enigma::reflectors::C, plugs, &trace );
+			trace.save_chrome_trace( argv[ 2 ] );
+		}
+		else if ( argc >= 2 && argv[ 1 ] == "-perf"sv )
+		{
+			// Cycles, instructions, cache and branch misses per key for each phase, Linux only
+			enigma::perf_counters counters;
+			break_message( donitz_message, donitz_decoded_message, enigma::reflectors::C, plugs, nullptr, &counters );
+		}
+		else if ( argc >= 3 && argv[ 1 ] == "-hitlog"sv )
+		{
+			enigma::hit_log hits( argv[ 2 ] );
+			break_message( donitz_message, donitz_decoded_message, enigma::reflectors::C, plugs, nullptr, nullptr, &hits );
+			std::cout << std::format( "{} hits logged to {}\n", hits.size(), argv[ 2 ] );
+		}
 		else if ( argc >= 2 && argv[ 1 ] == "-plugboard"sv )
 		{
 			break_message( donitz_message, donitz_decoded_message, enigma::reflectors::C, {} );
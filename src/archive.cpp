@@ -0,0 +1,371 @@
+#include "enigma/archive.h"
+
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+using enigma::archive_writer;
+using enigma::archived_crib;
+using enigma::intercept_archive;
+
+namespace
+{
+	constexpr std::uint64_t padded( std::uint64_t size )
+	{
+		return ( size + 7 ) & ~std::uint64_t( 7 );
+	}
+
+	void normalize( std::string_view text, std::string& output )
+	{
+		output.clear();
+		for ( const auto character : text )
+		{
+			if ( character >= 'a' && character <= 'z' )
+			{
+				output.push_back( static_cast<char>( character - 'a' + 'A' ) );
+			}
+			else if ( character >= 'A' && character <= 'Z' )
+			{
+				output.push_back( character );
+			}
+		}
+	}
+
+	std::size_t letter_count( std::string_view text )
+	{
+		std::size_t count = 0;
+		for ( const auto character : text )
+		{
+			count += ( character >= 'a' && character <= 'z' ) || ( character >= 'A' && character <= 'Z' );
+		}
+		return count;
+	}
+
+	std::vector<std::string_view> split_words( std::string_view line )
+	{
+		std::vector<std::string_view> words;
+		while ( !line.empty() )
+		{
+			const auto start = line.find_first_not_of( " \t\r" );
+			if ( start == std::string_view::npos )
+			{
+				break;
+			}
+			line.remove_prefix( start );
+			const auto end = line.find_first_of( " \t\r" );
+			words.push_back( line.substr( 0, end ) );
+			line.remove_prefix( end == std::string_view::npos ? line.size() : end );
+		}
+		return words;
+	}
+
+	std::uint32_t parse_number( std::string_view text, std::string_view name )
+	{
+		std::uint32_t value = 0;
+		const auto [ end, error ] = std::from_chars( text.data(), text.data() + text.size(), value );
+		if ( text.empty() || error != std::errc() || end != text.data() + text.size() )
+		{
+			throw std::invalid_argument( "invalid " + std::string( name ) );
+		}
+		return value;
+	}
+
+	std::uint32_t parse_date( std::string_view text )
+	{
+		if ( text == "-" )
+		{
+			return 0;
+		}
+		if ( text.size() != 10 || text[ 4 ] != '-' || text[ 7 ] != '-' )
+		{
+			throw std::invalid_argument( "date must be YYYY-MM-DD or -" );
+		}
+		const auto year = parse_number( text.substr( 0, 4 ), "year" );
+		const auto month = parse_number( text.substr( 5, 2 ), "month" );
+		const auto day = parse_number( text.substr( 8, 2 ), "day" );
+		if ( year == 0 || month < 1 || month > 12 || day < 1 || day > 31 )
+		{
+			throw std::invalid_argument( "invalid date" );
+		}
+		return year * 10000 + month * 100 + day;
+	}
+}
+
+intercept_archive::view::view( const intercept_archive& archive, const message_record& record )
+	: m_archive( &archive )
+	, m_record( &record )
+{
+}
+
+std::string_view intercept_archive::view::message() const
+{
+	return m_archive->text( m_record->m_offset, m_record->m_length );
+}
+
+std::string_view intercept_archive::view::net() const
+{
+	if ( m_record->m_net >= m_archive->m_nets.size() )
+	{
+		throw std::runtime_error( "Corrupt intercept archive" );
+	}
+	const auto& net = m_archive->m_nets[ m_record->m_net ];
+	return m_archive->text( net.m_offset, net.m_length );
+}
+
+archived_crib intercept_archive::view::crib( std::size_t index ) const
+{
+	const auto record = std::size_t( m_record->m_first_crib ) + index;
+	if ( index >= m_record->m_crib_count || record >= m_archive->m_cribs.size() )
+	{
+		throw std::runtime_error( "Corrupt intercept archive" );
+	}
+	const auto& crib = m_archive->m_cribs[ record ];
+	return { m_archive->text( crib.m_offset, crib.m_length ), crib.m_location };
+}
+
+intercept_archive::intercept_archive( const std::string& path )
+	: m_file( path )
+{
+	const auto bytes = m_file.bytes();
+	header file_header = {};
+	if ( bytes.size() >= sizeof( file_header ) )
+	{
+		std::memcpy( &file_header, bytes.data(), sizeof( file_header ) );
+	}
+
+	// Every count is checked against the file size before computing the expected size, which cannot overflow then
+	const auto size = std::uint64_t( bytes.size() );
+	if ( bytes.size() < sizeof( file_header ) || file_header.m_magic != magic || file_header.m_version != version
+		 || file_header.m_text_size > size || file_header.m_messages > size || file_header.m_cribs > size || file_header.m_nets > size
+		 || sizeof( file_header ) + padded( file_header.m_text_size ) + file_header.m_messages * sizeof( message_record )
+					+ ( file_header.m_cribs + file_header.m_nets ) * sizeof( text_record )
+				!= size )
+	{
+		throw std::runtime_error( "Not an intercept archive: " + path );
+	}
+
+	// Records are 8 bytes aligned in the file, and the mapping is page aligned
+	const auto* data = bytes.data() + sizeof( file_header );
+	m_text = { reinterpret_cast<const char*>( data ), file_header.m_text_size };
+	data += padded( file_header.m_text_size );
+	m_messages = { reinterpret_cast<const message_record*>( data ), file_header.m_messages };
+	data += m_messages.size_bytes();
+	m_cribs = { reinterpret_cast<const text_record*>( data ), file_header.m_cribs };
+	data += m_cribs.size_bytes();
+	m_nets = { reinterpret_cast<const text_record*>( data ), file_header.m_nets };
+}
+
+std::string_view intercept_archive::text( std::uint64_t offset, std::uint32_t length ) const
+{
+	if ( offset > m_text.size() || length > m_text.size() - offset )
+	{
+		throw std::runtime_error( "Corrupt intercept archive" );
+	}
+	return m_text.substr( offset, length );
+}
+
+archive_writer::archive_writer( const std::string& path )
+	: m_file( path, std::ios::binary | std::ios::trunc )
+	, m_path( path )
+{
+	if ( !m_file )
+	{
+		throw std::runtime_error( "Cannot create intercept archive " + path );
+	}
+	// Written for real on close, once the sizes are known
+	const intercept_archive::header file_header = {};
+	m_file.write( reinterpret_cast<const char*>( &file_header ), sizeof( file_header ) );
+}
+
+archive_writer::~archive_writer()
+{
+	if ( m_file.is_open() )
+	{
+		try
+		{
+			close();
+		}
+		catch ( const std::runtime_error& )
+		{
+		}
+	}
+}
+
+void archive_writer::add( std::string_view message, std::string_view net, std::uint32_t date, std::span<const archived_crib> cribs )
+{
+	const auto length = letter_count( message );
+	for ( const auto& crib : cribs )
+	{
+		const auto crib_length = letter_count( crib.m_text );
+		if ( crib_length == 0
+			 || ( crib.m_location != archived_crib::no_location
+				  && ( crib.m_location > length || crib_length > length - crib.m_location ) ) )
+		{
+			throw std::invalid_argument( "crib " + std::string( crib.m_text ) + " does not fit in the message" );
+		}
+	}
+
+	intercept_archive::message_record record = {};
+	normalize( message, m_letters );
+	record.m_offset = write_text( m_letters );
+	record.m_length = static_cast<std::uint32_t>( m_letters.size() );
+	record.m_date = date;
+
+	auto net_index = m_net_indices.find( net );
+	if ( net_index == m_net_indices.end() )
+	{
+		const auto offset = write_text( net );
+		m_nets.push_back( { offset, static_cast<std::uint32_t>( net.size() ), 0 } );
+		net_index = m_net_indices.emplace( net, static_cast<std::uint32_t>( m_nets.size() - 1 ) ).first;
+	}
+	record.m_net = net_index->second;
+
+	record.m_first_crib = static_cast<std::uint32_t>( m_cribs.size() );
+	record.m_crib_count = static_cast<std::uint32_t>( cribs.size() );
+	for ( const auto& crib : cribs )
+	{
+		normalize( crib.m_text, m_letters );
+		const auto offset = write_text( m_letters );
+		m_cribs.push_back( { offset, static_cast<std::uint32_t>( m_letters.size() ), static_cast<std::uint32_t>( crib.m_location ) } );
+	}
+	m_messages.push_back( record );
+}
+
+std::uint64_t archive_writer::write_text( std::string_view text )
+{
+	const auto offset = m_text_size;
+	m_file.write( text.data(), static_cast<std::streamsize>( text.size() ) );
+	m_text_size += text.size();
+	return offset;
+}
+
+void archive_writer::close()
+{
+	const std::array<char, 8> padding = {};
+	m_file.write( padding.data(), static_cast<std::streamsize>( padded( m_text_size ) - m_text_size ) );
+	m_file.write( reinterpret_cast<const char*>( m_messages.data() ),
+				  static_cast<std::streamsize>( m_messages.size() * sizeof( m_messages[ 0 ] ) ) );
+	m_file.write( reinterpret_cast<const char*>( m_cribs.data() ),
+				  static_cast<std::streamsize>( m_cribs.size() * sizeof( m_cribs[ 0 ] ) ) );
+	m_file.write( reinterpret_cast<const char*>( m_nets.data() ), static_cast<std::streamsize>( m_nets.size() * sizeof( m_nets[ 0 ] ) ) );
+
+	intercept_archive::header file_header = {};
+	file_header.m_magic = intercept_archive::magic;
+	file_header.m_version = intercept_archive::version;
+	file_header.m_text_size = m_text_size;
+	file_header.m_messages = m_messages.size();
+	file_header.m_cribs = m_cribs.size();
+	file_header.m_nets = m_nets.size();
+	m_file.seekp( 0 );
+	m_file.write( reinterpret_cast<const char*>( &file_header ), sizeof( file_header ) );
+
+	m_file.close();
+	if ( !m_file )
+	{
+		throw std::runtime_error( "Cannot write intercept archive " + m_path );
+	}
+}
+
+std::vector<enigma::m4_solver::crib> enigma::solver_cribs( const intercept_archive::view& intercept )
+{
+	std::vector<m4_solver::crib> cribs;
+	cribs.reserve( intercept.crib_count() );
+	for ( std::size_t i = 0; i < intercept.crib_count(); ++i )
+	{
+		const auto crib = intercept.crib( i );
+		if ( crib.m_location == archived_crib::no_location )
+		{
+			cribs.push_back( { crib.m_text, find_potential_crib_location( intercept.message(), crib.m_text ) } );
+		}
+		else
+		{
+			cribs.push_back( { crib.m_text, { crib.m_location } } );
+		}
+	}
+	return cribs;
+}
+
+void enigma::decode_intercepts( const m4_machine& machine,
+								std::span<const intercept_archive::view> intercepts,
+								std::span<const key> keys,
+								std::span<char> output )
+{
+	std::size_t offset = 0;
+	for ( std::size_t i = 0; i < intercepts.size(); ++i )
+	{
+		const auto message = intercepts[ i ].message();
+		machine.decode( message, keys[ i ], output.subspan( offset, message.size() ) );
+		offset += message.size();
+	}
+}
+
+std::size_t enigma::import_intercepts( std::istream& input, archive_writer& archive )
+{
+	std::size_t count = 0;
+	std::size_t line_number = 0;
+	std::string line;
+	std::vector<archived_crib> cribs;
+	while ( std::getline( input, line ) )
+	{
+		++line_number;
+		const auto words = split_words( line );
+		if ( words.empty() || words.front().starts_with( '#' ) )
+		{
+			continue;
+		}
+
+		try
+		{
+			if ( words.size() < 3 )
+			{
+				throw std::invalid_argument( "expected net, date and message" );
+			}
+			if ( letter_count( words[ 2 ] ) == 0 )
+			{
+				throw std::invalid_argument( "message has no letters" );
+			}
+
+			cribs.clear();
+			for ( std::size_t i = 3; i < words.size(); ++i )
+			{
+				const auto at = words[ i ].rfind( '@' );
+				cribs.push_back( { words[ i ].substr( 0, at ),
+								   at == std::string_view::npos ? archived_crib::no_location
+																: parse_number( words[ i ].substr( at + 1 ), "crib location" ) } );
+			}
+			archive.add( words[ 2 ], words[ 0 ] == "-" ? std::string_view() : words[ 0 ], parse_date( words[ 1 ] ), cribs );
+			++count;
+		}
+		catch ( const std::invalid_argument& error )
+		{
+			throw std::runtime_error( std::format( "Line {}: {}", line_number, error.what() ) );
+		}
+	}
+	return count;
+}
+
+void enigma::export_intercepts( const intercept_archive& archive, std::ostream& output )
+{
+	for ( std::size_t i = 0; i < archive.size(); ++i )
+	{
+		const auto intercept = archive[ i ];
+		const auto net = intercept.net();
+		const auto date = intercept.date();
+		output << ( net.empty() ? "-" : net ) << ' '
+			   << ( date == 0 ? std::string( "-" ) : std::format( "{:04}-{:02}-{:02}", date / 10000, date / 100 % 100, date % 100 ) ) << ' '
+			   << intercept.message();
+		for ( std::size_t c = 0; c < intercept.crib_count(); ++c )
+		{
+			const auto crib = intercept.crib( c );
+			output << ' ' << crib.m_text;
+			if ( crib.m_location != archived_crib::no_location )
+			{
+				output << '@' << crib.m_location;
+			}
+		}
+		output << '\n';
+	}
+}
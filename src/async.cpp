@@ -0,0 +1,203 @@
+#include "enigma/async.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace enigma;
+using m4_solver::crack_job;
+using m4_solver::executor;
+
+executor::executor( std::size_t workers )
+{
+	m_workers.reserve( workers );
+	for ( std::size_t i = 0; i < std::max<std::size_t>( workers, 1 ); ++i )
+	{
+		m_workers.emplace_back( [ this ]( std::stop_token stop_token ) { run( stop_token ); } );
+	}
+}
+
+executor::~executor()
+{
+	for ( auto& worker : m_workers )
+	{
+		worker.request_stop();
+	}
+	m_task_ready.notify_all();
+}
+
+void executor::submit( std::function<void()> task, int priority )
+{
+	{
+		std::lock_guard lock( m_mutex );
+		const auto position = std::find_if( begin( m_tasks ), end( m_tasks ), [ priority ]( const pending_task& pending ) {
+			return pending.m_priority < priority;
+		} );
+		m_tasks.insert( position, { priority, std::move( task ) } );
+	}
+	m_task_ready.notify_one();
+}
+
+void executor::run( std::stop_token stop_token )
+{
+	while ( true )
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock lock( m_mutex );
+			// Keep going until the queue is drained, even once stop is requested
+			m_task_ready.wait( lock, stop_token, [ this ] { return !m_tasks.empty(); } );
+			if ( m_tasks.empty() )
+			{
+				return;
+			}
+			task = std::move( m_tasks.front().m_function );
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+struct crack_job::state
+{
+	std::mutex m_mutex;
+	std::condition_variable m_candidate_ready;
+	std::deque<settings> m_candidates;
+	std::size_t m_dropped = 0;
+	bool m_finished = false;
+	std::stop_source m_stop;
+};
+
+std::optional<m4_solver::settings> crack_job::get() const
+{
+	return m_result.get();
+}
+
+bool crack_job::ready() const
+{
+	return m_result.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+}
+
+std::optional<m4_solver::settings> crack_job::next_candidate()
+{
+	std::unique_lock lock( m_state->m_mutex );
+	m_state->m_candidate_ready.wait( lock, [ this ] { return m_state->m_finished || !m_state->m_candidates.empty(); } );
+	if ( m_state->m_candidates.empty() )
+	{
+		return std::nullopt;
+	}
+
+	auto candidate = std::move( m_state->m_candidates.front() );
+	m_state->m_candidates.pop_front();
+	return candidate;
+}
+
+std::size_t crack_job::dropped_candidates() const
+{
+	std::lock_guard lock( m_state->m_mutex );
+	return m_state->m_dropped;
+}
+
+void crack_job::cancel()
+{
+	m_state->m_stop.request_stop();
+}
+
+template <typename crack_type>
+crack_job crack_job::start( executor& executor, std::span<const char* const> plugs, crack_type crack, const options& options )
+{
+	crack_job job;
+	job.m_state = std::make_shared<state>();
+
+	auto promise = std::make_shared<std::promise<std::optional<settings>>>();
+	job.m_result = promise->get_future().share();
+
+	auto job_options = options;
+	job_options.m_stop_token = job.m_state->m_stop.get_token();
+	job_options.m_on_candidate = [ state = job.m_state.get(), on_candidate = options.m_on_candidate ]( const settings& candidate ) {
+		if ( on_candidate )
+		{
+			on_candidate( candidate );
+		}
+		{
+			// Callers only waiting for the result never read them, keep memory bounded
+			std::lock_guard lock( state->m_mutex );
+			if ( state->m_candidates.size() == candidate_capacity )
+			{
+				state->m_candidates.pop_front();
+				++state->m_dropped;
+			}
+			state->m_candidates.push_back( candidate );
+		}
+		state->m_candidate_ready.notify_all();
+	};
+
+	// Plugs are usually string literals but nothing guarantees it, keep a copy
+	std::vector<std::string> plug_storage( begin( plugs ), end( plugs ) );
+
+	auto task = [ state = job.m_state,
+				   promise = std::move( promise ),
+				   plug_storage = std::move( plug_storage ),
+				   crack = std::move( crack ),
+				   job_options = std::move( job_options ) ] {
+		std::vector<const char*> plugs;
+		plugs.reserve( plug_storage.size() );
+		for ( const auto& plug : plug_storage )
+		{
+			plugs.push_back( plug.c_str() );
+		}
+
+		try
+		{
+			promise->set_value( crack( plugs, job_options ) );
+		}
+		catch ( ... )
+		{
+			promise->set_exception( std::current_exception() );
+		}
+
+		{
+			std::lock_guard lock( state->m_mutex );
+			state->m_finished = true;
+		}
+		state->m_candidate_ready.notify_all();
+	};
+	executor.submit( std::move( task ), options.m_priority );
+
+	return job;
+}
+
+crack_job m4_solver::crack_settings_async( executor& executor,
+										   std::string_view message,
+										   reflector reflector,
+										   std::span<const char* const> plugs,
+										   std::string_view plaintext,
+										   const options& options )
+{
+	return crack_job::start( executor,
+							 plugs,
+							 [ message = std::string( message ), reflector, plaintext = std::string( plaintext ) ](
+								 std::span<const char* const> plugs, const m4_solver::options& options ) {
+								 return crack_settings( message, reflector, plugs, plaintext, {}, options );
+							 },
+							 options );
+}
+
+crack_job m4_solver::crack_settings_with_crib_async( executor& executor,
+													 std::string_view message,
+													 reflector reflector,
+													 std::span<const char* const> plugs,
+													 std::string_view crib,
+													 std::span<const std::size_t> crib_locations,
+													 const options& options )
+{
+	return crack_job::start( executor,
+							 plugs,
+							 [ message = std::string( message ),
+							   reflector,
+							   crib = std::string( crib ),
+							   crib_locations = std::vector<std::size_t>( begin( crib_locations ), end( crib_locations ) ) ](
+								 std::span<const char* const> plugs, const m4_solver::options& options ) {
+								 return crack_settings_with_crib( message, reflector, plugs, crib, crib_locations, {}, options );
+							 },
+							 options );
+}
@@ -0,0 +1,291 @@
+#include "enigma/autotune.h"
+#include "enigma/bitsliced.h"
+#include "enigma/tiled.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace enigma;
+using m4_solver::kernel;
+
+namespace
+{
+	constexpr std::array kernels = { kernel::scalar, kernel::bitsliced_64, kernel::bitsliced_256, kernel::bitsliced_512, kernel::tiled };
+
+	// Keys checked again when a choice comes from the cache, in case the file moved to another machine
+	constexpr std::size_t cached_validation_keys = 512;
+
+	const std::array<rotor, 4> sample_wheels = { rotors[ 9 ], rotors[ 1 ], rotors[ 2 ], rotors[ 3 ] };
+
+	struct sample
+	{
+		std::string_view m_message;
+		std::string_view m_plaintext;
+		reflector m_reflector;
+		std::span<const char* const> m_plugs;
+		std::size_t m_keys;
+	};
+
+	// Scores of the scalar kernel for each sample key
+	std::vector<std::size_t> scalar_scores( const sample& sample )
+	{
+		const m4_machine machine( sample_wheels, { 0, 0, 0, 0 }, sample.m_reflector, sample.m_plugs );
+		std::string buffer( sample.m_message.size(), 'A' );
+
+		std::vector<std::size_t> scores;
+		scores.reserve( sample.m_keys );
+		for ( const auto key : key_range( 0, static_cast<std::uint32_t>( sample.m_keys ) ) )
+		{
+			machine.decode( sample.m_message, key, std::span<char>( buffer ) );
+			scores.push_back( partial_match_score( sample.m_plaintext, buffer ) );
+		}
+		return scores;
+	}
+
+	std::vector<bool> above( std::span<const std::size_t> scores, std::size_t threshold )
+	{
+		std::vector<bool> matches( scores.size() );
+		std::transform( begin( scores ), end( scores ), begin( matches ), [ & ]( std::size_t score ) { return score >= threshold; } );
+		return matches;
+	}
+
+	template <std::size_t words>
+	std::vector<bool> bitsliced_matches( const sample& sample, std::size_t threshold )
+	{
+		const bitsliced_m4_machine<words> machine( sample_wheels, { 0, 0, 0, 0 }, sample.m_reflector, sample.m_plugs );
+		constexpr auto lanes = bitsliced_m4_machine<words>::lanes;
+
+		std::vector<bool> matches( sample.m_keys );
+		for ( std::size_t block = 0; block < sample.m_keys; block += lanes )
+		{
+			const auto count = std::min( lanes, sample.m_keys - block );
+			const auto found = machine.partial_match(
+				sample.m_message, key::from_index( static_cast<std::uint32_t>( block ) ), count, sample.m_plaintext, threshold );
+			for ( std::size_t lane = 0; lane < count; ++lane )
+			{
+				matches[ block + lane ] = found.test( lane );
+			}
+		}
+		return matches;
+	}
+
+	std::vector<bool> tiled_matches( const sample& sample, std::size_t threshold )
+	{
+		constexpr std::size_t blocks = 26 * 26;
+		auto fast_tables
+			= std::make_shared<const fast_rotor_tables>( sample_wheels[ 2 ], sample_wheels[ 3 ], std::array { 0, 0 }, sample.m_plugs );
+		const tiled_m4_machine machine( sample_wheels, { 0, 0, 0, 0 }, sample.m_reflector, std::move( fast_tables ) );
+
+		std::vector<bool> matches( sample.m_keys );
+		for ( std::size_t middle_right = 0; middle_right < std::min( blocks, sample.m_keys ); ++middle_right )
+		{
+			// Sample keys only, which have the lowest greek and left letters
+			tiled_m4_machine::key_block block;
+			for ( std::size_t i = 0; i * blocks + middle_right < sample.m_keys; ++i )
+			{
+				block.set( i );
+			}
+			const auto found = machine.partial_match(
+				sample.m_message, key::from_index( static_cast<std::uint32_t>( middle_right ) ), block, sample.m_plaintext, threshold );
+			for ( std::size_t i = 0; i * blocks + middle_right < sample.m_keys; ++i )
+			{
+				matches[ i * blocks + middle_right ] = found.test( i );
+			}
+		}
+		return matches;
+	}
+
+	std::vector<bool> kernel_matches( kernel kernel, const sample& sample, std::size_t threshold )
+	{
+		switch ( kernel )
+		{
+			case kernel::bitsliced_64:
+				return bitsliced_matches<1>( sample, threshold );
+			case kernel::bitsliced_256:
+				return bitsliced_matches<4>( sample, threshold );
+			case kernel::bitsliced_512:
+				return bitsliced_matches<8>( sample, threshold );
+			case kernel::tiled:
+				return tiled_matches( sample, threshold );
+			default:
+				return above( scalar_scores( sample ), threshold );
+		}
+	}
+
+	// Median score, so that about half the keys match and a kernel flagging the wrong ones shows
+	std::size_t validation_threshold( std::vector<std::size_t> scores )
+	{
+		std::nth_element( begin( scores ), begin( scores ) + scores.size() / 2, end( scores ) );
+		return std::max<std::size_t>( scores[ scores.size() / 2 ], 1 );
+	}
+
+	bool validate( kernel kernel, const sample& sample )
+	{
+		const auto scores = scalar_scores( sample );
+		const auto threshold = validation_threshold( scores );
+		return kernel_matches( kernel, sample, threshold ) == above( scores, threshold );
+	}
+
+	// CPU model and thread count, what the timings depend on besides the message
+	std::string host_name()
+	{
+		std::string model = "unknown";
+		std::ifstream cpuinfo( "/proc/cpuinfo" );
+		for ( std::string line; std::getline( cpuinfo, line ); )
+		{
+			if ( line.starts_with( "model name" ) )
+			{
+				const auto colon = line.find( ':' );
+				model = line.substr( std::min( colon + 2, line.size() ) );
+				break;
+			}
+		}
+		return model + " x" + std::to_string( std::thread::hardware_concurrency() );
+	}
+
+	// Lengths within a factor 2 share their choice
+	std::string cache_entry( std::string_view message )
+	{
+		return host_name() + '\t' + std::to_string( std::bit_ceil( message.size() ) ) + '\t';
+	}
+
+	std::optional<kernel> read_cache( const std::string& path, const std::string& entry )
+	{
+		std::optional<kernel> result;
+		std::ifstream file( path );
+		for ( std::string line; std::getline( file, line ); )
+		{
+			if ( line.starts_with( entry ) )
+			{
+				const auto name = std::string_view( line ).substr( entry.size() );
+				const auto found = std::find_if(
+					begin( kernels ), end( kernels ), [ & ]( kernel kernel ) { return m4_solver::kernel_name( kernel ) == name; } );
+				if ( found != end( kernels ) )
+				{
+					// Later lines win
+					result = *found;
+				}
+			}
+		}
+		return result;
+	}
+
+	// Best effort, a read only home just means tuning again next time
+	void write_cache( const std::string& path, const std::string& entry, kernel kernel )
+	{
+		std::error_code error;
+		const auto directory = std::filesystem::path( path ).parent_path();
+		if ( !directory.empty() )
+		{
+			std::filesystem::create_directories( directory, error );
+		}
+		std::ofstream file( path, std::ios::app );
+		file << entry << m4_solver::kernel_name( kernel ) << '\n';
+	}
+}
+
+m4_solver::kernel_choice m4_solver::autotune_kernel( std::string_view message,
+													 reflector reflector,
+													 std::span<const char* const> plugs,
+													 std::string_view plaintext,
+													 const autotune_options& options )
+{
+	kernel_choice choice;
+	if ( plugs.empty() || message.empty() )
+	{
+		return choice;
+	}
+
+	const auto length = std::min( message.size(), plaintext.size() );
+	const sample sample = { message.substr( 0, length ),
+							plaintext.substr( 0, length ),
+							reflector,
+							plugs,
+							std::clamp<std::size_t>( options.m_sample_keys, 1, 26 * 26 * 26 ) };
+
+	const auto entry = cache_entry( message );
+	if ( !options.m_cache_path.empty() )
+	{
+		if ( const auto cached = read_cache( options.m_cache_path, entry ) )
+		{
+			auto check = sample;
+			check.m_keys = std::min( check.m_keys, cached_validation_keys );
+			if ( validate( *cached, check ) )
+			{
+				choice.m_kernel = *cached;
+				choice.m_cached = true;
+				return choice;
+			}
+		}
+	}
+
+	// Scalar first, it gives the threshold the others are checked with
+	auto start = std::chrono::steady_clock::now();
+	const auto scores = scalar_scores( sample );
+	choice.m_seconds[ 0 ] = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+	const auto threshold = validation_threshold( scores );
+	const auto reference = above( scores, threshold );
+
+	for ( std::size_t i = 1; i < kernels.size(); ++i )
+	{
+		start = std::chrono::steady_clock::now();
+		const auto matches = kernel_matches( kernels[ i ], sample, threshold );
+		const auto seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+		if ( matches == reference )
+		{
+			choice.m_seconds[ i ] = seconds;
+			if ( seconds < choice.m_seconds[ static_cast<std::size_t>( choice.m_kernel ) ] )
+			{
+				choice.m_kernel = kernels[ i ];
+			}
+		}
+	}
+
+	if ( !options.m_cache_path.empty() )
+	{
+		write_cache( options.m_cache_path, entry, choice.m_kernel );
+	}
+	return choice;
+}
+
+std::string m4_solver::default_kernel_cache_path()
+{
+	if ( const char* cache = std::getenv( "XDG_CACHE_HOME" ); cache && *cache )
+	{
+		return std::string( cache ) + "/enigma/kernels";
+	}
+	if ( const char* home = std::getenv( "HOME" ); home && *home )
+	{
+		return std::string( home ) + "/.cache/enigma/kernels";
+	}
+	return {};
+}
+
+std::string_view m4_solver::kernel_name( kernel kernel )
+{
+	switch ( kernel )
+	{
+		case kernel::bitsliced_64:
+			return "bitsliced_64";
+		case kernel::bitsliced_256:
+			return "bitsliced_256";
+		case kernel::bitsliced_512:
+			return "bitsliced_512";
+		case kernel::tiled:
+			return "tiled";
+		default:
+			return "scalar";
+	}
+}
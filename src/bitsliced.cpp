@@ -0,0 +1,435 @@
+#include "enigma/bitsliced.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+using enigma::bitsliced_m4_machine;
+using enigma::lane_mask;
+
+namespace
+{
+	// A letter (0-25) per lane, plane n holding bit n
+	template <std::size_t words>
+	using letter = std::array<lane_mask<words>, 5>;
+
+	template <std::size_t words>
+	letter<words> broadcast( int value )
+	{
+		letter<words> result;
+		for ( int plane = 0; plane < 5; ++plane )
+		{
+			result[ plane ] = lane_mask<words>::filled( ( value >> plane ) & 1 );
+		}
+		return result;
+	}
+
+	// Lanes holding value (none if value is -1)
+	template <std::size_t words>
+	lane_mask<words> equals( const letter<words>& input, int value )
+	{
+		if ( value < 0 )
+		{
+			return lane_mask<words>::filled( false );
+		}
+
+		auto result = ( value & 1 ) ? input[ 0 ] : ~input[ 0 ];
+		for ( int plane = 1; plane < 5; ++plane )
+		{
+			result = result & ( ( ( value >> plane ) & 1 ) ? input[ plane ] : ~input[ plane ] );
+		}
+		return result;
+	}
+
+	template <std::size_t words>
+	letter<words> add( const letter<words>& a, const letter<words>& b )
+	{
+		letter<words> sum;
+		auto carry = lane_mask<words>::filled( false );
+		for ( int plane = 0; plane < 5; ++plane )
+		{
+			const auto half = a[ plane ] ^ b[ plane ];
+			sum[ plane ] = half ^ carry;
+			carry = ( a[ plane ] & b[ plane ] ) | ( half & carry );
+		}
+
+		// Sum >= 26, bring it back by adding 6 modulo 32
+		const auto wrap = carry | ( sum[ 4 ] & sum[ 3 ] & ( sum[ 2 ] | sum[ 1 ] ) );
+		carry = sum[ 1 ] & wrap;
+		sum[ 1 ] = sum[ 1 ] ^ wrap;
+		const auto next_carry = wrap & ( sum[ 2 ] | carry );
+		sum[ 2 ] = sum[ 2 ] ^ wrap ^ carry;
+		carry = sum[ 3 ] & next_carry;
+		sum[ 3 ] = sum[ 3 ] ^ next_carry;
+		sum[ 4 ] = sum[ 4 ] ^ carry;
+
+		return sum;
+	}
+
+	template <std::size_t words>
+	letter<words> subtract( const letter<words>& a, const letter<words>& b )
+	{
+		letter<words> difference;
+		auto borrow = lane_mask<words>::filled( false );
+		for ( int plane = 0; plane < 5; ++plane )
+		{
+			const auto half = a[ plane ] ^ b[ plane ];
+			difference[ plane ] = half ^ borrow;
+			borrow = ( ~a[ plane ] & b[ plane ] ) | ( ~half & borrow );
+		}
+
+		// Negative, add 26 modulo 32
+		auto carry = difference[ 1 ] & borrow;
+		difference[ 1 ] = difference[ 1 ] ^ borrow;
+		const auto next_carry = difference[ 2 ] & carry;
+		difference[ 2 ] = difference[ 2 ] ^ carry;
+		carry = borrow & ( difference[ 3 ] | next_carry );
+		difference[ 3 ] = difference[ 3 ] ^ borrow ^ next_carry;
+		difference[ 4 ] = difference[ 4 ] ^ borrow ^ carry;
+
+		return difference;
+	}
+
+	// Add one modulo 26 to lanes in mask
+	template <std::size_t words>
+	void increment( letter<words>& input, lane_mask<words> mask )
+	{
+		for ( int plane = 0; plane < 5; ++plane )
+		{
+			const auto carry = input[ plane ] & mask;
+			input[ plane ] = input[ plane ] ^ mask;
+			mask = carry;
+		}
+
+		// 26 is the only reachable value with planes 1, 3 and 4 set
+		const auto wrap = ~( input[ 4 ] & input[ 3 ] & input[ 1 ] );
+		input[ 1 ] = input[ 1 ] & wrap;
+		input[ 3 ] = input[ 3 ] & wrap;
+		input[ 4 ] = input[ 4 ] & wrap;
+	}
+
+	// Boolean circuit for a substitution: decode each input value to a lane mask, then OR them into the output planes
+	template <std::size_t words>
+	letter<words> substitute( const letter<words>& input, const std::array<char, 26>& table )
+	{
+		const std::array<lane_mask<words>, 4> low = { ~input[ 1 ] & ~input[ 0 ],
+													  ~input[ 1 ] & input[ 0 ],
+													  input[ 1 ] & ~input[ 0 ],
+													  input[ 1 ] & input[ 0 ] };
+		const auto high_0 = ~input[ 4 ] & ~input[ 3 ];
+		const auto high_1 = ~input[ 4 ] & input[ 3 ];
+		const auto high_2 = input[ 4 ] & ~input[ 3 ];
+		const auto high_3 = input[ 4 ] & input[ 3 ];
+		const std::array<lane_mask<words>, 7> high = { high_0 & ~input[ 2 ], high_0 & input[ 2 ], high_1 & ~input[ 2 ],
+													   high_1 & input[ 2 ],	 high_2 & ~input[ 2 ], high_2 & input[ 2 ],
+													   high_3 & ~input[ 2 ] };
+
+		letter<words> result = broadcast<words>( 0 );
+		for ( int value = 0; value < 26; ++value )
+		{
+			const auto minterm = low[ value & 3 ] & high[ value >> 2 ];
+			const int output = table[ value ];
+			for ( int plane = 0; plane < 5; ++plane )
+			{
+				if ( ( output >> plane ) & 1 )
+				{
+					result[ plane ] = result[ plane ] | minterm;
+				}
+			}
+		}
+		return result;
+	}
+
+	// Vertical counter, one bit plane per bit of the count (least significant first), kept on the stack
+	template <std::size_t words>
+	class counter_planes
+	{
+	public:
+		[[nodiscard]] std::size_t size() const { return m_size; }
+		[[nodiscard]] bool empty() const { return m_size == 0; }
+
+		lane_mask<words>& operator[]( std::size_t plane ) { return m_planes[ plane ]; }
+		const lane_mask<words>& operator[]( std::size_t plane ) const { return m_planes[ plane ]; }
+		const lane_mask<words>& back() const { return m_planes[ m_size - 1 ]; }
+
+		lane_mask<words>* begin() { return m_planes.data(); }
+		lane_mask<words>* end() { return m_planes.data() + m_size; }
+
+		void push_back( lane_mask<words> plane )
+		{
+			assert( m_size < m_planes.size() );
+			m_planes[ m_size++ ] = plane;
+		}
+		void pop_back() { --m_size; }
+
+	private:
+		std::array<lane_mask<words>, 64> m_planes;
+		std::size_t m_size = 0;
+	};
+
+	// Add mask (one bit per lane) at the given plane of a vertical counter, growing the counter if needed
+	template <std::size_t words>
+	void add_at( counter_planes<words>& counter, std::size_t plane, lane_mask<words> mask )
+	{
+		for ( ; mask.any(); ++plane )
+		{
+			if ( plane == counter.size() )
+			{
+				counter.push_back( mask );
+				return;
+			}
+			const auto carry = counter[ plane ] & mask;
+			counter[ plane ] = counter[ plane ] ^ mask;
+			mask = carry;
+		}
+	}
+
+	// Lanes where counter >= value
+	template <std::size_t words>
+	lane_mask<words> greater_or_equal( const counter_planes<words>& counter, std::size_t value )
+	{
+		if ( std::bit_width( value ) > counter.size() )
+		{
+			return lane_mask<words>::filled( false );
+		}
+
+		// Borrow out of counter - value
+		auto borrow = lane_mask<words>::filled( false );
+		for ( std::size_t plane = 0; plane < counter.size(); ++plane )
+		{
+			if ( ( value >> plane ) & 1 )
+			{
+				borrow = ~counter[ plane ] | borrow;
+			}
+			else
+			{
+				borrow = ~counter[ plane ] & borrow;
+			}
+		}
+		return ~borrow;
+	}
+
+}
+
+template <std::size_t words>
+struct bitsliced_m4_machine<words>::state
+{
+	int m_greek_offset;
+	// Middle left, middle right and right rotors offsets
+	std::array<letter<words>, 3> m_offsets;
+	letter<words> m_middle_left_to_right;
+	letter<words> m_middle_right_to_left;
+};
+
+template <std::size_t words>
+bitsliced_m4_machine<words>::bitsliced_m4_machine( const std::array<rotor, 4>& rotors,
+												   std::array<int, 4> ring_settings,
+												   reflector reflector,
+												   std::span<const char* const> plugs )
+	: m_ring_settings( ring_settings )
+{
+	for ( int i = 0; i < 4; ++i )
+	{
+		for ( int j = 0; j < 26; ++j )
+		{
+			m_forward[ i ][ j ] = rotors[ i ].m_wiring[ j ] - 'A';
+			m_backward[ i ][ j ] = rotors[ i ].m_reversed_wiring[ j ] - 'A';
+		}
+		for ( int j = 0; j < 2; ++j )
+		{
+			const int turnover = rotors[ i ].m_turnovers[ j ];
+			m_turnovers[ i ][ j ] = turnover == -1 ? -1 : ( turnover + 26 - ring_settings[ i ] ) % 26;
+		}
+	}
+
+	for ( int offset = 0; offset < 26; ++offset )
+	{
+		for ( int input = 0; input < 26; ++input )
+		{
+			int output = m_forward[ 0 ][ ( input + offset ) % 26 ];
+			output = reflector.m_wiring[ ( output - offset + 26 ) % 26 ] - 'A';
+			output = m_backward[ 0 ][ ( output + offset ) % 26 ];
+			m_folded_reflector[ offset ][ input ] = ( output - offset + 26 ) % 26;
+		}
+	}
+
+	for ( int i = 0; i < 26; ++i )
+	{
+		m_plugboard[ i ] = i;
+	}
+
+	for ( auto pair : plugs )
+	{
+		m_plugboard[ pair[ 0 ] - 'A' ] = pair[ 1 ] - 'A';
+		m_plugboard[ pair[ 1 ] - 'A' ] = pair[ 0 ] - 'A';
+	}
+}
+
+template <std::size_t words>
+typename bitsliced_m4_machine<words>::state bitsliced_m4_machine<words>::load( key first_key, std::size_t count ) const
+{
+	assert( count > 0 && count <= lanes );
+	const int first_index = static_cast<int>( first_key.index() );
+	assert( first_index / ( 26 * 26 * 26 ) == ( first_index + static_cast<int>( count ) - 1 ) / ( 26 * 26 * 26 ) );
+
+	state result;
+	result.m_greek_offset = ( first_key[ 0 ] - 'A' - m_ring_settings[ 0 ] + 26 ) % 26;
+	for ( auto& offsets : result.m_offsets )
+	{
+		offsets = broadcast<words>( 0 );
+	}
+
+	// Unused lanes repeat the first key
+	for ( std::size_t lane = 0; lane < lanes; ++lane )
+	{
+		const int index = first_index + static_cast<int>( lane < count ? lane : 0 );
+		const std::array<int, 3> positions = { index / 676 % 26, index / 26 % 26, index % 26 };
+		for ( int rotor = 0; rotor < 3; ++rotor )
+		{
+			const int offset = ( positions[ rotor ] - m_ring_settings[ rotor + 1 ] + 26 ) % 26;
+			for ( int plane = 0; plane < 5; ++plane )
+			{
+				if ( ( offset >> plane ) & 1 )
+				{
+					result.m_offsets[ rotor ][ plane ].m_words[ lane / 64 ] |= std::uint64_t( 1 ) << ( lane % 64 );
+				}
+			}
+		}
+	}
+
+	result.m_middle_left_to_right = subtract( result.m_offsets[ 0 ], result.m_offsets[ 1 ] );
+	result.m_middle_right_to_left = subtract( result.m_offsets[ 1 ], result.m_offsets[ 0 ] );
+
+	return result;
+}
+
+template <std::size_t words>
+void bitsliced_m4_machine<words>::step( state& state ) const
+{
+	auto& [ middle_left, middle_right, right ] = state.m_offsets;
+
+	const auto right_turnover = equals( right, m_turnovers[ 3 ][ 0 ] ) | equals( right, m_turnovers[ 3 ][ 1 ] );
+	const auto middle_right_turnover = equals( middle_right, m_turnovers[ 2 ][ 0 ] ) | equals( middle_right, m_turnovers[ 2 ][ 1 ] );
+	const auto middle_right_step = right_turnover | middle_right_turnover;
+
+	if ( middle_right_step.any() )
+	{
+		increment( middle_right, middle_right_step );
+		increment( middle_left, ~right_turnover & middle_right_turnover );
+		state.m_middle_left_to_right = subtract( middle_left, middle_right );
+		state.m_middle_right_to_left = subtract( middle_right, middle_left );
+	}
+	increment( right, lane_mask<words>::filled( true ) );
+}
+
+// Output is before the plugboard so that comparisons can be made against a plugged constant instead
+template <std::size_t words>
+void bitsliced_m4_machine<words>::encode( state& state, char input, letter<words>& output ) const
+{
+	const auto& [ middle_left, middle_right, right ] = state.m_offsets;
+
+	auto value = add( broadcast<words>( m_plugboard[ input - 'A' ] ), right );
+	value = substitute( value, m_forward[ 3 ] );
+	value = add( value, subtract( middle_right, right ) );
+	value = substitute( value, m_forward[ 2 ] );
+	value = add( value, state.m_middle_left_to_right );
+	value = substitute( value, m_forward[ 1 ] );
+	value = subtract( value, middle_left );
+
+	value = substitute( value, m_folded_reflector[ state.m_greek_offset ] );
+
+	value = add( value, middle_left );
+	value = substitute( value, m_backward[ 1 ] );
+	value = add( value, state.m_middle_right_to_left );
+	value = substitute( value, m_backward[ 2 ] );
+	value = add( value, subtract( right, middle_right ) );
+	value = substitute( value, m_backward[ 3 ] );
+	output = subtract( value, right );
+}
+
+template <std::size_t words>
+void bitsliced_m4_machine<words>::decode( std::string_view message,
+										  key first_key,
+										  std::size_t count,
+										  std::span<std::string> outputs ) const
+{
+	auto state = load( first_key, count );
+
+	for ( std::size_t lane = 0; lane < count; ++lane )
+	{
+		outputs[ lane ].resize( message.size() );
+	}
+
+	letter<words> output;
+	for ( std::size_t position = 0; position < message.size(); ++position )
+	{
+		step( state );
+		encode( state, message[ position ], output );
+		for ( std::size_t lane = 0; lane < count; ++lane )
+		{
+			int value = 0;
+			for ( int plane = 0; plane < 5; ++plane )
+			{
+				value |= output[ plane ].test( lane ) << plane;
+			}
+			outputs[ lane ][ position ] = 'A' + m_plugboard[ value ];
+		}
+	}
+}
+
+template <std::size_t words>
+lane_mask<words> bitsliced_m4_machine<words>::partial_match( std::string_view message,
+															 key first_key,
+															 std::size_t count,
+															 std::string_view plaintext,
+															 std::size_t threshold ) const
+{
+	auto state = load( first_key, count );
+
+	// partial_match_score adds the square of each run length, that is 2 * run + 1 for each matching letter
+	counter_planes<words> score;
+	counter_planes<words> run;
+
+	letter<words> output;
+	const std::size_t length = std::min( message.size(), plaintext.size() );
+	for ( std::size_t position = 0; position < length; ++position )
+	{
+		step( state );
+		encode( state, message[ position ], output );
+		const auto match = equals( output, m_plugboard[ plaintext[ position ] - 'A' ] );
+
+		add_at( score, 0, match );
+		for ( std::size_t plane = 0; plane < run.size(); ++plane )
+		{
+			add_at( score, plane + 1, run[ plane ] & match );
+		}
+
+		// run = ( run + 1 ) if match, 0 otherwise
+		auto carry = match;
+		for ( auto& plane : run )
+		{
+			const auto next_carry = plane & carry;
+			plane = ( plane ^ carry ) & match;
+			carry = next_carry;
+		}
+		if ( carry.any() )
+		{
+			run.push_back( carry );
+		}
+		while ( !run.empty() && !run.back().any() )
+		{
+			run.pop_back();
+		}
+	}
+
+	auto result = greater_or_equal( score, threshold );
+	for ( std::size_t lane = count; lane < lanes; ++lane )
+	{
+		result.m_words[ lane / 64 ] &= ~( std::uint64_t( 1 ) << ( lane % 64 ) );
+	}
+	return result;
+}
+
+template class enigma::bitsliced_m4_machine<1>;
+template class enigma::bitsliced_m4_machine<4>;
+template class enigma::bitsliced_m4_machine<8>;
@@ -0,0 +1,109 @@
+#include "enigma/corpus.h"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <string_view>
+
+using namespace enigma;
+
+namespace
+{
+	// Roughly in order of how often they show up in naval traffic, earlier words are drawn more often
+	constexpr std::array<std::string_view, 80> vocabulary = {
+		"AN", "DER", "DIE", "UND", "VON", "BEI", "NACH", "IST", "DAS", "MIT",
+		"FUER", "AUF", "ZU", "EIN", "NICHT", "SIND", "QUADRAT", "FEIND", "GELEITZUG", "KURS",
+		"UBOOT", "BOOT", "STANDORT", "MELDUNG", "SOFORT", "BEFEHL", "ANGRIFF", "NORD", "SUED", "OST",
+		"WEST", "FAHRT", "SEEKRIEG", "LEITUNG", "FLOTTE", "KOMMANDANT", "ZERSTOERER", "DAMPFER", "TANKER", "SICHTUNG",
+		"WETTER", "WIND", "STAERKE", "SEEGANG", "SICHT", "GUT", "SCHLECHT", "BRENNSTOFF", "TORPEDO", "TREFFER",
+		"VERSENKT", "TONNEN", "GESCHWADER", "MARINE", "HAFEN", "EINLAUFEN", "AUSLAUFEN", "OPERATION", "GEBIET", "BESETZEN",
+		"HALTEN", "WARTEN", "FUNKSPRUCH", "UHRZEIT", "EINS", "ZWO", "DREI", "VIER", "FUENF", "SECHS",
+		"SIEBEN", "ACHT", "NEUN", "NULL", "HUNDERT", "TAUSEND", "OBERKOMMANDO", "ADMIRAL", "KAPITAEN", "ENDE"
+	};
+}
+
+std::vector<const char*> corpus::intercept::plugs() const
+{
+	std::vector<const char*> result;
+	for ( const auto& pair : m_plug_pairs )
+	{
+		result.push_back( pair.c_str() );
+	}
+	return result;
+}
+
+std::string corpus::german_like_text( std::size_t length, std::mt19937_64& random )
+{
+	// Zipf like draw, word i comes up about 1 / ( i + 8 ) of the time
+	std::vector<double> weights( vocabulary.size() );
+	for ( std::size_t i = 0; i < weights.size(); ++i )
+	{
+		weights[ i ] = 1.0 / static_cast<double>( i + 8 );
+	}
+	std::discrete_distribution<std::size_t> word( begin( weights ), end( weights ) );
+	std::bernoulli_distribution double_separator( 0.1 );
+
+	std::string text;
+	while ( text.size() < length )
+	{
+		text += vocabulary[ word( random ) ];
+		text += double_separator( random ) ? "XX" : "X";
+	}
+	text.resize( length );
+	return text;
+}
+
+std::vector<corpus::intercept> corpus::generate( const options& options )
+{
+	std::mt19937_64 random( options.m_seed );
+	std::uniform_int_distribution<int> letter( 0, 25 );
+	std::bernoulli_distribution coin( 0.5 );
+
+	std::vector<intercept> corpus;
+	for ( std::size_t i = 0; i < options.m_count; ++i )
+	{
+		intercept sample;
+
+		std::array<int, 8> wheels;
+		std::iota( begin( wheels ), end( wheels ), 1 );
+		std::shuffle( begin( wheels ), end( wheels ), random );
+		sample.m_settings.m_rotors = { coin( random ) ? static_cast<int>( rotor_index::Beta ) : static_cast<int>( rotor_index::Gamma ),
+									   wheels[ 0 ],
+									   wheels[ 1 ],
+									   wheels[ 2 ] };
+		for ( auto& ring : sample.m_settings.m_ring_settings )
+		{
+			ring = letter( random );
+		}
+		for ( std::size_t position = 0; position < 4; ++position )
+		{
+			sample.m_settings.m_key[ position ] = static_cast<char>( 'A' + letter( random ) );
+		}
+		if ( options.m_random_reflector && coin( random ) )
+		{
+			sample.m_reflector = reflectors::B;
+		}
+
+		std::array<char, 26> letters;
+		std::iota( begin( letters ), end( letters ), 'A' );
+		std::shuffle( begin( letters ), end( letters ), random );
+		for ( std::size_t pair = 0; pair < std::min<std::size_t>( options.m_plug_pairs, 13 ); ++pair )
+		{
+			sample.m_plug_pairs.push_back( { letters[ pair * 2 ], letters[ pair * 2 + 1 ] } );
+		}
+
+		sample.m_plaintext = german_like_text( options.m_length, random );
+
+		// Reciprocal machine, decoding the plaintext encrypts it
+		const auto& rotor_order = sample.m_settings.m_rotors;
+		const m4_machine machine(
+			{ rotors[ rotor_order[ 0 ] ], rotors[ rotor_order[ 1 ] ], rotors[ rotor_order[ 2 ] ], rotors[ rotor_order[ 3 ] ] },
+			sample.m_settings.m_ring_settings,
+			sample.m_reflector,
+			sample.plugs() );
+		sample.m_message = machine.decode( sample.m_plaintext, sample.m_settings.m_key );
+
+		corpus.push_back( std::move( sample ) );
+	}
+	return corpus;
+}
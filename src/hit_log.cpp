@@ -0,0 +1,170 @@
+#include "enigma/hit_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+
+using enigma::hit_log;
+using enigma::hit_log_reader;
+
+namespace
+{
+	// Hits are written once a thread has this many
+	constexpr std::size_t buffer_capacity = 1024;
+
+	constexpr std::array<const char*, hit_log::stage_count> stage_names = { "plaintext", "crib", "crib_staged", "day_key", "batch" };
+}
+
+hit_log::hit_log( const std::string& path )
+	: m_file( path, std::ios::binary | std::ios::trunc )
+{
+	if ( !m_file )
+	{
+		throw std::runtime_error( "Cannot open hit log " + path );
+	}
+
+	std::array<char, header_size> header = {};
+	const std::uint32_t record_size = sizeof( hit );
+	std::memcpy( header.data(), magic.data(), magic.size() );
+	std::memcpy( header.data() + 8, &version, sizeof( version ) );
+	std::memcpy( header.data() + 12, &record_size, sizeof( record_size ) );
+	m_file.write( header.data(), header.size() );
+}
+
+hit_log::~hit_log()
+{
+	flush();
+}
+
+void hit_log::record( const hit& hit )
+{
+	auto& buffer = m_buffers.local( [] {
+		hit_buffer buffer;
+		buffer.reserve( buffer_capacity );
+		return buffer;
+	} );
+	buffer.push_back( hit );
+	++m_size;
+	if ( buffer.size() == buffer_capacity )
+	{
+		write( buffer );
+		buffer.clear();
+	}
+}
+
+void hit_log::flush()
+{
+	m_buffers.for_each( [ this ]( hit_buffer& buffer ) {
+		write( buffer );
+		buffer.clear();
+	} );
+	std::scoped_lock lock( m_file_mutex );
+	m_file.flush();
+}
+
+std::size_t hit_log::size() const
+{
+	return m_size;
+}
+
+void hit_log::write( std::span<const hit> hits )
+{
+	if ( hits.empty() )
+	{
+		return;
+	}
+	std::scoped_lock lock( m_file_mutex );
+	m_file.write( reinterpret_cast<const char*>( hits.data() ), static_cast<std::streamsize>( hits.size_bytes() ) );
+}
+
+hit_log_reader::hit_log_reader( const std::string& path )
+	: m_file( path )
+{
+	const auto bytes = m_file.bytes();
+	std::uint32_t file_version = 0;
+	std::uint32_t record_size = 0;
+	if ( bytes.size() >= hit_log::header_size )
+	{
+		std::memcpy( &file_version, bytes.data() + 8, sizeof( file_version ) );
+		std::memcpy( &record_size, bytes.data() + 12, sizeof( record_size ) );
+	}
+	if ( bytes.size() < hit_log::header_size || std::memcmp( bytes.data(), hit_log::magic.data(), hit_log::magic.size() ) != 0
+		 || file_version != hit_log::version || record_size != sizeof( hit_log::hit ) )
+	{
+		throw std::runtime_error( "Not a hit log: " + path );
+	}
+}
+
+std::span<const hit_log::hit> hit_log_reader::hits() const
+{
+	// A record cut short by a crash while writing is left out
+	const auto bytes = m_file.bytes();
+	const auto count = ( bytes.size() - hit_log::header_size ) / sizeof( hit_log::hit );
+	return { reinterpret_cast<const hit_log::hit*>( bytes.data() + hit_log::header_size ), count };
+}
+
+void enigma::write_hit_report( std::span<const hit_log::hit> hits, std::ostream& output )
+{
+	output << std::format( "{} hits\n", hits.size() );
+	output << std::format( "{:<12} {:>10} {:>10} {:>10} {:>10} {:>14} {:>16}\n",
+						   "stage",
+						   "hits",
+						   "confirmed",
+						   "rejected",
+						   "unverified",
+						   "min confirmed",
+						   "rejected below" );
+
+	for ( std::size_t s = 0; s < hit_log::stage_count; ++s )
+	{
+		std::array<std::size_t, hit_log::outcome_count> counts = {};
+		std::vector<std::uint32_t> rejected_scores;
+		std::uint32_t min_confirmed = std::numeric_limits<std::uint32_t>::max();
+		for ( const auto& hit : hits )
+		{
+			if ( static_cast<std::size_t>( hit.m_stage ) != s || static_cast<std::size_t>( hit.m_outcome ) >= hit_log::outcome_count )
+			{
+				continue;
+			}
+			++counts[ static_cast<std::size_t>( hit.m_outcome ) ];
+			if ( hit.m_outcome == hit_log::outcome::confirmed )
+			{
+				min_confirmed = std::min( min_confirmed, hit.m_score );
+			}
+			else if ( hit.m_outcome == hit_log::outcome::rejected )
+			{
+				rejected_scores.push_back( hit.m_score );
+			}
+		}
+
+		const auto total = counts[ 0 ] + counts[ 1 ] + counts[ 2 ];
+		if ( total == 0 )
+		{
+			continue;
+		}
+
+		// Raising the threshold up to the lowest confirmed score keeps every confirmed hit and drops the rejected ones below it
+		std::string threshold = "n/a";
+		std::string dropped = "n/a";
+		if ( counts[ static_cast<std::size_t>( hit_log::outcome::confirmed ) ] > 0 )
+		{
+			const auto below = std::count_if(
+				begin( rejected_scores ), end( rejected_scores ), [ & ]( std::uint32_t score ) { return score < min_confirmed; } );
+			threshold = std::to_string( min_confirmed );
+			dropped = rejected_scores.empty() ? std::string( "-" )
+											  : std::format( "{} ({:.0f}%)", below, 100.0 * below / rejected_scores.size() );
+		}
+
+		output << std::format( "{:<12} {:>10} {:>10} {:>10} {:>10} {:>14} {:>16}\n",
+							   stage_names[ s ],
+							   total,
+							   counts[ static_cast<std::size_t>( hit_log::outcome::confirmed ) ],
+							   counts[ static_cast<std::size_t>( hit_log::outcome::rejected ) ],
+							   counts[ static_cast<std::size_t>( hit_log::outcome::unverified ) ],
+							   threshold,
+							   dropped );
+	}
+}
@@ -1,8 +1,87 @@
 #include "enigma/m4.h"
 
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+using enigma::fast_rotor_tables;
 using enigma::m4_machine;
 using enigma::rotor;
 
+namespace
+{
+	// Steps until the rotor at this offset next reaches one of its turnovers
+	std::size_t turnover_distance( const rotor& rotor, int offset )
+	{
+		std::size_t distance = 26;
+		for ( const auto turnover : rotor.m_turnovers )
+		{
+			if ( turnover != -1 )
+			{
+				distance = std::min<std::size_t>( distance, ( turnover - offset + 26 ) % 26 );
+			}
+		}
+		return distance;
+	}
+}
+
+fast_rotor_tables::fast_rotor_tables( const rotor& middle,
+									  const rotor& right,
+									  std::array<int, 2> ring_settings,
+									  std::span<const char* const> plugs )
+	: m_ring_settings( ring_settings )
+{
+	// Turnovers relative to the rings, as m4_machine keeps them
+	const auto turnover = [ & ]( const rotor& rotor, int ring, int offset ) {
+		return std::any_of( begin( rotor.m_turnovers ), end( rotor.m_turnovers ), [ & ]( char notch ) {
+			return notch != -1 && ( notch + 26 - ring ) % 26 == offset;
+		} );
+	};
+
+	std::array<char, 26> plugboard;
+	for ( int i = 0; i < 26; ++i )
+	{
+		plugboard[ i ] = static_cast<char>( 'A' + i );
+	}
+	for ( auto pair : plugs )
+	{
+		plugboard[ pair[ 0 ] - 'A' ] = pair[ 1 ];
+		plugboard[ pair[ 1 ] - 'A' ] = pair[ 0 ];
+	}
+
+	for ( int middle_offset = 0; middle_offset < 26; ++middle_offset )
+	{
+		for ( int right_offset = 0; right_offset < 26; ++right_offset )
+		{
+			auto& inward = m_inward[ middle_offset * 26 + right_offset ];
+			auto& outward = m_outward[ middle_offset * 26 + right_offset ];
+			for ( int letter = 0; letter < 26; ++letter )
+			{
+				auto input = right.m_wiring[ plugboard[ letter ] - 'A' + right_offset + 26 ];
+				input = middle.m_wiring[ input - 'A' + middle_offset - right_offset + 26 ];
+				inward[ letter ] = static_cast<std::uint8_t>( ( input - 'A' - middle_offset + 26 ) % 26 );
+
+				auto output = middle.m_reversed_wiring[ letter + middle_offset + 26 ];
+				output = right.m_reversed_wiring[ output - 'A' + right_offset - middle_offset + 26 ];
+				outward[ letter ] = static_cast<std::uint8_t>( plugboard[ ( output - 'A' - right_offset + 26 ) % 26 ] - 'A' );
+			}
+
+			// Same as m4_machine::step
+			auto next = static_cast<std::uint16_t>( middle_offset * 26 + ( right_offset + 1 ) % 26 );
+			if ( turnover( right, ring_settings[ 1 ], right_offset ) )
+			{
+				next = static_cast<std::uint16_t>( ( middle_offset + 1 ) % 26 * 26 + ( right_offset + 1 ) % 26 );
+			}
+			else if ( turnover( middle, ring_settings[ 0 ], middle_offset ) )
+			{
+				next = static_cast<std::uint16_t>( ( middle_offset + 1 ) % 26 * 26 + ( right_offset + 1 ) % 26 ) | left_step;
+			}
+			m_next[ middle_offset * 26 + right_offset ] = next;
+		}
+	}
+}
+
 m4_machine::m4_machine( const std::array<rotor, 4>& rotors,
 						std::array<int, 4> ring_settings,
 						reflector reflector,
@@ -34,126 +113,305 @@ m4_machine::m4_machine( const std::array<rotor, 4>& rotors,
 	}
 }
 
-void m4_machine::decode( std::string_view message, std::string_view key, std::string& output ) const
+m4_machine::m4_machine( const std::array<rotor, 4>& rotors,
+						std::array<int, 4> ring_settings,
+						reflector reflector,
+						std::span<const char* const> plugs,
+						std::shared_ptr<const fast_rotor_tables> fast_tables )
+	: m4_machine( rotors, ring_settings, reflector, plugs )
 {
-	output.resize( message.size(), 'A' );
+	if ( fast_tables && fast_tables->m_ring_settings == std::array { ring_settings[ 2 ], ring_settings[ 3 ] } )
+	{
+		m_fast_tables = std::move( fast_tables );
+	}
+}
 
-	const std::array<char, 4> start_positions = { key[ 0 ] - 'A', key[ 1 ] - 'A', key[ 2 ] - 'A', key[ 3 ] - 'A' };
+inline m4_machine::offsets m4_machine::key_offsets( key key ) const
+{
+	const std::array<int, 4> start_positions = { key[ 0 ] - 'A', key[ 1 ] - 'A', key[ 2 ] - 'A', key[ 3 ] - 'A' };
 
-	std::array<int, 4> offsets = { ( start_positions[ 0 ] - m_rings_settings[ 0 ] + 26 ) % 26,
-								   ( start_positions[ 1 ] - m_rings_settings[ 1 ] + 26 ) % 26,
-								   ( start_positions[ 2 ] - m_rings_settings[ 2 ] + 26 ) % 26,
-								   ( start_positions[ 3 ] - m_rings_settings[ 3 ] + 26 ) % 26 };
+	return { ( start_positions[ 0 ] - m_rings_settings[ 0 ] + 26 ) % 26,
+			 ( start_positions[ 1 ] - m_rings_settings[ 1 ] + 26 ) % 26,
+			 ( start_positions[ 2 ] - m_rings_settings[ 2 ] + 26 ) % 26,
+			 ( start_positions[ 3 ] - m_rings_settings[ 3 ] + 26 ) % 26 };
+}
 
-	auto output_iterator = begin( output );
-	for ( const auto character : message )
+inline enigma::key m4_machine::offsets_key( const offsets& offsets ) const
+{
+	key result_key;
+	for ( std::size_t i = 0; i < 4; ++i )
 	{
-		char input = character;
+		result_key[ i ] = static_cast<char>( 'A' + ( ( offsets[ i ] + m_rings_settings[ i ] ) % 26 ) );
+	}
 
-		if ( m_rotors[ 3 ].m_turnovers[ 0 ] == offsets[ 3 ] || m_rotors[ 3 ].m_turnovers[ 1 ] == offsets[ 3 ] )
-		{
-			offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
-		}
-		else if ( m_rotors[ 2 ].m_turnovers[ 0 ] == offsets[ 2 ] || m_rotors[ 2 ].m_turnovers[ 1 ] == offsets[ 2 ] )
-		{
-			offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
-			offsets[ 1 ] = ( offsets[ 1 ] + 1 ) % 26;
-		}
+	return result_key;
+}
+
+inline void m4_machine::step( offsets& offsets ) const
+{
+	if ( m_rotors[ 3 ].m_turnovers[ 0 ] == offsets[ 3 ] || m_rotors[ 3 ].m_turnovers[ 1 ] == offsets[ 3 ] )
+	{
+		offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
+	}
+	else if ( m_rotors[ 2 ].m_turnovers[ 0 ] == offsets[ 2 ] || m_rotors[ 2 ].m_turnovers[ 1 ] == offsets[ 2 ] )
+	{
+		offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
+		offsets[ 1 ] = ( offsets[ 1 ] + 1 ) % 26;
+	}
 
-		offsets[ 3 ] = ( offsets[ 3 ] + 1 ) % 26;
+	offsets[ 3 ] = ( offsets[ 3 ] + 1 ) % 26;
+}
 
-		input = m_plugboard[ input - 'A' ];
+inline void m4_machine::step_back( offsets& offsets ) const
+{
+	offsets[ 3 ] = ( offsets[ 3 ] - 1 + 26 ) % 26;
 
-		input = m_rotors[ 3 ].m_wiring[ input - 'A' + offsets[ 3 ] + 26 ];
-		input = m_rotors[ 2 ].m_wiring[ input - 'A' + offsets[ 2 ] - offsets[ 3 ] + 26 ];
-		input = m_rotors[ 1 ].m_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 2 ] + 26 ];
-		input = m_rotors[ 0 ].m_wiring[ input - 'A' + offsets[ 0 ] - offsets[ 1 ] + 26 ];
+	if ( m_rotors[ 3 ].m_turnovers[ 0 ] == offsets[ 3 ] || m_rotors[ 3 ].m_turnovers[ 1 ] == offsets[ 3 ] )
+	{
+		offsets[ 2 ] = ( offsets[ 2 ] - 1 + 26 ) % 26;
+	}
+	else if ( m_rotors[ 2 ].m_turnovers[ 0 ] == offsets[ 2 ] || m_rotors[ 2 ].m_turnovers[ 1 ] == offsets[ 2 ] )
+	{
+		offsets[ 2 ] = ( offsets[ 2 ] - 1 + 26 ) % 26;
+		offsets[ 1 ] = ( offsets[ 1 ] - 1 + 26 ) % 26;
+	}
+}
 
-		input = m_reflector.m_wiring[ input - 'A' - offsets[ 0 ] + 26 ];
+inline char m4_machine::encode_forward( char input, const offsets& offsets ) const
+{
+	input = m_plugboard[ input - 'A' ];
 
-		input = m_rotors[ 0 ].m_reversed_wiring[ input - 'A' + offsets[ 0 ] + 26 ];
-		input = m_rotors[ 1 ].m_reversed_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 0 ] + 26 ];
-		input = m_rotors[ 2 ].m_reversed_wiring[ input - 'A' + offsets[ 2 ] - offsets[ 1 ] + 26 ];
-		input = m_rotors[ 3 ].m_reversed_wiring[ input - 'A' + offsets[ 3 ] - offsets[ 2 ] + 26 ];
+	input = m_rotors[ 3 ].m_wiring[ input - 'A' + offsets[ 3 ] + 26 ];
+	input = m_rotors[ 2 ].m_wiring[ input - 'A' + offsets[ 2 ] - offsets[ 3 ] + 26 ];
+	input = m_rotors[ 1 ].m_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 2 ] + 26 ];
+	return m_rotors[ 0 ].m_wiring[ input - 'A' + offsets[ 0 ] - offsets[ 1 ] + 26 ];
+}
 
-		input = enigma::rotors[ static_cast<int>( enigma::rotor_index::ETW ) ].m_wiring[ input - 'A' - offsets[ 3 ] + 26 ];
+inline char m4_machine::encode_backward( char input, const offsets& offsets ) const
+{
+	input = m_rotors[ 0 ].m_reversed_wiring[ input - 'A' + offsets[ 0 ] + 26 ];
+	input = m_rotors[ 1 ].m_reversed_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 0 ] + 26 ];
+	input = m_rotors[ 2 ].m_reversed_wiring[ input - 'A' + offsets[ 2 ] - offsets[ 1 ] + 26 ];
+	input = m_rotors[ 3 ].m_reversed_wiring[ input - 'A' + offsets[ 3 ] - offsets[ 2 ] + 26 ];
 
-		input = m_plugboard[ input - 'A' ];
+	input = enigma::rotors[ static_cast<int>( enigma::rotor_index::ETW ) ].m_wiring[ input - 'A' - offsets[ 3 ] + 26 ];
 
-		*output_iterator++ = input;
-	}
+	return m_plugboard[ input - 'A' ];
 }
 
-std::string m4_machine::decode( std::string_view message, std::string_view key ) const
+inline char m4_machine::encode( char input, const offsets& offsets ) const
 {
-	std::string result;
-	decode( message, key, result );
-	return result;
+	return encode_backward( m_reflector.m_wiring[ encode_forward( input, offsets ) - 'A' - offsets[ 0 ] + 26 ], offsets );
 }
 
-std::string m4_machine::advance_key( std::string_view key, std::size_t position ) const
+inline char m4_machine::encode( char input, std::size_t index, int left_offset, int greek_offset, const fast_rotor_tables& tables ) const
 {
-	const std::array<char, 4> start_positions = { key[ 0 ] - 'A', key[ 1 ] - 'A', key[ 2 ] - 'A', key[ 3 ] - 'A' };
+	input = m_rotors[ 1 ].m_wiring[ tables.m_inward[ index ][ input - 'A' ] + left_offset + 26 ];
+	input = m_rotors[ 0 ].m_wiring[ input - 'A' + greek_offset - left_offset + 26 ];
+	input = m_reflector.m_wiring[ input - 'A' - greek_offset + 26 ];
+	input = m_rotors[ 0 ].m_reversed_wiring[ input - 'A' + greek_offset + 26 ];
+	input = m_rotors[ 1 ].m_reversed_wiring[ input - 'A' + left_offset - greek_offset + 26 ];
+	return static_cast<char>( 'A' + tables.m_outward[ index ][ ( input - 'A' - left_offset + 26 ) % 26 ] );
+}
 
-	std::array<int, 4> offsets = { ( start_positions[ 0 ] - m_rings_settings[ 0 ] + 26 ) % 26,
-								   ( start_positions[ 1 ] - m_rings_settings[ 1 ] + 26 ) % 26,
-								   ( start_positions[ 2 ] - m_rings_settings[ 2 ] + 26 ) % 26,
-								   ( start_positions[ 3 ] - m_rings_settings[ 3 ] + 26 ) % 26 };
+void m4_machine::decode( std::string_view message, key key, std::string& output ) const
+{
+	output.resize( message.size(), 'A' );
+	decode( message, key, std::span<char>( output ) );
+}
+
+void m4_machine::decode( std::string_view message, key key, std::span<char> output ) const
+{
+	decode_from( message, key, 0, output );
+}
+
+void m4_machine::decode_from( std::string_view message, key key, std::size_t position, std::span<char> output ) const
+{
+	auto offsets = key_offsets( key );
 
 	for ( ; position != 0; --position )
 	{
-		if ( m_rotors[ 3 ].m_turnovers[ 0 ] == offsets[ 3 ] || m_rotors[ 3 ].m_turnovers[ 1 ] == offsets[ 3 ] )
-		{
-			offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
-		}
-		else if ( m_rotors[ 2 ].m_turnovers[ 0 ] == offsets[ 2 ] || m_rotors[ 2 ].m_turnovers[ 1 ] == offsets[ 2 ] )
+		step( offsets );
+	}
+
+	auto output_iterator = begin( output );
+	if ( m_fast_tables )
+	{
+		const auto& tables = *m_fast_tables;
+		std::size_t index = offsets[ 2 ] * 26 + offsets[ 3 ];
+		for ( const auto character : message )
 		{
-			offsets[ 2 ] = ( offsets[ 2 ] + 1 ) % 26;
-			offsets[ 1 ] = ( offsets[ 1 ] + 1 ) % 26;
+			const auto next = tables.m_next[ index ];
+			index = next & ~fast_rotor_tables::left_step;
+			if ( next & fast_rotor_tables::left_step )
+			{
+				offsets[ 1 ] = offsets[ 1 ] == 25 ? 0 : offsets[ 1 ] + 1;
+			}
+			*output_iterator++ = encode( character, index, offsets[ 1 ], offsets[ 0 ], tables );
 		}
+		return;
+	}
 
-		offsets[ 3 ] = ( offsets[ 3 ] + 1 ) % 26;
+	for ( const auto character : message )
+	{
+		step( offsets );
+		*output_iterator++ = encode( character, offsets );
 	}
+}
 
-	std::string result_key;
-	result_key += 'A' + ( ( offsets[ 0 ] + m_rings_settings[ 0 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 1 ] + m_rings_settings[ 1 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 2 ] + m_rings_settings[ 2 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 3 ] + m_rings_settings[ 3 ] ) % 26 );
+std::string m4_machine::decode( std::string_view message, key key ) const
+{
+	std::string result;
+	decode( message, key, result );
+	return result;
+}
 
-	return result_key;
+void m4_machine::match_plaintext( std::string_view message,
+								  std::string_view plaintext,
+								  key key,
+								  std::span<const reflector> reflectors,
+								  std::span<char> output ) const
+{
+	auto offsets = key_offsets( key );
+
+	for ( std::size_t i = 0; i < message.size(); ++i )
+	{
+		step( offsets );
+		// Both sides of the reflector, message letter going in and plaintext letter expected out
+		const auto reflector_input = encode_forward( message[ i ], offsets ) - 'A' - offsets[ 0 ] + 26;
+		const auto reflector_output
+			= static_cast<char>( 'A' + ( encode_forward( plaintext[ i ], offsets ) - 'A' - offsets[ 0 ] + 26 ) % 26 );
+		for ( std::size_t r = 0; r < reflectors.size(); ++r )
+		{
+			output[ r * message.size() + i ] = reflectors[ r ].m_wiring[ reflector_input ] == reflector_output ? plaintext[ i ] : '?';
+		}
+	}
 }
 
-std::string m4_machine::rollback_key( std::string_view key, std::size_t position ) const
+void m4_machine::coincidence_by_right_letter( std::string_view message, key key, std::span<float, 26> output ) const
 {
-	const std::array<char, 4> start_positions = { key[ 0 ] - 'A', key[ 1 ] - 'A', key[ 2 ] - 'A', key[ 3 ] - 'A' };
+	using table = std::array<std::uint8_t, 26>;
 
-	std::array<int, 4> offsets = { ( start_positions[ 0 ] - m_rings_settings[ 0 ] + 26 ) % 26,
-								   ( start_positions[ 1 ] - m_rings_settings[ 1 ] + 26 ) % 26,
-								   ( start_positions[ 2 ] - m_rings_settings[ 2 ] + 26 ) % 26,
-								   ( start_positions[ 3 ] - m_rings_settings[ 3 ] + 26 ) % 26 };
+	// Middle, left and greek rotors and the reflector seen from the right rotor's contacts, for each middle and left offset
+	// (the greek wheel never moves)
+	std::array<table, 26 * 26> folded;
+	std::bitset<26 * 26> ready;
+	const auto fold = [ & ]( const offsets& offsets ) -> const table& {
+		const auto index = offsets[ 1 ] * 26 + offsets[ 2 ];
+		auto& folded_table = folded[ index ];
+		if ( !ready.test( index ) )
+		{
+			for ( int contact = 0; contact < 26; ++contact )
+			{
+				auto input = m_rotors[ 2 ].m_wiring[ contact + offsets[ 2 ] + 26 ];
+				input = m_rotors[ 1 ].m_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 2 ] + 26 ];
+				input = m_rotors[ 0 ].m_wiring[ input - 'A' + offsets[ 0 ] - offsets[ 1 ] + 26 ];
+				input = m_reflector.m_wiring[ input - 'A' - offsets[ 0 ] + 26 ];
+				input = m_rotors[ 0 ].m_reversed_wiring[ input - 'A' + offsets[ 0 ] + 26 ];
+				input = m_rotors[ 1 ].m_reversed_wiring[ input - 'A' + offsets[ 1 ] - offsets[ 0 ] + 26 ];
+				input = m_rotors[ 2 ].m_reversed_wiring[ input - 'A' + offsets[ 2 ] - offsets[ 1 ] + 26 ];
+				folded_table[ contact ] = static_cast<std::uint8_t>( ( input - 'A' - offsets[ 2 ] + 26 ) % 26 );
+			}
+			ready.set( index );
+		}
+		return folded_table;
+	};
 
-	for ( ; position != 0; --position )
+	// Right rotor from the plugboard to its contacts and back through the plugboard, for each of its offsets
+	const auto& right = m_rotors[ 3 ];
+	std::array<table, 26> inward;
+	std::array<table, 26> outward;
+	for ( int offset = 0; offset < 26; ++offset )
 	{
+		for ( int letter = 0; letter < 26; ++letter )
+		{
+			inward[ offset ][ letter ] = static_cast<std::uint8_t>( ( right.m_wiring[ letter + offset + 26 ] - 'A' - offset + 26 ) % 26 );
+			const auto back = ( right.m_reversed_wiring[ letter + offset + 26 ] - 'A' - offset + 26 ) % 26;
+			outward[ offset ][ letter ] = static_cast<std::uint8_t>( m_plugboard[ back ] - 'A' );
+		}
+	}
 
-		offsets[ 3 ] = ( offsets[ 3 ] - 1 + 26 ) % 26;
+	std::vector<std::uint8_t> plugged( message.size() );
+	std::transform( begin( message ), end( message ), begin( plugged ), [ & ]( char input ) { return m_plugboard[ input - 'A' ] - 'A'; } );
 
-		if ( m_rotors[ 3 ].m_turnovers[ 0 ] == offsets[ 3 ] || m_rotors[ 3 ].m_turnovers[ 1 ] == offsets[ 3 ] )
+	for ( int letter = 0; letter < 26; ++letter )
+	{
+		key[ 3 ] = static_cast<char>( 'A' + letter );
+		auto offsets = key_offsets( key );
+		// The left rotor only ever moves along with the middle one
+		const table* middle = nullptr;
+
+		// Sum of count * ( count - 1 ) grows by twice the previous count with each letter
+		std::array<int, 26> counts = {};
+		int sum = 0;
+		for ( const auto input : plugged )
 		{
-			offsets[ 2 ] = ( offsets[ 2 ] - 1 + 26 ) % 26;
+			const auto middle_offset = offsets[ 2 ];
+			step( offsets );
+			if ( !middle || offsets[ 2 ] != middle_offset )
+			{
+				middle = &fold( offsets );
+			}
+			const auto decoded = outward[ offsets[ 3 ] ][ ( *middle )[ inward[ offsets[ 3 ] ][ input ] ] ];
+			sum += 2 * counts[ decoded ]++;
 		}
-		else if ( m_rotors[ 2 ].m_turnovers[ 0 ] == offsets[ 2 ] || m_rotors[ 2 ].m_turnovers[ 1 ] == offsets[ 2 ] )
+		output[ letter ] = static_cast<float>( sum ) * 26 / ( message.size() * ( message.size() - 1 ) );
+	}
+}
+
+void m4_machine::trace( key key, std::span<offsets> output ) const
+{
+	auto offsets = key_offsets( key );
+
+	for ( std::size_t i = 0; i < output.size(); )
+	{
+		step( offsets );
+		output[ i++ ] = offsets;
+
+		// Only the right rotor moves until it reaches a turnover, unless the middle one is about to double step
+		const auto right_only = turnover_distance( m_rotors[ 2 ], offsets[ 2 ] ) == 0
+									? 0
+									: std::min( turnover_distance( m_rotors[ 3 ], offsets[ 3 ] ), output.size() - i );
+		for ( std::size_t j = 0; j < right_only; ++j )
 		{
-			offsets[ 2 ] = ( offsets[ 2 ] - 1 + 26 ) % 26;
-			offsets[ 1 ] = ( offsets[ 1 ] - 1 + 26 ) % 26;
+			offsets[ 3 ] = offsets[ 3 ] == 25 ? 0 : offsets[ 3 ] + 1;
+			output[ i++ ] = offsets;
 		}
 	}
+}
 
-	std::string result_key;
-	result_key += 'A' + ( ( offsets[ 0 ] + m_rings_settings[ 0 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 1 ] + m_rings_settings[ 1 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 2 ] + m_rings_settings[ 2 ] ) % 26 );
-	result_key += 'A' + ( ( offsets[ 3 ] + m_rings_settings[ 3 ] ) % 26 );
+void m4_machine::decode_trace( std::string_view message,
+							   std::span<const offsets> trace,
+							   std::span<const offsets> reference_trace,
+							   std::span<const char> reference_output,
+							   std::span<char> output ) const
+{
+	for ( std::size_t i = 0; i < message.size(); ++i )
+	{
+		output[ i ] = trace[ i ] == reference_trace[ i ] ? reference_output[ i ] : encode( message[ i ], trace[ i ] );
+	}
+}
 
-	return result_key;
+enigma::key m4_machine::advance_key( key key, std::size_t position ) const
+{
+	auto offsets = key_offsets( key );
+
+	for ( ; position != 0; --position )
+	{
+		step( offsets );
+	}
+
+	return offsets_key( offsets );
+}
+
+enigma::key m4_machine::rollback_key( key key, std::size_t position ) const
+{
+	auto offsets = key_offsets( key );
+
+	for ( ; position != 0; --position )
+	{
+		step_back( offsets );
+	}
+
+	return offsets_key( offsets );
 }
@@ -0,0 +1,85 @@
+#include "enigma/mapped_file.h"
+
+#include <stdexcept>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using enigma::mapped_file;
+
+mapped_file::mapped_file( const std::string& path )
+{
+#if defined( _WIN32 )
+	const auto file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( file == INVALID_HANDLE_VALUE )
+	{
+		throw std::runtime_error( "Cannot open " + path );
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx( file, &size );
+	m_size = static_cast<std::size_t>( size.QuadPart );
+	if ( m_size > 0 )
+	{
+		m_mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		m_data = m_mapping ? static_cast<const std::byte*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) ) : nullptr;
+	}
+	CloseHandle( file );
+#else
+	const int file = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+	if ( file < 0 )
+	{
+		throw std::runtime_error( "Cannot open " + path );
+	}
+	struct stat status;
+	if ( fstat( file, &status ) == 0 )
+	{
+		m_size = static_cast<std::size_t>( status.st_size );
+	}
+	if ( m_size > 0 )
+	{
+		void* data = mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0 );
+		m_data = data != MAP_FAILED ? static_cast<const std::byte*>( data ) : nullptr;
+	}
+	close( file );
+#endif
+
+	if ( m_size > 0 && !m_data )
+	{
+		unmap();
+		throw std::runtime_error( "Cannot map " + path );
+	}
+}
+
+mapped_file::~mapped_file()
+{
+	unmap();
+}
+
+void mapped_file::unmap()
+{
+#if defined( _WIN32 )
+	if ( m_data )
+	{
+		UnmapViewOfFile( m_data );
+	}
+	if ( m_mapping )
+	{
+		CloseHandle( m_mapping );
+	}
+#else
+	if ( m_data )
+	{
+		munmap( const_cast<std::byte*>( m_data ), m_size );
+	}
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_mapping = nullptr;
+}
@@ -0,0 +1,220 @@
+#include "enigma/perf_counters.h"
+
+#include <format>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using enigma::perf_counters;
+
+namespace
+{
+	constexpr std::array<const char*, perf_counters::phase_count> phase_names = { "calibration", "prescreen", "screening", "fine_tune" };
+
+	// Counters of the calling thread, -1 where the system refused one
+	class thread_counters
+	{
+	public:
+		thread_counters()
+		{
+			m_descriptors.fill( -1 );
+#ifdef __linux__
+			constexpr auto cache_miss = []( std::uint64_t cache ) {
+				return cache | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+			};
+			const std::array<std::pair<std::uint32_t, std::uint64_t>, perf_counters::event_count> events = {
+				{ { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+				  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+				  { PERF_TYPE_HW_CACHE, cache_miss( PERF_COUNT_HW_CACHE_L1D ) },
+				  { PERF_TYPE_HW_CACHE, cache_miss( PERF_COUNT_HW_CACHE_LL ) },
+				  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES } }
+			};
+			for ( std::size_t i = 0; i < events.size(); ++i )
+			{
+				// Not grouped: a counter the PMU cannot take should not cost us the others
+				perf_event_attr attributes = {};
+				attributes.size = sizeof( attributes );
+				attributes.type = events[ i ].first;
+				attributes.config = events[ i ].second;
+				attributes.exclude_kernel = 1;
+				attributes.exclude_hv = 1;
+				attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				m_descriptors[ i ] = static_cast<int>( syscall( SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC ) );
+			}
+#endif
+		}
+
+		~thread_counters()
+		{
+#ifdef __linux__
+			for ( const auto descriptor : m_descriptors )
+			{
+				if ( descriptor >= 0 )
+				{
+					close( descriptor );
+				}
+			}
+#endif
+		}
+
+		thread_counters( const thread_counters& ) = delete;
+		thread_counters& operator=( const thread_counters& ) = delete;
+
+		[[nodiscard]] std::uint32_t missing() const
+		{
+			std::uint32_t bits = 0;
+			for ( std::size_t i = 0; i < m_descriptors.size(); ++i )
+			{
+				bits |= m_descriptors[ i ] < 0 ? 1u << i : 0;
+			}
+			return bits;
+		}
+
+		// Raw counts so far, scaling is left to perf_counters::scaled_delta as it only holds over an interval
+		[[nodiscard]] perf_counters::samples read() const
+		{
+			perf_counters::samples values = {};
+#ifdef __linux__
+			for ( std::size_t i = 0; i < m_descriptors.size(); ++i )
+			{
+				std::array<std::uint64_t, 3> sample = {};
+				if ( m_descriptors[ i ] >= 0 && ::read( m_descriptors[ i ], sample.data(), sizeof( sample ) ) == sizeof( sample ) )
+				{
+					values[ i ] = { sample[ 0 ], sample[ 1 ], sample[ 2 ] };
+				}
+			}
+#endif
+			return values;
+		}
+
+	private:
+		std::array<int, perf_counters::event_count> m_descriptors;
+	};
+
+	thread_counters& local_counters()
+	{
+		thread_local thread_counters counters;
+		return counters;
+	}
+}
+
+perf_counters::scope::scope( perf_counters* counters, phase phase )
+	: m_counters( counters )
+	, m_phase( phase )
+{
+	if ( m_counters )
+	{
+		const auto& local = local_counters();
+		m_counters->m_unavailable |= local.missing();
+		m_start = local.read();
+	}
+}
+
+perf_counters::scope::~scope()
+{
+	if ( m_counters )
+	{
+		m_counters->add( m_phase, m_start, m_keys );
+	}
+}
+
+void perf_counters::scope::add_keys( std::uint64_t keys )
+{
+	m_keys += keys;
+}
+
+std::uint64_t perf_counters::scaled_delta( const sample& start, const sample& end )
+{
+	if ( end.m_running <= start.m_running || end.m_value < start.m_value )
+	{
+		return 0;
+	}
+	const auto value = static_cast<double>( end.m_value - start.m_value );
+	const auto enabled = static_cast<double>( end.m_enabled - start.m_enabled );
+	const auto running = static_cast<double>( end.m_running - start.m_running );
+	return static_cast<std::uint64_t>( value * enabled / running );
+}
+
+void perf_counters::add( phase phase, const samples& start, std::uint64_t keys )
+{
+	const auto end = local_counters().read();
+	auto& counts = m_phases[ static_cast<std::size_t>( phase ) ];
+	for ( std::size_t i = 0; i < event_count; ++i )
+	{
+		counts.m_events[ i ] += scaled_delta( start[ i ], end[ i ] );
+	}
+	counts.m_keys += keys;
+	++counts.m_scopes;
+}
+
+bool perf_counters::available( event event ) const
+{
+	return ( m_unavailable.load() & ( 1u << static_cast<std::uint32_t>( event ) ) ) == 0;
+}
+
+perf_counters::totals perf_counters::phase_totals( phase phase ) const
+{
+	const auto& counts = m_phases[ static_cast<std::size_t>( phase ) ];
+	totals result;
+	for ( std::size_t i = 0; i < event_count; ++i )
+	{
+		result.m_events[ i ] = counts.m_events[ i ];
+	}
+	result.m_keys = counts.m_keys;
+	result.m_scopes = counts.m_scopes;
+	return result;
+}
+
+void perf_counters::write_report( std::ostream& output ) const
+{
+	if ( !available( event::cycles ) )
+	{
+		output << "Hardware counters unavailable (perf_event_open refused, see /proc/sys/kernel/perf_event_paranoid)\n";
+		return;
+	}
+
+	output << std::format( "{:<12} {:>8} {:>12} {:>6} {:>12} {:>12} {:>12} {:>12}\n",
+						   "phase",
+						   "scopes",
+						   "keys",
+						   "IPC",
+						   "cycles",
+						   "L1D misses",
+						   "LLC misses",
+						   "br misses" );
+	for ( std::size_t p = 0; p < phase_count; ++p )
+	{
+		const auto totals = phase_totals( static_cast<phase>( p ) );
+		if ( totals.m_scopes == 0 )
+		{
+			continue;
+		}
+
+		const auto units = static_cast<double>( totals.m_keys > 0 ? totals.m_keys : totals.m_scopes );
+		const auto per_unit = [ & ]( event event ) {
+			const auto total = static_cast<double>( totals.m_events[ static_cast<std::size_t>( event ) ] );
+			return available( event ) ? std::format( "{:.2f}", total / units ) : std::string( "n/a" );
+		};
+		const auto cycles = static_cast<double>( totals.m_events[ static_cast<std::size_t>( event::cycles ) ] );
+		const auto instructions = static_cast<double>( totals.m_events[ static_cast<std::size_t>( event::instructions ) ] );
+		const auto ipc
+			= available( event::instructions ) && cycles > 0 ? std::format( "{:.2f}", instructions / cycles ) : std::string( "n/a" );
+
+		output << std::format( "{:<12} {:>8} {:>12} {:>6} {:>12} {:>12} {:>12} {:>12}\n",
+							   phase_names[ p ],
+							   totals.m_scopes,
+							   totals.m_keys > 0 ? std::to_string( totals.m_keys ) : std::string( "-" ),
+							   ipc,
+							   per_unit( event::cycles ),
+							   per_unit( event::l1d_misses ),
+							   per_unit( event::llc_misses ),
+							   per_unit( event::branch_misses ) );
+	}
+	output << "Counts are per key, or per scope where keys are not counted\n";
+}
@@ -0,0 +1,843 @@
+#include "enigma/server.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#if defined( _WIN32 )
+#define NOMINMAX
+#include <WinSock2.h>
+#include <afunix.h>
+#pragma comment( lib, "Ws2_32.lib" )
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace enigma;
+using server::request_handler;
+using server::unix_socket_server;
+
+namespace
+{
+	// Request parsing, errors are reported as std::invalid_argument and sent back to the client
+
+	struct request_fields
+	{
+		std::string_view m_command;
+		std::vector<std::pair<std::string_view, std::string_view>> m_fields;
+
+		[[nodiscard]] std::optional<std::string_view> find( std::string_view name ) const
+		{
+			const auto field
+				= std::find_if( begin( m_fields ), end( m_fields ), [ name ]( const auto& field ) { return field.first == name; } );
+			if ( field == end( m_fields ) )
+			{
+				return std::nullopt;
+			}
+			return field->second;
+		}
+
+		[[nodiscard]] std::string_view get( std::string_view name ) const
+		{
+			const auto value = find( name );
+			if ( !value )
+			{
+				throw std::invalid_argument( "missing " + std::string( name ) );
+			}
+			return *value;
+		}
+	};
+
+	std::vector<std::string_view> split( std::string_view text, char separator )
+	{
+		std::vector<std::string_view> parts;
+		while ( !text.empty() )
+		{
+			const auto end = text.find( separator );
+			if ( end != 0 )
+			{
+				parts.push_back( text.substr( 0, end ) );
+			}
+			text.remove_prefix( end == std::string_view::npos ? text.size() : end + 1 );
+		}
+		return parts;
+	}
+
+	request_fields parse_request( std::string_view request )
+	{
+		while ( !request.empty() && ( request.back() == '\r' || request.back() == '\n' ) )
+		{
+			request.remove_suffix( 1 );
+		}
+
+		const auto words = split( request, ' ' );
+		if ( words.empty() )
+		{
+			throw std::invalid_argument( "empty request" );
+		}
+
+		request_fields result { words.front(), {} };
+		for ( auto word = begin( words ) + 1; word != end( words ); ++word )
+		{
+			const auto equal = word->find( '=' );
+			if ( equal == std::string_view::npos )
+			{
+				throw std::invalid_argument( "expected name=value, got " + std::string( *word ) );
+			}
+			result.m_fields.emplace_back( word->substr( 0, equal ), word->substr( equal + 1 ) );
+		}
+		return result;
+	}
+
+	std::size_t parse_number( std::string_view text, std::string_view name )
+	{
+		std::size_t value = 0;
+		const auto [ end, error ] = std::from_chars( text.data(), text.data() + text.size(), value );
+		if ( error != std::errc() || end != text.data() + text.size() )
+		{
+			throw std::invalid_argument( "invalid " + std::string( name ) );
+		}
+		return value;
+	}
+
+	std::array<int, 4> parse_numbers( std::string_view text, std::string_view name, std::size_t min, std::size_t max, char separator = ',' )
+	{
+		const auto parts = split( text, separator );
+		if ( parts.size() != 4 )
+		{
+			throw std::invalid_argument( "expected 4 " + std::string( name ) );
+		}
+
+		std::array<int, 4> result;
+		for ( std::size_t i = 0; i < 4; ++i )
+		{
+			const auto value = parse_number( parts[ i ], name );
+			if ( value < min || value > max )
+			{
+				throw std::invalid_argument( "invalid " + std::string( name ) );
+			}
+			result[ i ] = static_cast<int>( value );
+		}
+		return result;
+	}
+
+	std::array<int, 4> parse_rotors( std::string_view text, char separator = ',' )
+	{
+		const auto result = parse_numbers( text, "rotors", 1, 10, separator );
+		const bool greek_left = result[ 0 ] >= static_cast<int>( rotor_index::Beta );
+		const bool greek_elsewhere = std::any_of( begin( result ) + 1, end( result ), []( int index ) {
+			return index >= static_cast<int>( rotor_index::Beta );
+		} );
+		if ( !greek_left || greek_elsewhere )
+		{
+			throw std::invalid_argument( "leftmost rotor must be beta (9) or gamma (10), the others I to VIII (1-8)" );
+		}
+		return result;
+	}
+
+	reflector parse_reflector( std::string_view text )
+	{
+		if ( text == "B" )
+		{
+			return reflectors::B;
+		}
+		if ( text == "C" )
+		{
+			return reflectors::C;
+		}
+		throw std::invalid_argument( "reflector must be B or C" );
+	}
+
+	std::string_view parse_letters( std::string_view text, std::string_view name )
+	{
+		if ( text.empty() || !std::all_of( begin( text ), end( text ), []( char letter ) { return letter >= 'A' && letter <= 'Z'; } ) )
+		{
+			throw std::invalid_argument( std::string( name ) + " must be uppercase letters" );
+		}
+		return text;
+	}
+
+	key parse_key( std::string_view text )
+	{
+		if ( text.size() != 4 )
+		{
+			throw std::invalid_argument( "key must be 4 letters" );
+		}
+		return key( parse_letters( text, "key" ) );
+	}
+
+	// Plug pairs, with a null terminated copy for the machine
+	struct plugboard
+	{
+		std::vector<std::string> m_pairs;
+		std::vector<const char*> m_plugs;
+	};
+
+	plugboard parse_plugs( std::optional<std::string_view> text )
+	{
+		plugboard result;
+		if ( text )
+		{
+			const auto pairs = split( *text, ',' );
+			if ( pairs.size() > 13 )
+			{
+				throw std::invalid_argument( "at most 13 plug pairs" );
+			}
+			// Plugs swap letters both ways, a letter in two pairs would not give a reciprocal machine
+			std::array<bool, 26> plugged = {};
+			for ( const auto pair : pairs )
+			{
+				if ( pair.size() != 2 || pair[ 0 ] == pair[ 1 ] )
+				{
+					throw std::invalid_argument( "plugs must be letter pairs" );
+				}
+				const auto& letters = result.m_pairs.emplace_back( parse_letters( pair, "plugs" ) );
+				for ( const auto letter : letters )
+				{
+					if ( std::exchange( plugged[ letter - 'A' ], true ) )
+					{
+						throw std::invalid_argument( "plug letters must all be different" );
+					}
+				}
+			}
+		}
+		for ( const auto& pair : result.m_pairs )
+		{
+			result.m_plugs.push_back( pair.c_str() );
+		}
+		return result;
+	}
+
+	std::string format_numbers( const std::array<int, 4>& numbers )
+	{
+		return std::to_string( numbers[ 0 ] ) + ',' + std::to_string( numbers[ 1 ] ) + ',' + std::to_string( numbers[ 2 ] ) + ','
+			+ std::to_string( numbers[ 3 ] );
+	}
+
+	std::string error_response( const std::exception& error )
+	{
+		return std::string( "ERROR " ) + error.what();
+	}
+
+	bool is_decode( std::string_view command )
+	{
+		return command == "DECODE" || command == "BULK-DECODE";
+	}
+
+	// Machine settings part of a decode request, identifies cached machines
+	std::string machine_description( const request_fields& request )
+	{
+		return std::string( request.get( "reflector" ) ) + ' ' + std::string( request.get( "rotors" ) ) + ' '
+			+ std::string( request.get( "rings" ) ) + ' ' + std::string( request.find( "plugs" ).value_or( "" ) );
+	}
+
+	std::string decode( const m4_machine& machine, const request_fields& request )
+	{
+		if ( request.m_command == "DECODE" )
+		{
+			return "OK " + machine.decode( parse_letters( request.get( "message" ), "message" ), parse_key( request.get( "key" ) ) );
+		}
+
+		std::string response = "OK ";
+		std::string buffer;
+		for ( const auto entry : split( request.get( "messages" ), ',' ) )
+		{
+			const auto colon = entry.find( ':' );
+			if ( colon == std::string_view::npos )
+			{
+				throw std::invalid_argument( "messages must be key:message pairs" );
+			}
+			machine.decode( parse_letters( entry.substr( colon + 1 ), "message" ), parse_key( entry.substr( 0, colon ) ), buffer );
+			if ( response.size() > 3 )
+			{
+				response += ',';
+			}
+			response += buffer;
+		}
+		return response;
+	}
+}
+
+request_handler::request_handler( const handler_options& options )
+	: m_options( options )
+	, m_executor( options.m_crack_workers )
+{
+}
+
+request_handler::~request_handler()
+{
+	// Queued jobs would otherwise still run to completion before the executor goes away
+	std::lock_guard lock( m_jobs_mutex );
+	for ( auto& [ id, entry ] : m_jobs )
+	{
+		entry.m_job.cancel();
+	}
+}
+
+std::shared_ptr<const m4_machine> request_handler::machine( const std::string& description,
+															const std::array<int, 4>& rotors,
+															const std::array<int, 4>& ring_settings,
+															reflector reflector,
+															std::span<const char* const> plugs )
+{
+	std::lock_guard lock( m_machines_mutex );
+	const auto cached = m_machines.find( description );
+	if ( cached != end( m_machines ) )
+	{
+		return cached->second;
+	}
+
+	if ( m_machines.size() >= m_options.m_cache_size )
+	{
+		m_machines.clear();
+	}
+	auto result = std::make_shared<const m4_machine>(
+		std::array<rotor, 4> {
+			enigma::rotors[ rotors[ 0 ] ], enigma::rotors[ rotors[ 1 ] ], enigma::rotors[ rotors[ 2 ] ], enigma::rotors[ rotors[ 3 ] ] },
+		ring_settings,
+		reflector,
+		plugs );
+	m_machines.emplace( description, result );
+	return result;
+}
+
+m4_solver::calibration request_handler::calibration( const std::string& description,
+													 const std::function<m4_solver::calibration()>& calibrate )
+{
+	{
+		std::lock_guard lock( m_calibrations_mutex );
+		const auto cached = m_calibrations.find( description );
+		if ( cached != end( m_calibrations ) )
+		{
+			return cached->second;
+		}
+	}
+
+	// Not holding the lock, other requests don't have to wait for this one (at worst two threads calibrate the same message)
+	const auto result = calibrate();
+
+	std::lock_guard lock( m_calibrations_mutex );
+	if ( m_calibrations.size() >= m_options.m_cache_size )
+	{
+		m_calibrations.clear();
+	}
+	m_calibrations.emplace( description, result );
+	return result;
+}
+
+std::string request_handler::handle( std::string_view request )
+{
+	const std::string requests[] = { std::string( request ) };
+	return std::move( handle_batch( requests ).front() );
+}
+
+std::vector<std::string> request_handler::handle_batch( std::span<const std::string> requests )
+{
+	std::vector<std::string> responses( requests.size() );
+
+	// Decodes by machine settings, the rest is handled as it comes
+	std::map<std::string, std::vector<std::pair<std::size_t, request_fields>>> decodes;
+	for ( std::size_t i = 0; i < requests.size(); ++i )
+	{
+		try
+		{
+			auto request = parse_request( requests[ i ] );
+			if ( is_decode( request.m_command ) )
+			{
+				auto description = machine_description( request );
+				decodes[ std::move( description ) ].emplace_back( i, std::move( request ) );
+			}
+			else if ( request.m_command == "CRACK" )
+			{
+				responses[ i ] = handle_crack( requests[ i ] );
+			}
+			else if ( request.m_command == "STATUS" || request.m_command == "CANCEL" )
+			{
+				responses[ i ] = handle_job( requests[ i ] );
+			}
+			else if ( request.m_command == "SHUTDOWN" )
+			{
+				m_shutdown_requested = true;
+				responses[ i ] = "OK";
+			}
+			else
+			{
+				throw std::invalid_argument( "unknown command " + std::string( request.m_command ) );
+			}
+		}
+		catch ( const std::exception& error )
+		{
+			responses[ i ] = error_response( error );
+		}
+	}
+
+	for ( const auto& [ description, group ] : decodes )
+	{
+		try
+		{
+			const auto& settings = group.front().second;
+			const auto plugs = parse_plugs( settings.find( "plugs" ) );
+			const auto group_machine = machine( description,
+												parse_rotors( settings.get( "rotors" ) ),
+												parse_numbers( settings.get( "rings" ), "rings", 0, 25 ),
+												parse_reflector( settings.get( "reflector" ) ),
+												plugs.m_plugs );
+
+			for ( const auto& [ index, request ] : group )
+			{
+				try
+				{
+					responses[ index ] = decode( *group_machine, request );
+				}
+				catch ( const std::exception& error )
+				{
+					responses[ index ] = error_response( error );
+				}
+			}
+		}
+		catch ( const std::exception& error )
+		{
+			for ( const auto& [ index, request ] : group )
+			{
+				responses[ index ] = error_response( error );
+			}
+		}
+	}
+
+	return responses;
+}
+
+std::string request_handler::handle_crack( std::string_view text )
+{
+	const auto request = parse_request( text );
+
+	const auto reflector_name = request.get( "reflector" );
+	const auto reflector = parse_reflector( reflector_name );
+	const auto plugs = parse_plugs( request.find( "plugs" ) );
+	const auto message = parse_letters( request.get( "message" ), "message" );
+	const auto plaintext = request.find( "plaintext" );
+	const auto crib = request.find( "crib" );
+	if ( plaintext.has_value() == crib.has_value() )
+	{
+		throw std::invalid_argument( "expected either plaintext or crib" );
+	}
+
+	m4_solver::options options;
+	if ( const auto priority = request.find( "priority" ) )
+	{
+		options.m_priority = static_cast<int>( parse_number( *priority, "priority" ) );
+	}
+	if ( const auto orders = request.find( "orders" ) )
+	{
+		for ( const auto order : split( *orders, ',' ) )
+		{
+			options.m_rotor_orders.push_back( parse_rotors( order, '/' ) );
+		}
+	}
+
+	const auto description = std::string( reflector_name ) + ' ' + std::string( request.find( "plugs" ).value_or( "" ) ) + ' '
+		+ std::string( message ) + ' ' + ( plaintext ? "plaintext=" + std::string( *plaintext ) : "crib=" + std::string( *crib ) ) + ' '
+		+ std::string( request.find( "crib_start" ).value_or( "" ) );
+
+	std::optional<m4_solver::crack_job> job;
+	if ( plaintext )
+	{
+		parse_letters( *plaintext, "plaintext" );
+		options.m_calibration
+			= calibration( description, [ & ] { return m4_solver::calibrate( message, reflector, plugs.m_plugs, *plaintext ); } );
+		job = m4_solver::crack_settings_async( m_executor, message, reflector, plugs.m_plugs, *plaintext, options );
+	}
+	else
+	{
+		parse_letters( *crib, "crib" );
+		auto locations = find_potential_crib_location( message, *crib );
+		if ( const auto crib_start = request.find( "crib_start" ) )
+		{
+			const auto start = parse_number( *crib_start, "crib_start" );
+			std::erase_if( locations, [ start ]( std::size_t location ) { return location < start; } );
+		}
+		if ( locations.empty() )
+		{
+			throw std::invalid_argument( "crib cannot be found in message" );
+		}
+		options.m_calibration = calibration( description, [ & ] {
+			return m4_solver::calibrate_with_crib( message, reflector, plugs.m_plugs, *crib, locations );
+		} );
+		job = m4_solver::crack_settings_with_crib_async( m_executor, message, reflector, plugs.m_plugs, *crib, locations, options );
+	}
+
+	std::lock_guard lock( m_jobs_mutex );
+	const auto id = m_next_job++;
+	m_jobs.emplace( id, job_entry { std::move( *job ) } );
+	return "OK job=" + std::to_string( id );
+}
+
+std::string request_handler::handle_job( std::string_view text )
+{
+	const auto request = parse_request( text );
+	const auto id = parse_number( request.get( "job" ), "job" );
+
+	std::lock_guard lock( m_jobs_mutex );
+	const auto entry = m_jobs.find( id );
+	if ( entry == end( m_jobs ) )
+	{
+		throw std::invalid_argument( "unknown job" );
+	}
+	auto& [ job, cancelled ] = entry->second;
+
+	if ( request.m_command == "CANCEL" )
+	{
+		job.cancel();
+		cancelled = true;
+		return "OK";
+	}
+
+	if ( !job.ready() )
+	{
+		return "OK running";
+	}
+
+	// The outcome is only reported once, the job is then forgotten
+	const auto settings = job.get();
+	std::string response = cancelled ? "OK cancelled" : "OK failed";
+	if ( settings )
+	{
+		response = "OK found rotors=" + format_numbers( settings->m_rotors ) + " rings=" + format_numbers( settings->m_ring_settings )
+			+ " key=" + std::string( settings->m_key.view() );
+	}
+	m_jobs.erase( entry );
+	return response;
+}
+
+// Sockets
+
+namespace
+{
+#if defined( _WIN32 )
+	constexpr std::intptr_t invalid_socket = static_cast<std::intptr_t>( INVALID_SOCKET );
+	constexpr int send_flags = 0;
+
+	std::error_code last_socket_error()
+	{
+		return std::error_code( WSAGetLastError(), std::system_category() );
+	}
+
+	void close_socket( std::intptr_t socket )
+	{
+		closesocket( static_cast<SOCKET>( socket ) );
+	}
+
+	// Whether accept() failed for this connection only and can be called again right away
+	bool transient_accept_error()
+	{
+		const auto error = WSAGetLastError();
+		return error == WSAEINTR || error == WSAECONNRESET;
+	}
+
+	void start_sockets()
+	{
+		static const bool started = [] {
+			WSADATA data;
+			return WSAStartup( MAKEWORD( 2, 2 ), &data ) == 0;
+		}();
+		if ( !started )
+		{
+			throw std::system_error( last_socket_error(), "WSAStartup" );
+		}
+	}
+#else
+	constexpr std::intptr_t invalid_socket = -1;
+#if defined( MSG_NOSIGNAL )
+	// A client going away must not kill the server with SIGPIPE
+	constexpr int send_flags = MSG_NOSIGNAL;
+#else
+	constexpr int send_flags = 0;
+#endif
+
+	std::error_code last_socket_error()
+	{
+		return std::error_code( errno, std::system_category() );
+	}
+
+	void close_socket( std::intptr_t socket )
+	{
+		close( static_cast<int>( socket ) );
+	}
+
+	bool transient_accept_error()
+	{
+		return errno == EINTR || errno == ECONNABORTED;
+	}
+
+	void start_sockets()
+	{
+	}
+#endif
+
+	sockaddr_un socket_address( const std::string& path )
+	{
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if ( path.size() >= sizeof( address.sun_path ) )
+		{
+			throw std::system_error( std::make_error_code( std::errc::filename_too_long ), path );
+		}
+		std::copy( begin( path ), end( path ), address.sun_path );
+		return address;
+	}
+
+	std::intptr_t open_socket()
+	{
+		start_sockets();
+		const auto result = static_cast<std::intptr_t>( socket( AF_UNIX, SOCK_STREAM, 0 ) );
+		if ( result == invalid_socket )
+		{
+			throw std::system_error( last_socket_error(), "socket" );
+		}
+		return result;
+	}
+
+	bool send_line( std::intptr_t socket, std::string line )
+	{
+		line += '\n';
+		for ( std::string_view remaining = line; !remaining.empty(); )
+		{
+			const auto sent = send( socket, remaining.data(), static_cast<int>( remaining.size() ), send_flags );
+			if ( sent <= 0 )
+			{
+				return false;
+			}
+			remaining.remove_prefix( sent );
+		}
+		return true;
+	}
+
+	// Reads up to the next end of line (not included), false once the peer is gone
+	bool receive_line( std::intptr_t socket, std::string& pending, std::string& line )
+	{
+		while ( true )
+		{
+			const auto end = pending.find( '\n' );
+			if ( end != std::string::npos )
+			{
+				line.assign( pending, 0, end );
+				pending.erase( 0, end + 1 );
+				return true;
+			}
+
+			char buffer[ 4096 ];
+			const auto received = recv( socket, buffer, sizeof( buffer ), 0 );
+			if ( received <= 0 )
+			{
+				return false;
+			}
+			pending.append( buffer, received );
+		}
+	}
+}
+
+struct unix_socket_server::pending_request
+{
+	std::string m_line;
+	std::promise<std::string> m_response;
+};
+
+unix_socket_server::unix_socket_server( std::string path, request_handler& handler )
+	: m_path( std::move( path ) )
+	, m_handler( handler )
+	, m_listener( open_socket() )
+{
+	const auto address = socket_address( m_path );
+	// Left behind by a previous run that didn't shut down cleanly
+	std::remove( m_path.c_str() );
+
+	if ( bind( m_listener, reinterpret_cast<const sockaddr*>( &address ), sizeof( address ) ) != 0 || listen( m_listener, SOMAXCONN ) != 0 )
+	{
+		const auto error = last_socket_error();
+		close_socket( m_listener );
+		throw std::system_error( error, m_path );
+	}
+
+	m_batch_thread = std::jthread( [ this ]( std::stop_token stop_token ) { run_batches( stop_token ); } );
+}
+
+unix_socket_server::~unix_socket_server()
+{
+	stop();
+	{
+		std::unique_lock lock( m_connections_mutex );
+		m_connections_done.wait( lock, [ this ] { return m_active_connections == 0; } );
+	}
+
+	m_batch_thread.request_stop();
+	m_batch_thread.join();
+
+#if !defined( _WIN32 )
+	close_socket( m_listener );
+#endif
+	std::remove( m_path.c_str() );
+}
+
+void unix_socket_server::run()
+{
+	while ( !m_stopping )
+	{
+		const auto connection = static_cast<std::intptr_t>( accept( m_listener, nullptr, nullptr ) );
+		if ( connection == invalid_socket )
+		{
+			// Errors like running out of descriptors last a while, don't spin on them
+			if ( !m_stopping && !transient_accept_error() )
+			{
+				std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+			}
+			continue;
+		}
+
+		std::lock_guard lock( m_connections_mutex );
+		if ( m_stopping )
+		{
+			close_socket( connection );
+			break;
+		}
+		m_connections.push_back( connection );
+		++m_active_connections;
+		std::thread( [ this, connection ] { serve_connection( connection ); } ).detach();
+	}
+}
+
+void unix_socket_server::stop()
+{
+	std::lock_guard lock( m_connections_mutex );
+	if ( m_stopping.exchange( true ) )
+	{
+		return;
+	}
+
+	// Wakes up accept() and any connection waiting for a request
+#if defined( _WIN32 )
+	close_socket( m_listener );
+	for ( const auto connection : m_connections )
+	{
+		shutdown( static_cast<SOCKET>( connection ), SD_BOTH );
+	}
+#else
+	shutdown( static_cast<int>( m_listener ), SHUT_RDWR );
+	for ( const auto connection : m_connections )
+	{
+		shutdown( static_cast<int>( connection ), SHUT_RDWR );
+	}
+#endif
+}
+
+void unix_socket_server::serve_connection( std::intptr_t connection )
+{
+	std::string pending;
+	std::string line;
+	while ( receive_line( connection, pending, line ) )
+	{
+		if ( !line.empty() && line.back() == '\r' )
+		{
+			line.pop_back();
+		}
+		if ( line.empty() )
+		{
+			continue;
+		}
+
+		const auto command = std::string_view( line ).substr( 0, line.find( ' ' ) );
+		auto response = is_decode( command ) ? queue_decode( line ) : m_handler.handle( line );
+		if ( !send_line( connection, std::move( response ) ) )
+		{
+			break;
+		}
+
+		if ( m_handler.shutdown_requested() )
+		{
+			stop();
+		}
+	}
+
+	std::lock_guard lock( m_connections_mutex );
+	std::erase( m_connections, connection );
+	close_socket( connection );
+	if ( --m_active_connections == 0 )
+	{
+		m_connections_done.notify_all();
+	}
+}
+
+std::string unix_socket_server::queue_decode( std::string line )
+{
+	auto request = std::make_shared<pending_request>();
+	request->m_line = std::move( line );
+	auto response = request->m_response.get_future();
+
+	{
+		std::lock_guard lock( m_queue_mutex );
+		m_queue.push_back( std::move( request ) );
+	}
+	m_request_ready.notify_one();
+
+	return response.get();
+}
+
+void unix_socket_server::run_batches( std::stop_token stop_token )
+{
+	std::vector<std::shared_ptr<pending_request>> batch;
+	std::vector<std::string> lines;
+	while ( true )
+	{
+		{
+			std::unique_lock lock( m_queue_mutex );
+			// Whatever arrived while the previous batch was being decoded makes up the next one
+			m_request_ready.wait( lock, stop_token, [ this ] { return !m_queue.empty(); } );
+			if ( m_queue.empty() )
+			{
+				return;
+			}
+			batch.swap( m_queue );
+		}
+
+		lines.clear();
+		for ( const auto& request : batch )
+		{
+			lines.push_back( std::move( request->m_line ) );
+		}
+
+		auto responses = m_handler.handle_batch( lines );
+		for ( std::size_t i = 0; i < batch.size(); ++i )
+		{
+			batch[ i ]->m_response.set_value( std::move( responses[ i ] ) );
+		}
+		batch.clear();
+	}
+}
+
+std::string server::send_request( const std::string& path, std::string_view request )
+{
+	const auto address = socket_address( path );
+	const auto connection = open_socket();
+
+	std::string response;
+	std::string pending;
+	const bool ok = connect( connection, reinterpret_cast<const sockaddr*>( &address ), sizeof( address ) ) == 0
+		&& send_line( connection, std::string( request ) ) && receive_line( connection, pending, response );
+	const auto error = last_socket_error();
+	close_socket( connection );
+
+	if ( !ok )
+	{
+		throw std::system_error( error ? error : std::make_error_code( std::errc::connection_reset ), path );
+	}
+	return response;
+}
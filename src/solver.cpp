@@ -1,11 +1,25 @@
 #include "enigma/solver.h"
 
+#include "enigma/bitsliced.h"
+#include "enigma/bounded_queue.h"
+#include "enigma/hit_log.h"
+#include "enigma/perf_counters.h"
+#include "enigma/thread_pool.h"
+#include "enigma/tiled.h"
+#include "enigma/trace.h"
+
 #include <atomic>
-#include <execution>
+#include <bit>
+#include <bitset>
+#include <cmath>
 #include <iostream>
+#include <map>
+#include <memory_resource>
 #include <numeric>
+#include <random>
 #include <stdexcept>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 using namespace enigma;
@@ -46,6 +60,576 @@ namespace
 
 		return combinations;
 	}
+
+	const std::vector<std::array<int, 4>>& rotor_orders( const m4_solver::options& options )
+	{
+		static const auto rotor_combinations = generate_rotor_combinations();
+		return options.m_rotor_orders.empty() ? rotor_combinations : options.m_rotor_orders;
+	}
+
+	// Same options with rotor orders sorted by decreasing prescreen score (if any, in rotor_orders( options ) order)
+	// then weight, ties keep their usual order
+	m4_solver::options prioritized( const m4_solver::options& options, std::span<const double> prescreen_scores = {} )
+	{
+		const auto& weights = options.m_priorities.m_rotor_order_weights;
+		if ( prescreen_scores.empty() && weights.empty() )
+		{
+			return options;
+		}
+
+		const auto& orders = rotor_orders( options );
+		const auto weight = [ & ]( std::size_t order ) {
+			const auto entry = weights.find( orders[ order ] );
+			return entry != end( weights ) ? entry->second : 0.0;
+		};
+		std::vector<std::size_t> ranking( orders.size() );
+		std::iota( begin( ranking ), end( ranking ), 0 );
+		std::stable_sort( begin( ranking ), end( ranking ), [ & ]( std::size_t lhs, std::size_t rhs ) {
+			if ( !prescreen_scores.empty() && prescreen_scores[ lhs ] != prescreen_scores[ rhs ] )
+			{
+				return prescreen_scores[ lhs ] > prescreen_scores[ rhs ];
+			}
+			return weight( lhs ) > weight( rhs );
+		} );
+
+		auto result = options;
+		result.m_rotor_orders.clear();
+		for ( const auto order : ranking )
+		{
+			result.m_rotor_orders.push_back( orders[ order ] );
+		}
+		return result;
+	}
+
+	// Rotor orders (indices in rotor_orders( options )) in the order to sweep them. Unless options ask for an order of their
+	// own, those sharing their two fast rotors come one after the other so that workers read the same fast_rotor_tables.
+	std::vector<std::size_t> sweep_schedule( const m4_solver::options& options )
+	{
+		const auto& orders = rotor_orders( options );
+		std::vector<std::size_t> schedule( orders.size() );
+		std::iota( begin( schedule ), end( schedule ), 0 );
+		if ( options.m_rotor_orders.empty() )
+		{
+			std::stable_sort( begin( schedule ), end( schedule ), [ & ]( std::size_t lhs, std::size_t rhs ) {
+				return std::tie( orders[ lhs ][ 2 ], orders[ lhs ][ 3 ] ) < std::tie( orders[ rhs ][ 2 ], orders[ rhs ][ 3 ] );
+			} );
+		}
+		return schedule;
+	}
+
+	using fast_tables_map = std::map<std::array<int, 2>, std::shared_ptr<const fast_rotor_tables>>;
+
+	// Tables of each pair of fast rotors found in orders at ring settings 0, built once for all the orders using them
+	fast_tables_map make_fast_tables( std::span<const std::array<int, 4>> orders, std::span<const char* const> plugs )
+	{
+		fast_tables_map tables;
+		for ( const auto& order : orders )
+		{
+			auto& entry = tables[ { order[ 2 ], order[ 3 ] } ];
+			if ( !entry )
+			{
+				entry = std::make_shared<const fast_rotor_tables>( rotors[ order[ 2 ] ], rotors[ order[ 3 ] ], std::array { 0, 0 }, plugs );
+			}
+		}
+		return tables;
+	}
+
+	m4_machine make_sweep_machine( const std::array<int, 4>& order,
+								   reflector reflector,
+								   std::span<const char* const> plugs,
+								   const fast_tables_map& fast_tables )
+	{
+		return m4_machine( { rotors[ order[ 0 ] ], rotors[ order[ 1 ] ], rotors[ order[ 2 ] ], rotors[ order[ 3 ] ] },
+						   { 0, 0, 0, 0 },
+						   reflector,
+						   plugs,
+						   fast_tables.at( { order[ 2 ], order[ 3 ] } ) );
+	}
+
+	constexpr std::size_t keys_per_rotor_order = 26 * 26 * 26 * 26;
+	constexpr std::size_t total_keys = std::size_t( 2 ) * 8 * 7 * 6 * keys_per_rotor_order;
+
+	// Decodes done by fine_tune_key for each false positive (one per right and middle right ring setting)
+	constexpr std::size_t fine_tune_decodes = 26 * 2;
+
+	template <typename score_type>
+	m4_solver::calibration calibrate( std::string_view message,
+									  reflector reflector,
+									  std::span<const char* const> plugs,
+									  const score_type& score,
+									  const m4_solver::options& options )
+	{
+		static const auto rotor_combinations = generate_rotor_combinations();
+
+		const std::size_t sample_count = std::max<std::size_t>( options.m_calibration_samples, 100 );
+
+		// Fixed seed so that a given message always gets the same thresholds
+		std::mt19937_64 random( 0x454e49474d41 );
+		std::uniform_int_distribution<std::size_t> pick_rotors( 0, rotor_combinations.size() - 1 );
+		std::uniform_int_distribution<int> pick_letter( 0, 25 );
+
+		std::vector<std::size_t> samples;
+		samples.reserve( sample_count );
+		key key;
+		std::string buffer;
+
+		perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::calibration );
+		counters.add_keys( sample_count );
+		for ( std::size_t i = 0; i < sample_count; ++i )
+		{
+			const auto& rotor_settings = rotor_combinations[ pick_rotors( random ) ];
+			const m4_machine machine( { rotors[ rotor_settings[ 0 ] ],
+										rotors[ rotor_settings[ 1 ] ],
+										rotors[ rotor_settings[ 2 ] ],
+										rotors[ rotor_settings[ 3 ] ] },
+									  { 0, 0, 0, 0 },
+									  reflector,
+									  plugs );
+			for ( std::size_t letter = 0; letter < 4; ++letter )
+			{
+				key[ letter ] = static_cast<char>( 'A' + pick_letter( random ) );
+			}
+			machine.decode( message, key, buffer );
+			samples.push_back( score( buffer ) );
+		}
+
+		std::sort( begin( samples ), end( samples ) );
+
+		const double mean = std::accumulate( begin( samples ), end( samples ), 0.0 ) / samples.size();
+		const auto add_squared_deviation = [ mean ]( double sum, std::size_t sample ) {
+			return sum + ( sample - mean ) * ( sample - mean );
+		};
+		const double variance = std::accumulate( begin( samples ), end( samples ), 0.0, add_squared_deviation ) / samples.size();
+
+		// Random keys never get close to the rates we want (a full sweep is ~3e8 keys), so fit an exponential
+		// on the top percentile of the distribution and extrapolate the tail from there (peaks over threshold)
+		const std::size_t tail_start = samples[ samples.size() * 99 / 100 ];
+		const auto tail_begin = std::upper_bound( begin( samples ), end( samples ), tail_start );
+		const auto tail_size = std::distance( tail_begin, end( samples ) );
+		// Coarse scores (short cribs) may leave nothing above the percentile, samples then only tell the rate is below 1 / n
+		const double tail_probability = std::max( static_cast<double>( tail_size ) / samples.size(), 1.0 / samples.size() );
+		const auto add_excess = [ tail_start ]( double sum, std::size_t sample ) { return sum + ( sample - tail_start ); };
+		const double tail_scale = tail_size == 0 ? 1.0 : std::accumulate( tail_begin, end( samples ), 0.0, add_excess ) / tail_size;
+
+		// Probability for a wrong key to score at least the given value
+		const auto false_positive_rate = [ & ]( std::size_t threshold ) {
+			if ( threshold <= tail_start )
+			{
+				const auto above = std::distance( std::lower_bound( begin( samples ), end( samples ), threshold ), end( samples ) );
+				return static_cast<double>( above ) / samples.size();
+			}
+			return tail_probability * std::exp( -( threshold - 1.0 - tail_start ) / tail_scale );
+		};
+
+		std::size_t threshold = tail_start + 1;
+		if ( options.m_false_positive_rate < tail_probability )
+		{
+			threshold += static_cast<std::size_t>( std::ceil( tail_scale * std::log( tail_probability / options.m_false_positive_rate ) ) );
+		}
+		else
+		{
+			// Target rate is loose enough to be read directly from the samples
+			while ( threshold > 1 && false_positive_rate( threshold - 1 ) <= options.m_false_positive_rate )
+			{
+				--threshold;
+			}
+		}
+
+		m4_solver::calibration result;
+		result.m_threshold = threshold;
+		result.m_false_positive_rate = false_positive_rate( threshold );
+		result.m_expected_false_positives = result.m_false_positive_rate * total_keys;
+		result.m_expected_fine_tune_decodes = result.m_expected_false_positives * fine_tune_decodes;
+		result.m_mean_score = mean;
+		result.m_score_deviation = std::sqrt( variance );
+		result.m_samples = samples.size();
+		result.m_tail_start = tail_start;
+		result.m_tail_probability = tail_probability;
+		result.m_tail_scale = tail_scale;
+		return result;
+	}
+
+	struct message_segment
+	{
+		std::size_t m_start;
+		std::size_t m_length;
+	};
+
+	// Merge overlapping crib windows so that each letter is decoded at most once
+	std::vector<message_segment> make_crib_segments( std::vector<message_segment> windows )
+	{
+		std::sort( begin( windows ), end( windows ), []( const message_segment& lhs, const message_segment& rhs ) {
+			return lhs.m_start < rhs.m_start;
+		} );
+
+		std::vector<message_segment> segments;
+		for ( const auto& window : windows )
+		{
+			if ( !segments.empty() && window.m_start <= segments.back().m_start + segments.back().m_length )
+			{
+				segments.back().m_length = std::max( segments.back().m_length, window.m_start + window.m_length - segments.back().m_start );
+			}
+			else
+			{
+				segments.push_back( window );
+			}
+		}
+		return segments;
+	}
+
+	void decode_segments( const m4_machine& machine,
+						  std::string_view message,
+						  std::span<const message_segment> segments,
+						  key key,
+						  std::span<char> output )
+	{
+		for ( const auto& segment : segments )
+		{
+			machine.decode_from( message.substr( segment.m_start, segment.m_length ),
+								 key,
+								 segment.m_start,
+								 output.subspan( segment.m_start, segment.m_length ) );
+		}
+	}
+
+	// Key strokes cannot always be undone unambiguously (middle rotor double stepping)
+	// so check the rolled back key and look for a better one around it if needed
+	key rollback_message_key( const m4_machine& machine, key key, std::size_t position )
+	{
+		const auto candidate = machine.rollback_key( key, position );
+		auto adjusted_key = candidate;
+
+		for ( const int middle_left_offset : { 0, -1, 1, -2, 2 } )
+		{
+			adjusted_key[ 1 ] = 'A' + ( ( candidate[ 1 ] - 'A' + middle_left_offset + 26 ) % 26 );
+			for ( const int middle_right_offset : { 0, -1, 1, -2, 2 } )
+			{
+				adjusted_key[ 2 ] = 'A' + ( ( candidate[ 2 ] - 'A' + middle_right_offset + 26 ) % 26 );
+				if ( machine.advance_key( adjusted_key, position ) == key )
+				{
+					return adjusted_key;
+				}
+			}
+		}
+
+		return candidate;
+	}
+
+	m4_machine make_machine( const m4_solver::settings& settings, reflector reflector, std::span<const char* const> plugs )
+	{
+		return m4_machine( { rotors[ settings.m_rotors[ 0 ] ],
+							 rotors[ settings.m_rotors[ 1 ] ],
+							 rotors[ settings.m_rotors[ 2 ] ],
+							 rotors[ settings.m_rotors[ 3 ] ] },
+						   settings.m_ring_settings,
+						   reflector,
+						   plugs );
+	}
+
+	// Candidates found at rings 0, logged with the key at the start of the message
+	hit_log::hit make_hit( const m4_solver::settings& candidate,
+						   key message_key,
+						   std::size_t score,
+						   hit_log::stage stage,
+						   hit_log::outcome outcome,
+						   std::size_t reflector )
+	{
+		return { { static_cast<std::uint8_t>( candidate.m_rotors[ 0 ] ),
+				   static_cast<std::uint8_t>( candidate.m_rotors[ 1 ] ),
+				   static_cast<std::uint8_t>( candidate.m_rotors[ 2 ] ),
+				   static_cast<std::uint8_t>( candidate.m_rotors[ 3 ] ) },
+				 message_key.index(),
+				 static_cast<std::uint32_t>( score ),
+				 stage,
+				 outcome,
+				 static_cast<std::uint8_t>( reflector ),
+				 0 };
+	}
+
+	std::vector<std::size_t> relative_locations( std::span<const std::size_t> locations, std::size_t start )
+	{
+		std::vector<std::size_t> result;
+		result.reserve( locations.size() );
+		std::transform( begin( locations ), end( locations ), std::back_inserter( result ), [ start ]( std::size_t location ) {
+			return location - start;
+		} );
+		return result;
+	}
+
+	crib_match_scorer make_crib_score( std::string_view crib, std::span<const std::size_t> crib_locations )
+	{
+		const auto end_location = *std::max_element( begin( crib_locations ), end( crib_locations ) ) + crib.size();
+		return crib_match_scorer( crib, crib_locations, end_location );
+	}
+
+	// Sum of the scores of each crib at its best location
+	class joint_crib_score
+	{
+	public:
+		explicit joint_crib_score( std::span<const m4_solver::crib> cribs )
+		{
+			for ( const auto& crib : cribs )
+			{
+				m_scores.push_back( make_crib_score( crib.m_text, crib.m_locations ) );
+			}
+		}
+
+		std::size_t operator()( std::string_view candidate ) const
+		{
+			std::size_t score = 0;
+			for ( const auto& crib_score : m_scores )
+			{
+				score += crib_score( candidate );
+			}
+			return score;
+		}
+
+	private:
+		std::vector<crib_match_scorer> m_scores;
+	};
+
+	struct scored_key
+	{
+		std::size_t m_score;
+		key m_key;
+	};
+
+	// Rotor positions stepped from one key, shared by messages whatever their plugs. Plugboard aside, the fast rotors come from
+	// plug free fast_rotor_tables and the left and greek rotors fold with the reflector into one table per left rotor position.
+	class shared_rotor_state
+	{
+	public:
+		using table = fast_rotor_tables::table;
+
+		// Tables must be plug free and built from the same fast rotors as wheels, at ring settings 0
+		shared_rotor_state( const std::array<rotor, 4>& wheels, reflector reflector, const fast_rotor_tables& tables, std::size_t length )
+			: m_machine( wheels, { 0, 0, 0, 0 }, reflector, {} )
+			, m_wheels( wheels )
+			, m_reflector( reflector )
+			, m_tables( tables )
+			, m_trace( length )
+			, m_indices( length )
+			, m_folds( length )
+		{
+		}
+
+		// Step the first length() positions from key
+		void reset( key key )
+		{
+			m_machine.trace( key, m_trace );
+			m_ready.reset();
+			for ( std::size_t i = 0; i < m_trace.size(); ++i )
+			{
+				const auto& offsets = m_trace[ i ];
+				m_indices[ i ] = static_cast<std::uint16_t>( offsets[ 2 ] * 26 + offsets[ 3 ] );
+				m_folds[ i ] = &fold( offsets[ 0 ], offsets[ 1 ] );
+			}
+		}
+
+		std::size_t length() const { return m_trace.size(); }
+
+		// Decode message letters typed from position start, plugboard giving each letter's plug (0 to 25)
+		void decode( std::string_view message, std::size_t start, const table& plugboard, std::span<char> output ) const
+		{
+			for ( std::size_t i = 0; i < message.size(); ++i )
+			{
+				const auto index = m_indices[ start + i ];
+				const auto contact = ( *m_folds[ start + i ] )[ m_tables.m_inward[ index ][ plugboard[ message[ i ] - 'A' ] ] ];
+				output[ i ] = static_cast<char>( 'A' + plugboard[ m_tables.m_outward[ index ][ contact ] ] );
+			}
+		}
+
+	private:
+		// Contact on the left of the middle rotor to the one it comes back to, the greek wheel never moves during a key
+		const table& fold( int greek_offset, int left_offset )
+		{
+			auto& folded = m_left_folds[ left_offset ];
+			if ( !m_ready.test( left_offset ) )
+			{
+				for ( int contact = 0; contact < 26; ++contact )
+				{
+					auto input = m_wheels[ 1 ].m_wiring[ contact + left_offset + 26 ];
+					input = m_wheels[ 0 ].m_wiring[ input - 'A' + greek_offset - left_offset + 26 ];
+					input = m_reflector.m_wiring[ input - 'A' - greek_offset + 26 ];
+					input = m_wheels[ 0 ].m_reversed_wiring[ input - 'A' + greek_offset + 26 ];
+					input = m_wheels[ 1 ].m_reversed_wiring[ input - 'A' + left_offset - greek_offset + 26 ];
+					folded[ contact ] = static_cast<std::uint8_t>( ( input - 'A' - left_offset + 26 ) % 26 );
+				}
+				m_ready.set( left_offset );
+			}
+			return folded;
+		}
+
+		m4_machine m_machine;
+		std::array<rotor, 4> m_wheels;
+		reflector m_reflector;
+		const fast_rotor_tables& m_tables;
+		std::vector<m4_machine::offsets> m_trace;
+		std::vector<std::uint16_t> m_indices;
+		std::vector<const table*> m_folds;
+		std::array<table, 26> m_left_folds;
+		std::bitset<26> m_ready;
+	};
+
+	// Sweep results of a rotor order, allocated from an arena local to the worker running it
+	using key_matches = std::pmr::vector<key>;
+
+	// Crib attack on a single message, with one or more cribs scored together. Message keys are swept at the first possible
+	// crib location instead of the start of the message so that only crib windows have to be decoded, results are mapped back after.
+	class crib_attack
+	{
+	public:
+		crib_attack( std::string_view message,
+					 reflector reflector,
+					 std::span<const char* const> plugs,
+					 std::span<const m4_solver::crib> cribs );
+		crib_attack( std::string_view message,
+					 reflector reflector,
+					 std::span<const char* const> plugs,
+					 std::string_view crib,
+					 std::span<const std::size_t> crib_locations );
+
+		// Keys (at the first crib location) reaching threshold
+		void sweep( const m4_machine& machine, std::size_t threshold, key_matches& matches ) const;
+		// Same, only for keys whose right letter is set
+		void sweep( const m4_machine& machine, std::size_t threshold, std::bitset<26> right_letters, key_matches& matches ) const;
+		// Right letters of sweep keys for which every crib fits one of its windows with at most that many contradictions,
+		// whatever the right ring (see involution_contradictions)
+		std::bitset<26> right_letters( const rotor& right_rotor, std::size_t contradictions ) const;
+		// Letters from the first crib location that crib windows reach
+		std::size_t window_end() const;
+		// Joint score of the windows decoded at the rotor positions of state (stepped from the first crib location, at least
+		// window_end() of them), buffer being at least as large as the message
+		std::size_t score( const shared_rotor_state& state, std::span<char> buffer ) const;
+		// Joint score of a sweep candidate (key at the first crib location)
+		std::size_t score( const m4_solver::settings& candidate ) const;
+		// Best count keys (at the first crib location), best first
+		std::vector<scored_key> best_keys( const m4_machine& machine, std::size_t count ) const;
+		// Fine tune rings for a sweep result, returns settings with the message key
+		std::optional<m4_solver::settings> verify( const m4_solver::settings& candidate ) const;
+		// Message key decoding every crib exactly at one of its locations with known rings
+		std::optional<key> find_key( const m4_machine& machine ) const;
+		// Map a sweep key back to the start of the message
+		key message_key( const m4_machine& machine, key key ) const;
+
+	private:
+		// Fine tune around the best window of a single crib
+		std::optional<m4_solver::settings> verify_crib( const m4_solver::settings& candidate ) const;
+		// Fine tune from the first window on the joint score, validating all cribs at once
+		std::optional<m4_solver::settings> verify_cribs( const m4_solver::settings& candidate ) const;
+		// Every crib appears at one of its (window relative) locations
+		bool contains_cribs( std::string_view candidate ) const;
+
+		std::string_view m_message;
+		reflector m_reflector;
+		std::span<const char* const> m_plugs;
+		// Plug of each letter, 0 to 25
+		fast_rotor_tables::table m_plugboard;
+		std::size_t m_start;
+		// Same cribs with locations relative to m_start
+		std::vector<m4_solver::crib> m_cribs;
+		std::vector<message_segment> m_segments;
+		joint_crib_score m_score;
+		pattern_matcher m_matcher;
+		// Joint score of a decode matching all cribs
+		std::size_t m_exact_score;
+	};
+
+	// -log of the probability for the best key of a wrong rotor order to score that high
+	double best_key_evidence( const m4_solver::calibration& calibration, std::size_t score )
+	{
+		const double log_rate = std::log( calibration.m_tail_probability )
+			- ( static_cast<double>( score ) - 1.0 - calibration.m_tail_start ) / calibration.m_tail_scale;
+		return std::max( 0.0, -( log_rate + std::log( static_cast<double>( keys_per_rotor_order ) ) ) );
+	}
+
+	// Without a crib, keep the key giving the most language like decode if it stands out from random text
+	std::optional<key> best_language_key( const m4_machine& machine, std::string_view message )
+	{
+		key best_key;
+		float best_index = 0;
+
+		std::array<float, 26> coincidences;
+		for ( std::uint32_t prefix = 0; prefix < key::count; prefix += 26 )
+		{
+			machine.coincidence_by_right_letter( message, key::from_index( prefix ), coincidences );
+			const auto best = std::max_element( begin( coincidences ), end( coincidences ) );
+			if ( *best > best_index )
+			{
+				best_index = *best;
+				best_key = key::from_index( prefix + static_cast<std::uint32_t>( best - begin( coincidences ) ) );
+			}
+		}
+
+		// Random text is around 1.0 with a deviation of sqrt( 50 ) / length, German closer to 2.0
+		if ( best_index < 1.0 + 7 * std::sqrt( 50.0 ) / message.size() )
+		{
+			return std::nullopt;
+		}
+		return best_key;
+	}
+
+	// Rotor order and rings are known from one message, find the keys of the others
+	m4_solver::day_key complete_day_key( std::span<const m4_solver::intercept> intercepts,
+										 std::span<const std::size_t> cribbed,
+										 std::span<const crib_attack> attacks,
+										 std::size_t solved,
+										 const m4_solver::settings& found,
+										 reflector reflector,
+										 std::span<const char* const> plugs )
+	{
+		std::vector<std::optional<key>> keys( intercepts.size() );
+		auto machine = make_machine( found, reflector, plugs );
+		for ( std::size_t i = 0; i < attacks.size(); ++i )
+		{
+			keys[ cribbed[ i ] ] = i == solved ? std::optional( found.m_key ) : attacks[ i ].find_key( machine );
+		}
+
+		// Cribs only pin the middle right ring down if its turnover happens where they were found, so pick the one giving the
+		// most language like decodes of whole messages (moving keys along with it to keep rotor positions at the start)
+		const auto shift_key = []( key key, int shift ) {
+			key[ 2 ] = 'A' + ( key[ 2 ] - 'A' + shift ) % 26;
+			return key;
+		};
+		std::array<double, 26> scores = {};
+		for ( int shift = 0; shift < 26; ++shift )
+		{
+			auto shifted = found;
+			shifted.m_ring_settings[ 2 ] = ( found.m_ring_settings[ 2 ] + shift ) % 26;
+			const auto shifted_machine = make_machine( shifted, reflector, plugs );
+			for ( std::size_t i = 0; i < intercepts.size(); ++i )
+			{
+				if ( keys[ i ] )
+				{
+					const auto decoded = shifted_machine.decode( intercepts[ i ].m_message, shift_key( *keys[ i ], shift ) );
+					scores[ shift ] += index_of_coincidence( decoded ) * decoded.size();
+				}
+			}
+		}
+		const int best_shift = std::distance( begin( scores ), std::max_element( begin( scores ), end( scores ) ) );
+
+		m4_solver::day_key result { found.m_rotors, found.m_ring_settings, {} };
+		result.m_ring_settings[ 2 ] = ( found.m_ring_settings[ 2 ] + best_shift ) % 26;
+		machine = make_machine( { found.m_rotors, result.m_ring_settings, found.m_key }, reflector, plugs );
+		for ( std::size_t i = 0; i < intercepts.size(); ++i )
+		{
+			const auto attack = std::find( begin( cribbed ), end( cribbed ), i );
+			if ( keys[ i ] )
+			{
+				keys[ i ] = shift_key( *keys[ i ], best_shift );
+			}
+			else if ( attack != end( cribbed ) )
+			{
+				keys[ i ] = attacks[ attack - begin( cribbed ) ].find_key( machine );
+			}
+			else
+			{
+				keys[ i ] = best_language_key( machine, intercepts[ i ].m_message );
+			}
+		}
+		result.m_keys = std::move( keys );
+		return result;
+	}
 }
 
 template <typename score_type, typename validate_type>
@@ -60,9 +644,23 @@ std::optional<m4_solver::settings> fine_tune_key( std::string_view message,
 										  rotors[ settings.m_rotors[ 1 ] ],
 										  rotors[ settings.m_rotors[ 2 ] ],
 										  rotors[ settings.m_rotors[ 3 ] ] };
-	std::string key = settings.m_key;
-	std::string buffer;
-	buffer.reserve( message.size() );
+	auto key = settings.m_key;
+
+	// Ring settings only matter when rotors turn over, so decode the message once and then, for each ring
+	// setting tried, only the letters typed with rotors in a different position than that first time
+	std::vector<m4_machine::offsets> reference_trace( message.size() );
+	std::vector<m4_machine::offsets> trace( message.size() );
+	std::string reference( message.size(), 'A' );
+	std::string buffer( message.size(), 'A' );
+
+	const m4_machine reference_machine( wheels, { 0, 0, settings.m_ring_settings[ 2 ], settings.m_ring_settings[ 3 ] }, reflector, plugs );
+	reference_machine.trace( key, reference_trace );
+	reference_machine.decode( message, key, std::span<char>( reference ) );
+
+	const auto decode = [ & ]( const m4_machine& machine ) {
+		machine.trace( key, trace );
+		machine.decode_trace( message, trace, reference_trace, reference, buffer );
+	};
 
 	// Adjust rings (and corresponding key) from right to left (as getting right correct first will improve score)
 	std::array<std::size_t, 26> scores = {};
@@ -70,20 +668,25 @@ std::optional<m4_solver::settings> fine_tune_key( std::string_view message,
 	{
 		key[ 3 ] = ( settings.m_key[ 3 ] - 'A' + right_ring - settings.m_ring_settings[ 3 ] + 26 ) % 26 + 'A';
 		const m4_machine machine( wheels, { 0, 0, settings.m_ring_settings[ 2 ], right_ring }, reflector, plugs );
-		machine.decode( message, key, buffer );
+		decode( machine );
 		scores[ right_ring ] = score( buffer );
 	}
 
 	const char best_right = std::distance( begin( scores ), std::max_element( begin( scores ), end( scores ) ) );
 	key[ 3 ] = ( settings.m_key[ 3 ] - 'A' + best_right - settings.m_ring_settings[ 3 ] + 26 ) % 26 + 'A';
 
+	// Best right ring decode is closer to what the middle right ones will give
+	decode( m4_machine( wheels, { 0, 0, settings.m_ring_settings[ 2 ], best_right }, reflector, plugs ) );
+	std::swap( reference, buffer );
+	std::swap( reference_trace, trace );
+
 	// Then middle right
 	for ( char middle_right_ring = 0; middle_right_ring < 26; ++middle_right_ring )
 	{
 		key[ 2 ] = ( settings.m_key[ 2 ] - 'A' + middle_right_ring - settings.m_ring_settings[ 2 ] + 26 ) % 26 + 'A';
 
 		const m4_machine machine( wheels, { 0, 0, middle_right_ring, best_right }, reflector, plugs );
-		machine.decode( message, key, buffer );
+		decode( machine );
 		if ( validate( buffer ) )
 		{
 			auto final_settings = settings;
@@ -97,168 +700,1401 @@ std::optional<m4_solver::settings> fine_tune_key( std::string_view message,
 	return {};
 }
 
+// Appends keys whose decode satisfies match to matches
 template <typename heuristic_type>
-std::vector<std::string> brute_force_key( std::string_view message, const m4_machine& machine, const heuristic_type& match )
+void brute_force_key( std::string_view message, const m4_machine& machine, const heuristic_type& match, key_matches& matches )
 {
-	std::vector<std::string> matches;
-	std::string key = "AAAA";
-	std::string result_buffer;
+	std::string result_buffer( message.size(), 'A' );
 
-	for ( int i = 0; i < 26; ++i )
+	for ( const auto key : key_range() )
 	{
-		key[ 0 ] = 'A' + i;
-		for ( int j = 0; j < 26; ++j )
+		machine.decode( message, key, std::span<char>( result_buffer ) );
+		if ( match( result_buffer ) )
 		{
-			key[ 1 ] = 'A' + j;
-			for ( int k = 0; k < 26; ++k )
-			{
-				key[ 2 ] = 'A' + k;
-				for ( int l = 0; l < 26; ++l )
-				{
-					key[ 3 ] = 'A' + l;
-					machine.decode( message, key, result_buffer );
-					if ( match( result_buffer ) )
-					{
-						matches.emplace_back( key );
-					}
-				}
-			}
+			matches.push_back( key );
 		}
 	}
-
-	return matches;
 }
 
-template <typename heuristic_type, typename score_type, typename validate_type>
-std::optional<m4_solver::settings> crack_settings( std::string_view message,
-												   reflector reflector,
-												   std::span<const char* const> plugs,
-												   const heuristic_type& heuristic,
-												   const score_type& score,
-												   const validate_type& validate,
-												   m4_solver::progress_fn progress_update )
+// Same as above for several reflectors at once with a known plaintext (match only gets to compare decodes with it),
+// matches for each reflector go to the matching entry of matches
+template <typename heuristic_type>
+void brute_force_key( std::string_view message,
+					  std::string_view plaintext,
+					  const m4_machine& machine,
+					  std::span<const reflector> reflectors,
+					  const heuristic_type& match,
+					  std::span<key_matches> matches )
 {
-	using m4_solver::settings;
-
-	std::atomic<std::size_t> progress = 0;
-	std::atomic<std::size_t> false_positives = 0;
-	const std::size_t total = std::size_t( 2 ) * 8 * 7 * 6 * 26 * 26 * 26 * 26;
-
-	static const auto rotor_combinations = generate_rotor_combinations();
-
-	const auto root_thread_id = std::this_thread::get_id();
-	settings found_settings;
-	std::atomic_bool found = false;
+	std::string result_buffer( message.size() * reflectors.size(), 'A' );
 
-	std::for_each( std::execution::par_unseq,
-				   begin( rotor_combinations ),
-				   end( rotor_combinations ),
-				   [ & ]( const std::array<int, 4>& rotor_settings ) {
-					   const std::array<rotor, 4> wheels = { rotors[ rotor_settings[ 0 ] ],
-															 rotors[ rotor_settings[ 1 ] ],
-															 rotors[ rotor_settings[ 2 ] ],
-															 rotors[ rotor_settings[ 3 ] ] };
-
-					   const m4_machine machine( wheels, { 0, 0, 0, 0 }, reflector, plugs );
-
-					   const auto keys = brute_force_key( message, machine, heuristic );
-					   if ( !keys.empty() )
-					   {
-						   settings potential_settings { rotor_settings, { 0, 0, 0, 0 }, "AAAA" };
-
-						   for ( const auto& key : keys )
-						   {
-							   potential_settings.m_key = key;
-							   const auto settings = fine_tune_key( message, potential_settings, reflector, plugs, score, validate );
-							   if ( settings )
-							   {
-								   found = true;
-								   found_settings = *settings;
-								   return;
-							   }
-						   }
-
-						   false_positives += keys.size();
-					   }
-
-					   if ( found )
-					   {
-						   return;
-					   }
-
-					   progress += 26 * 26 * 26 * 26;
-					   if ( progress_update && root_thread_id == std::this_thread::get_id() )
-					   {
-						   progress_update( progress, total, false_positives );
-					   }
-				   } );
-
-	if ( found )
+	for ( const auto key : key_range() )
 	{
-		return found_settings;
+		machine.match_plaintext( message, plaintext, key, reflectors, result_buffer );
+		for ( std::size_t r = 0; r < reflectors.size(); ++r )
+		{
+			if ( match( std::string_view( result_buffer ).substr( r * message.size(), message.size() ) ) )
+			{
+				matches[ r ].push_back( key );
+			}
+		}
 	}
-
-	return std::nullopt;
 }
 
-
-
-std::optional<m4_solver::settings> m4_solver::crack_settings( std::string_view message,
-															  reflector reflector,
-															  std::span<const char* const> plugs,
-															  std::string_view plaintext,
-															  progress_fn progress )
+// Same as above, but only decodes the given segments of the message (the rest of the buffer passed to match is left unspecified)
+// for keys passing filter
+template <typename filter_type, typename heuristic_type>
+void brute_force_key( std::string_view message,
+					  std::span<const message_segment> segments,
+					  const m4_machine& machine,
+					  const filter_type& filter,
+					  const heuristic_type& match,
+					  key_matches& matches )
 {
-	const auto validate = [ plaintext ]( std::string_view candidate ) { return candidate == plaintext; };
+	std::string result_buffer( message.size(), 'A' );
 
-	if ( plugs.empty() )
-	{
-		const auto match_heuristic = [ plaintext, score = plaintext.size() / 10 ]( std::string_view candidate ) {
-			return unknown_plugboard_match_score( plaintext, candidate ) >= score;
-		};
-		const auto score = [ plaintext ]( std::string_view candidate ) { return unknown_plugboard_match_score( plaintext, candidate ); };
-
-		return ::crack_settings( message, reflector, plugs, match_heuristic, score, validate, std::move( progress ) );
-	}
-	else
+	for ( const auto key : key_range() )
 	{
-		const auto target_score = partial_match_reference_score( message.size() );
-		const auto match_heuristic = [ plaintext, target_score ]( std::string_view candidate ) {
-			return partial_match_score( plaintext, candidate ) >= target_score;
-		};
-		// const auto match_heuristic = []( std::string_view candidate ) { return index_of_coincidence( candidate ) >= 1.05f; };
-		const auto score = [ plaintext ]( std::string_view candidate ) { return partial_match_score( plaintext, candidate ); };
-
-		return ::crack_settings( message, reflector, plugs, match_heuristic, score, validate, std::move( progress ) );
+		if ( !filter( key ) )
+		{
+			continue;
+		}
+		decode_segments( machine, message, segments, key, result_buffer );
+		if ( match( result_buffer ) )
+		{
+			matches.push_back( key );
+		}
 	}
 }
 
-std::optional<m4_solver::settings> m4_solver::crack_settings_with_crib( std::string_view message,
-																		reflector reflector,
-																		std::span<const char* const> plugs,
-																		std::string_view crib,
-																		std::span<const size_t> crib_locations,
-																		progress_fn progress )
+// Same as brute_force_key with a partial_match_score( plaintext ) >= threshold heuristic, screening a machine word of keys at once
+template <std::size_t words>
+void brute_force_key( std::string_view message,
+					  const bitsliced_m4_machine<words>& machine,
+					  std::string_view plaintext,
+					  std::size_t threshold,
+					  key_matches& matches )
 {
-	const auto score = [ crib, crib_locations ]( std::string_view candidate ) {
-		std::size_t best_score = 0;
-		for ( const auto location : crib_locations )
+	constexpr std::size_t keys_per_greek_position = 26 * 26 * 26;
+	constexpr std::size_t lanes = bitsliced_m4_machine<words>::lanes;
+
+	// Blocks may not span greek wheel positions
+	for ( std::size_t greek_position = 0; greek_position < 26; ++greek_position )
+	{
+		for ( std::size_t block = 0; block < keys_per_greek_position; block += lanes )
 		{
-			const auto score = partial_match_score( crib, candidate.substr( location, crib.size() ) );
-			if ( score > best_score )
+			const std::size_t first_index = greek_position * keys_per_greek_position + block;
+			const std::size_t count = std::min( lanes, keys_per_greek_position - block );
+
+			const auto found = machine.partial_match( message, key::from_index( first_index ), count, plaintext, threshold );
+			if ( found.any() )
 			{
-				best_score = score;
+				for ( std::size_t lane = 0; lane < count; ++lane )
+				{
+					if ( found.test( lane ) )
+					{
+						matches.push_back( key::from_index( static_cast<std::uint32_t>( first_index + lane ) ) );
+					}
+				}
 			}
 		}
-		return best_score;
-	};
-	const auto target_score = partial_match_reference_score( crib.size() );
-	const auto match_heuristic = [ score, target_score ]( std::string_view candidate ) { return score( candidate ) >= target_score; };
-	const auto validate = [ crib ]( std::string_view candidate ) { return candidate.contains( crib ); };
-
-	return ::crack_settings( message, reflector, plugs, match_heuristic, score, validate, std::move( progress ) );
+	}
 }
 
+// Same as brute_force_key with a partial_match_score( plaintext ) >= threshold heuristic, a block of keys sharing middle and
+// right letters at a time
+void brute_force_key( std::string_view message,
+					  const tiled_m4_machine& machine,
+					  std::string_view plaintext,
+					  std::size_t threshold,
+					  key_matches& matches )
+{
+	constexpr std::uint32_t blocks = 26 * 26;
+
+	tiled_m4_machine::key_block all;
+	all.set();
+	const auto first = matches.size();
+	for ( std::uint32_t middle_right = 0; middle_right < blocks; ++middle_right )
+	{
+		const auto found = machine.partial_match( message, key::from_index( middle_right ), all, plaintext, threshold );
+		for ( std::uint32_t i = 0; found.any() && i < blocks; ++i )
+		{
+			if ( found.test( i ) )
+			{
+				matches.push_back( key::from_index( i * blocks + middle_right ) );
+			}
+		}
+	}
+	// Back to key order, as the other kernels give them
+	std::sort( begin( matches ) + first, end( matches ), []( key lhs, key rhs ) { return lhs.index() < rhs.index(); } );
+}
+
+// fast_tables, built from wheels[ 2 ], wheels[ 3 ] and plugs at ring_settings, may be shared with other machines or left
+// null to build them if needed
+void brute_force_key( std::string_view message,
+					  m4_solver::kernel kernel,
+					  const std::array<rotor, 4>& wheels,
+					  std::array<int, 4> ring_settings,
+					  reflector reflector,
+					  std::span<const char* const> plugs,
+					  std::shared_ptr<const fast_rotor_tables> fast_tables,
+					  std::string_view plaintext,
+					  std::size_t threshold,
+					  key_matches& matches )
+{
+	switch ( kernel )
+	{
+		case m4_solver::kernel::bitsliced_64:
+			return brute_force_key(
+				message, bitsliced_m4_machine<1>( wheels, ring_settings, reflector, plugs ), plaintext, threshold, matches );
+		case m4_solver::kernel::bitsliced_256:
+			return brute_force_key(
+				message, bitsliced_m4_machine<4>( wheels, ring_settings, reflector, plugs ), plaintext, threshold, matches );
+		case m4_solver::kernel::bitsliced_512:
+			return brute_force_key(
+				message, bitsliced_m4_machine<8>( wheels, ring_settings, reflector, plugs ), plaintext, threshold, matches );
+		case m4_solver::kernel::tiled:
+			if ( !fast_tables )
+			{
+				fast_tables = std::make_shared<const fast_rotor_tables>(
+					wheels[ 2 ], wheels[ 3 ], std::array { ring_settings[ 2 ], ring_settings[ 3 ] }, plugs );
+			}
+			return brute_force_key(
+				message, tiled_m4_machine( wheels, ring_settings, reflector, std::move( fast_tables ) ), plaintext, threshold, matches );
+		default:
+		{
+			const m4_machine machine( wheels, ring_settings, reflector, plugs );
+			const auto match = [ & ]( std::string_view candidate ) { return partial_match_score( plaintext, candidate ) >= threshold; };
+			return brute_force_key( message, machine, match, matches );
+		}
+	}
+}
+
+// Best score( plaintext, candidate ) over all keys of each rotor order (in rotor_orders( options ) order) decoding only
+// the first m_prescreen_length letters of the message with each reflector, empty if prescreening is off
+template <typename score_type>
+std::vector<double> prescreen_rotor_orders( std::string_view message,
+											std::string_view plaintext,
+											std::span<const reflector> reflectors,
+											std::span<const char* const> plugs,
+											const score_type& score,
+											const m4_solver::options& options )
+{
+	const auto length = std::min( options.m_priorities.m_prescreen_length, message.size() );
+	if ( length == 0 )
+	{
+		return {};
+	}
+
+	const auto& rotor_combinations = rotor_orders( options );
+	const auto prefix = message.substr( 0, length );
+	const auto plaintext_prefix = plaintext.substr( 0, length );
+	std::vector<double> scores( rotor_combinations.size(), 0.0 );
+
+	thread_pool& pool = options.m_thread_pool ? *options.m_thread_pool : default_thread_pool();
+	pool.parallel_for( rotor_combinations.size(), [ & ]( std::size_t order ) {
+		const auto& rotor_settings = rotor_combinations[ order ];
+		if ( options.m_stop_token.stop_requested() )
+		{
+			return;
+		}
+
+		trace_recorder::scope prescreen_span( options.m_trace, "prescreen" );
+		prescreen_span.arg( "order", order );
+		perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::prescreen );
+		counters.add_keys( keys_per_rotor_order * reflectors.size() );
+
+		std::string buffer( length, 'A' );
+		std::size_t best = 0;
+		for ( const auto& reflector : reflectors )
+		{
+			const m4_machine machine( { rotors[ rotor_settings[ 0 ] ],
+										rotors[ rotor_settings[ 1 ] ],
+										rotors[ rotor_settings[ 2 ] ],
+										rotors[ rotor_settings[ 3 ] ] },
+									  { 0, 0, 0, 0 },
+									  reflector,
+									  plugs );
+			for ( const auto key : key_range() )
+			{
+				machine.decode( prefix, key, std::span<char>( buffer ) );
+				best = std::max<std::size_t>( best, score( plaintext_prefix, buffer ) );
+			}
+		}
+		scores[ order ] = static_cast<double>( best );
+	} );
+
+	return scores;
+}
+
+// Sweeps all rotor orders for several reflectors at once: sweep( machine, wheels, matches ) fills one list of keys
+// per reflector and returns how many keys it screened, verify( reflector index, candidate ) checks them. With m_verify_threads,
+// candidates are handed over to dedicated verifiers through a bounded queue so that screening goes on at the same pace
+// whatever their number.
+// With m_hit_log, candidates are logged under stage once checked, with the score and message key given by
+// hit( reflector index, candidate ) as a scored_key.
+template <typename sweep_type, typename verify_type, typename hit_type>
+std::optional<m4_solver::reflector_settings> crack_settings( std::span<const reflector> reflectors,
+															 std::span<const char* const> plugs,
+															 const sweep_type& sweep,
+															 const verify_type& verify,
+															 hit_log::stage stage,
+															 const hit_type& hit,
+															 m4_solver::progress_fn progress_update,
+															 const m4_solver::options& options )
+{
+	using m4_solver::settings;
+
+	const auto& rotor_combinations = rotor_orders( options );
+	const auto schedule = sweep_schedule( options );
+	const auto fast_tables = make_fast_tables( rotor_combinations, plugs );
+
+	std::atomic<std::size_t> progress = 0;
+	std::atomic<std::size_t> false_positives = 0;
+	const std::size_t total = rotor_combinations.size() * keys_per_rotor_order * reflectors.size();
+
+	const auto root_thread_id = std::this_thread::get_id();
+	m4_solver::reflector_settings found_settings;
+	std::atomic_bool found = false;
+
+	struct candidate
+	{
+		settings m_settings;
+		std::size_t m_reflector;
+	};
+	const auto log_hit = [ & ]( const candidate& candidate, hit_log::outcome outcome ) {
+		if ( options.m_hit_log )
+		{
+			const scored_key logged = hit( candidate.m_reflector, candidate.m_settings );
+			options.m_hit_log->record(
+				make_hit( candidate.m_settings, logged.m_key, logged.m_score, stage, outcome, candidate.m_reflector ) );
+		}
+	};
+	const auto check = [ & ]( const candidate& candidate ) {
+		if ( found || options.m_stop_token.stop_requested() )
+		{
+			log_hit( candidate, hit_log::outcome::unverified );
+			return;
+		}
+		trace_recorder::scope verify_span( options.m_trace, "fine_tune_key" );
+		verify_span.arg( "key", candidate.m_settings.m_key.index() );
+		perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::fine_tune );
+		const auto settings = verify( candidate.m_reflector, candidate.m_settings );
+		log_hit( candidate, settings ? hit_log::outcome::confirmed : hit_log::outcome::rejected );
+		bool first = false;
+		if ( !settings )
+		{
+			++false_positives;
+		}
+		else if ( found.compare_exchange_strong( first, true ) )
+		{
+			found_settings = { *settings, candidate.m_reflector };
+		}
+	};
+
+	// Verifiers wait on the count of candidates pushed so far, screening is over once done is set
+	bounded_queue<candidate> queue( options.m_verify_queue_size );
+	std::atomic<std::size_t> pushed = 0;
+	std::atomic_bool done = false;
+	std::vector<std::jthread> verifiers;
+	for ( std::size_t i = 0; i < options.m_verify_threads; ++i )
+	{
+		verifiers.emplace_back( [ & ] {
+			candidate next;
+			for ( ;; )
+			{
+				const auto seen = pushed.load();
+				while ( queue.try_pop( next ) )
+				{
+					check( next );
+				}
+				if ( done )
+				{
+					// Pushes all happened before done was set, anything left was popped above or by another verifier
+					while ( queue.try_pop( next ) )
+					{
+						check( next );
+					}
+					return;
+				}
+				pushed.wait( seen );
+			}
+		} );
+	}
+
+	// Let verifiers finish what is left in the queue, also when the sweep throws
+	const auto stop_verifiers = [ & ] {
+		done = true;
+		++pushed;
+		pushed.notify_all();
+		verifiers.clear();
+	};
+
+	thread_pool& pool = options.m_thread_pool ? *options.m_thread_pool : default_thread_pool();
+	const auto sweep_order = [ & ]( std::size_t turn ) {
+		const auto order = schedule[ turn ];
+		const auto& rotor_settings = rotor_combinations[ order ];
+		if ( found || options.m_stop_token.stop_requested() )
+		{
+			return;
+		}
+
+		trace_recorder::scope order_span( options.m_trace, "rotor order" );
+		order_span.arg( "order", order );
+
+		const std::array<rotor, 4> wheels = { rotors[ rotor_settings[ 0 ] ],
+											  rotors[ rotor_settings[ 1 ] ],
+											  rotors[ rotor_settings[ 2 ] ],
+											  rotors[ rotor_settings[ 3 ] ] };
+
+		const auto machine = make_sweep_machine( rotor_settings, reflectors.front(), plugs, fast_tables );
+
+		// Most rotor orders give no or a handful of candidates, keep them on the stack
+		std::array<std::byte, 1024> arena_buffer;
+		std::pmr::monotonic_buffer_resource arena( arena_buffer.data(), arena_buffer.size() );
+		std::pmr::vector<key_matches> keys( reflectors.size(), &arena );
+
+		{
+			trace_recorder::scope screening_span( options.m_trace, "screening" );
+			screening_span.arg( "first key", 0 );
+			perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::screening );
+			const std::size_t screened = sweep( machine, wheels, std::span<key_matches>( keys ) );
+			screening_span.arg( "keys", screened );
+			counters.add_keys( screened );
+		}
+
+		std::size_t candidates = 0;
+		for ( const auto& reflector_keys : keys )
+		{
+			candidates += reflector_keys.size();
+		}
+		order_span.arg( "candidates", candidates );
+
+		for ( std::size_t r = 0; r < reflectors.size() && !found; ++r )
+		{
+			candidate potential { { rotor_settings, { 0, 0, 0, 0 }, {} }, r };
+
+			for ( const auto& key : keys[ r ] )
+			{
+				potential.m_settings.m_key = key;
+				if ( options.m_on_candidate )
+				{
+					options.m_on_candidate( potential.m_settings );
+				}
+
+				if ( verifiers.empty() )
+				{
+					check( potential );
+				}
+				else if ( queue.try_push( potential ) )
+				{
+					++pushed;
+					pushed.notify_one();
+				}
+				else
+				{
+					// Verifiers are falling behind, lend them a hand rather than wait
+					check( potential );
+				}
+			}
+		}
+
+		if ( found )
+		{
+			return;
+		}
+
+		progress += keys_per_rotor_order * reflectors.size();
+		if ( progress_update && root_thread_id == std::this_thread::get_id() )
+		{
+			trace_recorder::scope progress_span( options.m_trace, "progress" );
+			progress_update( progress, total, false_positives );
+		}
+	};
+
+	try
+	{
+		pool.parallel_for( rotor_combinations.size(), sweep_order );
+	}
+	catch ( ... )
+	{
+		stop_verifiers();
+		throw;
+	}
+	stop_verifiers();
+
+	if ( found )
+	{
+		return found_settings;
+	}
+
+	return std::nullopt;
+}
+
+// Single reflector version, sweep( machine, wheels, matches ), verify( candidate ) and hit( candidate )
+template <typename sweep_type, typename verify_type, typename hit_type>
+std::optional<m4_solver::settings> crack_settings( reflector reflector,
+												   std::span<const char* const> plugs,
+												   const sweep_type& sweep,
+												   const verify_type& verify,
+												   hit_log::stage stage,
+												   const hit_type& hit,
+												   m4_solver::progress_fn progress_update,
+												   const m4_solver::options& options )
+{
+	const auto result = crack_settings(
+		std::span( &reflector, 1 ),
+		plugs,
+		[ & ]( const m4_machine& machine, const std::array<rotor, 4>& wheels, std::span<key_matches> keys ) {
+			return sweep( machine, wheels, keys.front() );
+		},
+		[ & ]( std::size_t, const m4_solver::settings& candidate ) { return verify( candidate ); },
+		stage,
+		[ & ]( std::size_t, const m4_solver::settings& candidate ) { return hit( candidate ); },
+		std::move( progress_update ),
+		options );
+	if ( result )
+	{
+		return result->m_settings;
+	}
+	return std::nullopt;
+}
+
+
+
+namespace
+{
+	std::size_t first_crib_location( std::span<const m4_solver::crib> cribs )
+	{
+		std::size_t first = std::numeric_limits<std::size_t>::max();
+		for ( const auto& crib : cribs )
+		{
+			first = std::min( first, *std::min_element( begin( crib.m_locations ), end( crib.m_locations ) ) );
+		}
+		return first;
+	}
+
+	std::vector<m4_solver::crib> relative_cribs( std::span<const m4_solver::crib> cribs, std::size_t start )
+	{
+		std::vector<m4_solver::crib> result;
+		for ( const auto& crib : cribs )
+		{
+			result.push_back( { crib.m_text, relative_locations( crib.m_locations, start ) } );
+		}
+		return result;
+	}
+
+	std::vector<message_segment> crib_windows( std::span<const m4_solver::crib> cribs )
+	{
+		std::vector<message_segment> windows;
+		for ( const auto& crib : cribs )
+		{
+			for ( const auto location : crib.m_locations )
+			{
+				windows.push_back( { location, crib.m_text.size() } );
+			}
+		}
+		return windows;
+	}
+
+	// Over a crib window where the middle rotor doesn't move, everything between the right rotor and the reflector is
+	// the same fixed point free involution. Letter pairs taken through the plugboard and right rotor must then be
+	// consistent with one: count those that aren't.
+	std::size_t involution_contradictions( std::span<const std::array<int, 2>> pairs )
+	{
+		std::array<int, 26> wiring;
+		wiring.fill( -1 );
+
+		std::size_t contradictions = 0;
+		for ( const auto [ a, b ] : pairs )
+		{
+			if ( a != b && wiring[ a ] < 0 && wiring[ b ] < 0 )
+			{
+				wiring[ a ] = b;
+				wiring[ b ] = a;
+			}
+			else if ( a == b || wiring[ a ] != b )
+			{
+				++contradictions;
+			}
+		}
+		return contradictions;
+	}
+
+	fast_rotor_tables::table letter_plugs( std::span<const char* const> plugs )
+	{
+		fast_rotor_tables::table plugboard;
+		std::iota( begin( plugboard ), end( plugboard ), 0 );
+		for ( const auto* pair : plugs )
+		{
+			plugboard[ pair[ 0 ] - 'A' ] = static_cast<std::uint8_t>( pair[ 1 ] - 'A' );
+			plugboard[ pair[ 1 ] - 'A' ] = static_cast<std::uint8_t>( pair[ 0 ] - 'A' );
+		}
+		return plugboard;
+	}
+
+	std::vector<std::string_view> crib_texts( std::span<const m4_solver::crib> cribs )
+	{
+		std::vector<std::string_view> texts;
+		for ( const auto& crib : cribs )
+		{
+			texts.push_back( crib.m_text );
+		}
+		return texts;
+	}
+}
+
+crib_attack::crib_attack( std::string_view message,
+						  reflector reflector,
+						  std::span<const char* const> plugs,
+						  std::span<const m4_solver::crib> cribs )
+	: m_message( message.substr( first_crib_location( cribs ) ) )
+	, m_reflector( reflector )
+	, m_plugs( plugs )
+	, m_plugboard( letter_plugs( plugs ) )
+	, m_start( message.size() - m_message.size() )
+	, m_cribs( relative_cribs( cribs, m_start ) )
+	, m_segments( make_crib_segments( crib_windows( m_cribs ) ) )
+	, m_score( m_cribs )
+	, m_matcher( crib_texts( m_cribs ) )
+	, m_exact_score( std::accumulate( begin( m_cribs ), end( m_cribs ), std::size_t( 0 ), []( std::size_t sum, const auto& crib ) {
+		return sum + crib.m_text.size() * crib.m_text.size();
+	} ) )
+{
+}
+
+crib_attack::crib_attack( std::string_view message,
+						  reflector reflector,
+						  std::span<const char* const> plugs,
+						  std::string_view crib,
+						  std::span<const std::size_t> crib_locations )
+	: crib_attack( message, reflector, plugs, std::array { m4_solver::crib { crib, { begin( crib_locations ), end( crib_locations ) } } } )
+{
+}
+
+void crib_attack::sweep( const m4_machine& machine, std::size_t threshold, key_matches& matches ) const
+{
+	const auto match = [ & ]( std::string_view candidate ) { return m_score( candidate ) >= threshold; };
+	brute_force_key( m_message, m_segments, machine, []( key ) { return true; }, match, matches );
+}
+
+void crib_attack::sweep( const m4_machine& machine, std::size_t threshold, std::bitset<26> right_letters, key_matches& matches ) const
+{
+	const auto filter = [ & ]( key key ) { return right_letters.test( key[ 3 ] - 'A' ); };
+	const auto match = [ & ]( std::string_view candidate ) { return m_score( candidate ) >= threshold; };
+	brute_force_key( m_message, m_segments, machine, filter, match, matches );
+}
+
+std::bitset<26> crib_attack::right_letters( const rotor& right_rotor, std::size_t contradictions ) const
+{
+	std::array<int, 26> plugboard;
+	std::iota( begin( plugboard ), end( plugboard ), 0 );
+	for ( const auto* pair : m_plugs )
+	{
+		plugboard[ pair[ 0 ] - 'A' ] = pair[ 1 ] - 'A';
+		plugboard[ pair[ 1 ] - 'A' ] = pair[ 0 ] - 'A';
+	}
+	// Contact on the middle rotor side, undoing the right rotor's rotation
+	const auto through_right_rotor = [ & ]( char letter, int offset ) {
+		return ( right_rotor.m_wiring[ plugboard[ letter - 'A' ] + offset ] - 'A' - offset + 26 ) % 26;
+	};
+	const auto turnover = [ & ]( int offset ) { return right_rotor.m_turnovers[ 0 ] == offset || right_rotor.m_turnovers[ 1 ] == offset; };
+
+	std::vector<std::array<int, 2>> pairs;
+	const auto fits = [ & ]( int letter, const m4_solver::crib& crib, std::size_t location ) {
+		pairs.clear();
+		for ( std::size_t i = 0; i < crib.m_text.size(); ++i )
+		{
+			// Sweep keys have rings at 0, the right rotor offset is its key letter plus the letters typed so far
+			const int offset = static_cast<int>( ( letter + location + i + 1 ) % 26 );
+			pairs.push_back(
+				{ through_right_rotor( m_message[ location + i ], offset ), through_right_rotor( crib.m_text[ i ], offset ) } );
+		}
+
+		// The right ring only moves turnovers: cut the window where the middle rotor steps, and once more after in case it
+		// double steps along with the left one
+		for ( int ring = 0; ring < 26; ++ring )
+		{
+			std::size_t found = 0;
+			std::size_t first = 0;
+			for ( std::size_t i = 1; i <= pairs.size(); ++i )
+			{
+				const auto steps = [ & ]( std::size_t at ) {
+					return at > 0 && at < pairs.size() && turnover( static_cast<int>( ( letter + location + at + ring ) % 26 ) );
+				};
+				if ( i == pairs.size() || steps( i ) || steps( i - 1 ) )
+				{
+					found += involution_contradictions( std::span( pairs ).subspan( first, i - first ) );
+					first = i;
+				}
+			}
+			if ( found <= contradictions )
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	std::bitset<26> letters;
+	for ( int letter = 0; letter < 26; ++letter )
+	{
+		letters[ letter ] = std::all_of( begin( m_cribs ), end( m_cribs ), [ & ]( const m4_solver::crib& crib ) {
+			return std::any_of( begin( crib.m_locations ), end( crib.m_locations ), [ & ]( std::size_t location ) {
+				return fits( letter, crib, location );
+			} );
+		} );
+	}
+	return letters;
+}
+
+std::size_t crib_attack::window_end() const
+{
+	return m_segments.empty() ? 0 : m_segments.back().m_start + m_segments.back().m_length;
+}
+
+std::size_t crib_attack::score( const shared_rotor_state& state, std::span<char> buffer ) const
+{
+	for ( const auto& segment : m_segments )
+	{
+		state.decode( m_message.substr( segment.m_start, segment.m_length ),
+					  segment.m_start,
+					  m_plugboard,
+					  buffer.subspan( segment.m_start, segment.m_length ) );
+	}
+	return m_score( std::string_view( buffer.data(), m_message.size() ) );
+}
+
+std::size_t crib_attack::score( const m4_solver::settings& candidate ) const
+{
+	std::string buffer( m_message.size(), 'A' );
+	decode_segments( make_machine( candidate, m_reflector, m_plugs ), m_message, m_segments, candidate.m_key, buffer );
+	return m_score( buffer );
+}
+
+std::vector<scored_key> crib_attack::best_keys( const m4_machine& machine, std::size_t count ) const
+{
+	std::vector<scored_key> best;
+	best.reserve( count + 1 );
+	std::string buffer( m_message.size(), 'A' );
+
+	for ( const auto key : key_range() )
+	{
+		decode_segments( machine, m_message, m_segments, key, buffer );
+		const auto score = m_score( buffer );
+		if ( best.size() < count || score > best.back().m_score )
+		{
+			const auto position
+				= std::find_if( begin( best ), end( best ), [ score ]( const scored_key& entry ) { return score > entry.m_score; } );
+			best.insert( position, { score, key } );
+			if ( best.size() > count )
+			{
+				best.pop_back();
+			}
+		}
+	}
+
+	return best;
+}
+
+std::optional<m4_solver::settings> crib_attack::verify( const m4_solver::settings& candidate ) const
+{
+	return m_cribs.size() == 1 ? verify_crib( candidate ) : verify_cribs( candidate );
+}
+
+std::optional<m4_solver::settings> crib_attack::verify_crib( const m4_solver::settings& candidate ) const
+{
+	const auto& [ crib, window_locations ] = m_cribs.front();
+
+	// Middle rotor stepping before a window depends on the (yet unknown) right ring setting, so the sweep can only
+	// be trusted around the best scoring window: fine tune from the rotor positions there and roll back afterwards
+	const auto sweep_machine = make_machine( candidate, m_reflector, m_plugs );
+	std::string buffer( m_message.size(), 'A' );
+	decode_segments( sweep_machine, m_message, m_segments, candidate.m_key, buffer );
+	const auto window_score = [ & ]( std::size_t location ) {
+		return partial_match_score( crib, std::string_view( buffer ).substr( location, crib.size() ) );
+	};
+	const auto by_score = [ & ]( std::size_t lhs, std::size_t rhs ) { return window_score( lhs ) < window_score( rhs ); };
+	const auto best_location = *std::max_element( begin( window_locations ), end( window_locations ), by_score );
+
+	const auto crib_score = [ crib ]( std::string_view candidate ) {
+		return partial_match_score( crib, candidate.substr( 0, crib.size() ) );
+	};
+	const auto validate = [ crib ]( std::string_view candidate ) { return candidate.starts_with( crib ); };
+
+	const auto location_key = sweep_machine.advance_key( candidate.m_key, best_location );
+	auto at_location = candidate;
+
+	// The middle rotor may also have stepped at the wrong place inside the window itself
+	for ( const int middle_right_offset : { 0, -1, 1 } )
+	{
+		at_location.m_key = location_key;
+		at_location.m_key[ 2 ] = static_cast<char>( 'A' + ( ( location_key[ 2 ] - 'A' + middle_right_offset + 26 ) % 26 ) );
+
+		auto result = ::fine_tune_key( m_message.substr( best_location ), at_location, m_reflector, m_plugs, crib_score, validate );
+		if ( result )
+		{
+			result->m_key = rollback_message_key( make_machine( *result, m_reflector, m_plugs ), result->m_key, m_start + best_location );
+			return result;
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<m4_solver::settings> crib_attack::verify_cribs( const m4_solver::settings& candidate ) const
+{
+	// The sweep key may be off by one on the middle right rotor at the first window (the right ring moves its turnovers),
+	// with the right one each crib gets scored where it belongs
+	const auto validate = [ this ]( std::string_view candidate ) { return contains_cribs( candidate ); };
+
+	auto at_start = candidate;
+	for ( const int middle_right_offset : { 0, -1, 1 } )
+	{
+		at_start.m_key[ 2 ] = static_cast<char>( 'A' + ( ( candidate.m_key[ 2 ] - 'A' + middle_right_offset + 26 ) % 26 ) );
+
+		auto result = ::fine_tune_key( m_message, at_start, m_reflector, m_plugs, m_score, validate );
+		if ( result )
+		{
+			result->m_key = rollback_message_key( make_machine( *result, m_reflector, m_plugs ), result->m_key, m_start );
+			return result;
+		}
+	}
+	return std::nullopt;
+}
+
+bool crib_attack::contains_cribs( std::string_view candidate ) const
+{
+	std::vector<bool> found( m_cribs.size(), false );
+	m_matcher.find( candidate, [ & ]( std::size_t crib, std::size_t position ) {
+		const auto& locations = m_cribs[ crib ].m_locations;
+		if ( std::find( begin( locations ), end( locations ), position ) != end( locations ) )
+		{
+			found[ crib ] = true;
+		}
+	} );
+	return std::find( begin( found ), end( found ), false ) == end( found );
+}
+
+std::optional<key> crib_attack::find_key( const m4_machine& machine ) const
+{
+	key_matches keys;
+	sweep( machine, m_exact_score, keys );
+	if ( keys.empty() )
+	{
+		return std::nullopt;
+	}
+	return message_key( machine, keys.front() );
+}
+
+key crib_attack::message_key( const m4_machine& machine, key key ) const
+{
+	return rollback_message_key( machine, key, m_start );
+}
+
+m4_solver::calibration m4_solver::calibrate( std::string_view message,
+											 reflector reflector,
+											 std::span<const char* const> plugs,
+											 std::string_view plaintext,
+											 const options& options )
+{
+	if ( plugs.empty() )
+	{
+		const auto score = [ plaintext ]( std::string_view candidate ) { return unknown_plugboard_match_score( plaintext, candidate ); };
+		return ::calibrate( message, reflector, plugs, score, options );
+	}
+	else
+	{
+		const auto score = [ plaintext ]( std::string_view candidate ) { return partial_match_score( plaintext, candidate ); };
+		return ::calibrate( message, reflector, plugs, score, options );
+	}
+}
+
+m4_solver::calibration m4_solver::calibrate_with_crib( std::string_view message,
+													   reflector reflector,
+													   std::span<const char* const> plugs,
+													   std::string_view crib,
+													   std::span<const std::size_t> crib_locations,
+													   const options& options )
+{
+	return ::calibrate( message, reflector, plugs, make_crib_score( crib, crib_locations ), options );
+}
+
+m4_solver::calibration m4_solver::calibrate_with_cribs( std::string_view message,
+														reflector reflector,
+														std::span<const char* const> plugs,
+														std::span<const crib> cribs,
+														const options& options )
+{
+	return ::calibrate( message, reflector, plugs, joint_crib_score( cribs ), options );
+}
+
+std::optional<m4_solver::settings> m4_solver::crack_settings( std::string_view message,
+															  reflector reflector,
+															  std::span<const char* const> plugs,
+															  std::string_view plaintext,
+															  progress_fn progress,
+															  const options& options )
+{
+	const auto validate = [ plaintext ]( std::string_view candidate ) { return candidate == plaintext; };
+	const auto target_score = options.m_calibration ? options.m_calibration->m_threshold
+													: calibrate( message, reflector, plugs, plaintext, options ).m_threshold;
+
+	if ( plugs.empty() )
+	{
+		const auto match_heuristic = [ plaintext, target_score ]( std::string_view candidate ) {
+			return unknown_plugboard_match_score( plaintext, candidate ) >= target_score;
+		};
+		const auto score = [ plaintext ]( std::string_view candidate ) { return unknown_plugboard_match_score( plaintext, candidate ); };
+		const auto sweep = [ message, &match_heuristic ]( const m4_machine& machine, const std::array<rotor, 4>&, key_matches& keys ) {
+			brute_force_key( message, machine, match_heuristic, keys );
+			return keys_per_rotor_order;
+		};
+		const auto verify = [ & ]( const settings& candidate ) {
+			return ::fine_tune_key( message, candidate, reflector, plugs, score, validate );
+		};
+		const auto hit = [ & ]( const settings& candidate ) {
+			return scored_key { score( make_machine( candidate, reflector, plugs ).decode( message, candidate.m_key ) ), candidate.m_key };
+		};
+		const auto prescreen_scores
+			= prescreen_rotor_orders( message, plaintext, std::span( &reflector, 1 ), plugs, unknown_plugboard_match_score, options );
+
+		return ::crack_settings( reflector,
+								 plugs,
+								 sweep,
+								 verify,
+								 hit_log::stage::plaintext,
+								 hit,
+								 std::move( progress ),
+								 prioritized( options, prescreen_scores ) );
+	}
+	else
+	{
+		const auto match_heuristic = [ plaintext, target_score ]( std::string_view candidate ) {
+			return partial_match_score( plaintext, candidate ) >= target_score;
+		};
+		// const auto match_heuristic = []( std::string_view candidate ) { return index_of_coincidence( candidate ) >= 1.05f; };
+		const auto score = [ plaintext ]( std::string_view candidate ) { return partial_match_score( plaintext, candidate ); };
+		const auto sweep = [ & ]( const m4_machine& machine, const std::array<rotor, 4>& wheels, key_matches& keys ) {
+			if ( options.m_kernel == kernel::scalar )
+			{
+				brute_force_key( message, machine, match_heuristic, keys );
+			}
+			else
+			{
+				brute_force_key( message,
+								 options.m_kernel,
+								 wheels,
+								 { 0, 0, 0, 0 },
+								 reflector,
+								 plugs,
+								 machine.fast_tables(),
+								 plaintext,
+								 target_score,
+								 keys );
+			}
+			return keys_per_rotor_order;
+		};
+		const auto verify = [ & ]( const settings& candidate ) {
+			return ::fine_tune_key( message, candidate, reflector, plugs, score, validate );
+		};
+		const auto hit = [ & ]( const settings& candidate ) {
+			return scored_key { score( make_machine( candidate, reflector, plugs ).decode( message, candidate.m_key ) ), candidate.m_key };
+		};
+		const auto prescreen_scores
+			= prescreen_rotor_orders( message, plaintext, std::span( &reflector, 1 ), plugs, partial_match_score, options );
+
+		return ::crack_settings( reflector,
+								 plugs,
+								 sweep,
+								 verify,
+								 hit_log::stage::plaintext,
+								 hit,
+								 std::move( progress ),
+								 prioritized( options, prescreen_scores ) );
+	}
+}
+
+std::optional<m4_solver::reflector_settings> m4_solver::crack_settings( std::string_view message,
+																		std::span<const reflector> reflectors,
+																		std::span<const char* const> plugs,
+																		std::string_view plaintext,
+																		progress_fn progress,
+																		const options& options )
+{
+	if ( reflectors.empty() )
+	{
+		return std::nullopt;
+	}
+
+	// Wrong keys score the same whatever the reflector, calibrating with the first one is enough
+	const auto validate = [ plaintext ]( std::string_view candidate ) { return candidate == plaintext; };
+	const auto target_score = options.m_calibration ? options.m_calibration->m_threshold
+													: calibrate( message, reflectors.front(), plugs, plaintext, options ).m_threshold;
+
+	const auto crack = [ & ]( const auto& match_score ) {
+		const auto score = [ & ]( std::string_view candidate ) { return match_score( plaintext, candidate ); };
+		const auto match_heuristic = [ & ]( std::string_view candidate ) { return score( candidate ) >= target_score; };
+		const auto sweep = [ & ]( const m4_machine& machine, const std::array<rotor, 4>& wheels, std::span<key_matches> keys ) {
+			if ( options.m_kernel == kernel::scalar || plugs.empty() )
+			{
+				brute_force_key( message, plaintext, machine, reflectors, match_heuristic, keys );
+			}
+			else
+			{
+				// Bit sliced machines fold the reflector into their tables, they only share the rotor order
+				for ( std::size_t r = 0; r < reflectors.size(); ++r )
+				{
+					brute_force_key( message,
+									 options.m_kernel,
+									 wheels,
+									 { 0, 0, 0, 0 },
+									 reflectors[ r ],
+									 plugs,
+									 machine.fast_tables(),
+									 plaintext,
+									 target_score,
+									 keys[ r ] );
+				}
+			}
+			return keys_per_rotor_order * reflectors.size();
+		};
+		const auto verify = [ & ]( std::size_t r, const settings& candidate ) {
+			return ::fine_tune_key( message, candidate, reflectors[ r ], plugs, score, validate );
+		};
+		const auto hit = [ & ]( std::size_t r, const settings& candidate ) {
+			const auto decoded = make_machine( candidate, reflectors[ r ], plugs ).decode( message, candidate.m_key );
+			return scored_key { score( decoded ), candidate.m_key };
+		};
+		const auto prescreen_scores = prescreen_rotor_orders( message, plaintext, reflectors, plugs, match_score, options );
+		return ::crack_settings( reflectors,
+								 plugs,
+								 sweep,
+								 verify,
+								 hit_log::stage::plaintext,
+								 hit,
+								 std::move( progress ),
+								 prioritized( options, prescreen_scores ) );
+	};
+
+	if ( plugs.empty() )
+	{
+		return crack( unknown_plugboard_match_score );
+	}
+	else
+	{
+		return crack( partial_match_score );
+	}
+}
+
+std::optional<m4_solver::settings> m4_solver::crack_settings_with_crib( std::string_view message,
+																		reflector reflector,
+																		std::span<const char* const> plugs,
+																		std::string_view crib,
+																		std::span<const size_t> crib_locations,
+																		progress_fn progress,
+																		const options& options )
+{
+	const std::array cribs = { m4_solver::crib { crib, { begin( crib_locations ), end( crib_locations ) } } };
+	return crack_settings_with_cribs( message, reflector, plugs, cribs, std::move( progress ), options );
+}
+
+std::optional<m4_solver::settings> m4_solver::crack_settings_with_cribs( std::string_view message,
+																		 reflector reflector,
+																		 std::span<const char* const> plugs,
+																		 std::span<const crib> cribs,
+																		 progress_fn progress,
+																		 const options& options )
+{
+	if ( cribs.empty()
+		 || std::any_of(
+			 begin( cribs ), end( cribs ), []( const crib& crib ) { return crib.m_text.empty() || crib.m_locations.empty(); } ) )
+	{
+		return std::nullopt;
+	}
+
+	const auto target_score = options.m_calibration ? options.m_calibration->m_threshold
+													: calibrate_with_cribs( message, reflector, plugs, cribs, options ).m_threshold;
+
+	const crib_attack attack( message, reflector, plugs, cribs );
+	const auto sweep = [ & ]( const m4_machine& machine, const std::array<rotor, 4>& wheels, key_matches& keys ) {
+		if ( !options.m_right_rotor_first )
+		{
+			attack.sweep( machine, target_score, keys );
+			return keys_per_rotor_order;
+		}
+
+		std::bitset<26> letters;
+		{
+			trace_recorder::scope stage( options.m_trace, "right rotor" );
+			letters = attack.right_letters( wheels[ 3 ], options.m_right_rotor_contradictions );
+			stage.arg( "survivors", static_cast<std::int64_t>( letters.count() ) );
+		}
+		if ( letters.any() )
+		{
+			attack.sweep( machine, target_score, letters, keys );
+		}
+		// Keys with any other right letter are skipped
+		return keys_per_rotor_order / 26 * letters.count();
+	};
+	const auto verify = [ & ]( const settings& candidate ) { return attack.verify( candidate ); };
+	// Sweep keys are at the first crib location
+	const auto hit = [ & ]( const settings& candidate ) {
+		return scored_key { attack.score( candidate ), attack.message_key( make_machine( candidate, reflector, plugs ), candidate.m_key ) };
+	};
+	const auto stage = options.m_right_rotor_first ? hit_log::stage::crib_staged : hit_log::stage::crib;
+
+	return ::crack_settings( reflector, plugs, sweep, verify, stage, hit, std::move( progress ), prioritized( options ) );
+}
+
+
+std::optional<m4_solver::day_key> m4_solver::crack_day_key( std::span<const intercept> intercepts,
+															reflector reflector,
+															std::span<const char* const> plugs,
+															progress_fn progress_update,
+															const options& options )
+{
+	// Only messages with a crib take part in the sweep
+	std::vector<std::size_t> cribbed;
+	std::vector<crib_attack> attacks;
+	std::vector<calibration> calibrations;
+	for ( std::size_t i = 0; i < intercepts.size(); ++i )
+	{
+		const auto& intercept = intercepts[ i ];
+		if ( !intercept.m_crib.empty() && !intercept.m_crib_locations.empty() )
+		{
+			cribbed.push_back( i );
+			attacks.emplace_back( intercept.m_message, reflector, plugs, intercept.m_crib, intercept.m_crib_locations );
+			calibrations.push_back(
+				calibrate_with_crib( intercept.m_message, reflector, plugs, intercept.m_crib, intercept.m_crib_locations, options ) );
+		}
+	}
+
+	if ( attacks.empty() )
+	{
+		return std::nullopt;
+	}
+
+	const auto& rotor_combinations = rotor_orders( options );
+
+	// Best keys of each message for each rotor order, weighted by how unlikely it is for a wrong order to score that high
+	struct rotor_order_evidence
+	{
+		std::vector<std::vector<scored_key>> m_keys;
+		double m_weight = 0;
+	};
+	std::vector<rotor_order_evidence> evidence( rotor_combinations.size() );
+
+	std::atomic<std::size_t> progress = 0;
+	const std::size_t total = rotor_combinations.size() * keys_per_rotor_order * attacks.size();
+	const auto root_thread_id = std::this_thread::get_id();
+	const auto schedule = sweep_schedule( options );
+	const auto fast_tables = make_fast_tables( rotor_combinations, plugs );
+
+	thread_pool& pool = options.m_thread_pool ? *options.m_thread_pool : default_thread_pool();
+	pool.parallel_for( rotor_combinations.size(), [ & ]( std::size_t turn ) {
+		const auto order = schedule[ turn ];
+		const auto& rotor_settings = rotor_combinations[ order ];
+		if ( options.m_stop_token.stop_requested() )
+		{
+			return;
+		}
+
+		trace_recorder::scope order_span( options.m_trace, "rotor order" );
+		order_span.arg( "order", order );
+
+		auto& order_evidence = evidence[ order ];
+		const auto machine = make_sweep_machine( rotor_settings, reflector, plugs, fast_tables );
+
+		for ( std::size_t i = 0; i < attacks.size(); ++i )
+		{
+			trace_recorder::scope screening_span( options.m_trace, "screening" );
+			screening_span.arg( "intercept", cribbed[ i ] );
+			screening_span.arg( "keys", keys_per_rotor_order );
+			perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::screening );
+			counters.add_keys( keys_per_rotor_order );
+			auto keys = attacks[ i ].best_keys( machine, std::max<std::size_t>( options.m_day_key_candidates, 1 ) );
+			order_evidence.m_weight += best_key_evidence( calibrations[ i ], keys.front().m_score );
+			order_evidence.m_keys.push_back( std::move( keys ) );
+		}
+
+		progress += keys_per_rotor_order * attacks.size();
+		if ( progress_update && root_thread_id == std::this_thread::get_id() )
+		{
+			trace_recorder::scope progress_span( options.m_trace, "progress" );
+			progress_update( progress, total, 0 );
+		}
+	} );
+
+	if ( options.m_stop_token.stop_requested() )
+	{
+		return std::nullopt;
+	}
+
+	std::vector<std::size_t> ranking( rotor_combinations.size() );
+	std::iota( begin( ranking ), end( ranking ), 0 );
+	std::stable_sort( begin( ranking ), end( ranking ), [ & ]( std::size_t lhs, std::size_t rhs ) {
+		return evidence[ lhs ].m_weight > evidence[ rhs ].m_weight;
+	} );
+
+	for ( const auto order : ranking )
+	{
+		for ( std::size_t i = 0; i < attacks.size(); ++i )
+		{
+			for ( const auto& candidate : evidence[ order ].m_keys[ i ] )
+			{
+				if ( options.m_stop_token.stop_requested() )
+				{
+					return std::nullopt;
+				}
+				if ( options.m_on_candidate )
+				{
+					options.m_on_candidate( { rotor_combinations[ order ], { 0, 0, 0, 0 }, candidate.m_key } );
+				}
+
+				trace_recorder::scope verify_span( options.m_trace, "fine_tune_key" );
+				verify_span.arg( "key", candidate.m_key.index() );
+				perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::fine_tune );
+				const settings potential = { rotor_combinations[ order ], { 0, 0, 0, 0 }, candidate.m_key };
+				const auto found = attacks[ i ].verify( potential );
+				if ( options.m_hit_log )
+				{
+					const auto outcome = found ? hit_log::outcome::confirmed : hit_log::outcome::rejected;
+					const auto message_key = attacks[ i ].message_key( make_machine( potential, reflector, plugs ), candidate.m_key );
+					options.m_hit_log->record( make_hit( potential, message_key, candidate.m_score, hit_log::stage::day_key, outcome, 0 ) );
+				}
+				if ( !found )
+				{
+					continue;
+				}
+
+				return complete_day_key( intercepts, cribbed, attacks, i, *found, reflector, plugs );
+			}
+		}
+	}
+
+	return std::nullopt;
+}
+
+std::vector<std::optional<m4_solver::settings>> m4_solver::crack_batch_with_cribs( std::span<const batch_intercept> intercepts,
+																					 reflector reflector,
+																					 progress_fn progress_update,
+																					 const options& options )
+{
+	std::vector<std::optional<settings>> results( intercepts.size() );
+
+	// Only messages with usable cribs take part in the sweep
+	std::vector<std::size_t> cribbed;
+	std::vector<crib_attack> attacks;
+	std::vector<std::size_t> thresholds;
+	for ( std::size_t i = 0; i < intercepts.size(); ++i )
+	{
+		const auto& intercept = intercepts[ i ];
+		if ( intercept.m_cribs.empty() || std::any_of( begin( intercept.m_cribs ), end( intercept.m_cribs ), []( const crib& crib ) {
+				 return crib.m_text.empty() || crib.m_locations.empty();
+			 } ) )
+		{
+			continue;
+		}
+		cribbed.push_back( i );
+		attacks.emplace_back( intercept.m_message, reflector, intercept.m_plugs, intercept.m_cribs );
+		const auto calibrated = calibrate_with_cribs( intercept.m_message, reflector, intercept.m_plugs, intercept.m_cribs, options );
+		thresholds.push_back( calibrated.m_threshold );
+	}
+
+	if ( attacks.empty() )
+	{
+		return results;
+	}
+
+	const auto& rotor_combinations = rotor_orders( options );
+	const auto schedule = sweep_schedule( options );
+	// Plug free, messages go through their own plugboard on both sides
+	const auto fast_tables = make_fast_tables( rotor_combinations, {} );
+	const auto longest = std::max_element( begin( intercepts ), end( intercepts ), []( const auto& lhs, const auto& rhs ) {
+		return lhs.m_message.size() < rhs.m_message.size();
+	} );
+	const auto buffer_size = longest->m_message.size();
+
+	// Set by whoever verifies a message first, later rotor orders leave it out
+	std::vector<std::atomic_bool> solved( attacks.size() );
+	std::atomic<std::size_t> remaining = attacks.size();
+	std::atomic<std::size_t> progress = 0;
+	std::atomic<std::size_t> false_positives = 0;
+	const std::size_t total = rotor_combinations.size() * keys_per_rotor_order;
+	const auto root_thread_id = std::this_thread::get_id();
+
+	thread_pool& pool = options.m_thread_pool ? *options.m_thread_pool : default_thread_pool();
+	pool.parallel_for( rotor_combinations.size(), [ & ]( std::size_t turn ) {
+		const auto order = schedule[ turn ];
+		const auto& rotor_settings = rotor_combinations[ order ];
+		if ( remaining == 0 || options.m_stop_token.stop_requested() )
+		{
+			return;
+		}
+
+		trace_recorder::scope order_span( options.m_trace, "rotor order" );
+		order_span.arg( "order", order );
+
+		const std::array<rotor, 4> wheels = { rotors[ rotor_settings[ 0 ] ],
+											  rotors[ rotor_settings[ 1 ] ],
+											  rotors[ rotor_settings[ 2 ] ],
+											  rotors[ rotor_settings[ 3 ] ] };
+
+		// Messages only differ by their plugs, rotors all step the same from a given key
+		std::vector<std::size_t> pending;
+		std::size_t length = 0;
+		for ( std::size_t i = 0; i < attacks.size(); ++i )
+		{
+			if ( !solved[ i ] )
+			{
+				pending.push_back( i );
+				length = std::max( length, attacks[ i ].window_end() );
+			}
+		}
+		if ( pending.empty() )
+		{
+			return;
+		}
+
+		shared_rotor_state state( wheels, reflector, *fast_tables.at( { rotor_settings[ 2 ], rotor_settings[ 3 ] } ), length );
+		std::string buffer( buffer_size, 'A' );
+		std::vector<std::vector<scored_key>> matches( pending.size() );
+		{
+			trace_recorder::scope screening_span( options.m_trace, "screening" );
+			screening_span.arg( "intercepts", pending.size() );
+			screening_span.arg( "keys", keys_per_rotor_order );
+			perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::screening );
+			counters.add_keys( keys_per_rotor_order * pending.size() );
+			for ( const auto key : key_range() )
+			{
+				state.reset( key );
+				for ( std::size_t p = 0; p < pending.size(); ++p )
+				{
+					const auto score = attacks[ pending[ p ] ].score( state, buffer );
+					if ( score >= thresholds[ pending[ p ] ] )
+					{
+						matches[ p ].push_back( { score, key } );
+					}
+				}
+			}
+		}
+
+		for ( std::size_t p = 0; p < pending.size(); ++p )
+		{
+			const auto i = pending[ p ];
+			for ( const auto& match : matches[ p ] )
+			{
+				const settings candidate = { rotor_settings, { 0, 0, 0, 0 }, match.m_key };
+				const auto log_hit = [ & ]( hit_log::outcome outcome ) {
+					if ( options.m_hit_log )
+					{
+						const auto machine = make_machine( candidate, reflector, intercepts[ cribbed[ i ] ].m_plugs );
+						const auto message_key = attacks[ i ].message_key( machine, match.m_key );
+						options.m_hit_log->record( make_hit( candidate, message_key, match.m_score, hit_log::stage::batch, outcome, 0 ) );
+					}
+				};
+				if ( solved[ i ] || options.m_stop_token.stop_requested() )
+				{
+					log_hit( hit_log::outcome::unverified );
+					continue;
+				}
+
+				if ( options.m_on_candidate )
+				{
+					options.m_on_candidate( candidate );
+				}
+
+				trace_recorder::scope verify_span( options.m_trace, "fine_tune_key" );
+				verify_span.arg( "key", match.m_key.index() );
+				perf_counters::scope counters( options.m_perf_counters, perf_counters::phase::fine_tune );
+				const auto found = attacks[ i ].verify( candidate );
+				log_hit( found ? hit_log::outcome::confirmed : hit_log::outcome::rejected );
+				bool first = false;
+				if ( !found )
+				{
+					++false_positives;
+				}
+				else if ( solved[ i ].compare_exchange_strong( first, true ) )
+				{
+					results[ cribbed[ i ] ] = found;
+					--remaining;
+				}
+			}
+		}
+
+		progress += keys_per_rotor_order;
+		if ( progress_update && root_thread_id == std::this_thread::get_id() )
+		{
+			trace_recorder::scope progress_span( options.m_trace, "progress" );
+			progress_update( progress, total, false_positives );
+		}
+	} );
+
+	return results;
+}
+
+std::vector<m4_solver::coincidence_candidate> m4_solver::screen_by_coincidence( std::string_view message,
+																				reflector reflector,
+																				std::span<const char* const> plugs,
+																				std::size_t count,
+																				const options& options )
+{
+	if ( message.size() < 2 || count == 0 )
+	{
+		return {};
+	}
+
+	const auto& rotor_combinations = rotor_orders( options );
+	const auto by_index = []( const coincidence_candidate& lhs, const coincidence_candidate& rhs ) { return lhs.m_index > rhs.m_index; };
+	const auto keep_best = [ & ]( std::vector<coincidence_candidate>& best, const coincidence_candidate& candidate ) {
+		if ( best.size() == count && !by_index( candidate, best.back() ) )
+		{
+			return;
+		}
+		best.insert( std::upper_bound( begin( best ), end( best ), candidate, by_index ), candidate );
+		if ( best.size() > count )
+		{
+			best.pop_back();
+		}
+	};
+
+	std::vector<std::vector<coincidence_candidate>> best_by_order( rotor_combinations.size() );
+	thread_pool& pool = options.m_thread_pool ? *options.m_thread_pool : default_thread_pool();
+	pool.parallel_for( rotor_combinations.size(), [ & ]( std::size_t order ) {
+		if ( options.m_stop_token.stop_requested() )
+		{
+			return;
+		}
+		trace_recorder::scope order_span( options.m_trace, "rotor order" );
+		order_span.arg( "order", order );
+
+		const auto& rotor_settings = rotor_combinations[ order ];
+		const settings order_settings = { rotor_settings, { 0, 0, 0, 0 }, {} };
+		const auto machine = make_machine( order_settings, reflector, plugs );
+
+		std::array<float, 26> coincidences;
+		for ( std::uint32_t prefix = 0; prefix < key::count; prefix += 26 )
+		{
+			machine.coincidence_by_right_letter( message, key::from_index( prefix ), coincidences );
+			for ( std::uint32_t letter = 0; letter < 26; ++letter )
+			{
+				auto candidate = coincidence_candidate { order_settings, coincidences[ letter ] };
+				candidate.m_settings.m_key = key::from_index( prefix + letter );
+				keep_best( best_by_order[ order ], candidate );
+			}
+		}
+	} );
+
+	std::vector<coincidence_candidate> best;
+	for ( const auto& order_best : best_by_order )
+	{
+		for ( const auto& candidate : order_best )
+		{
+			keep_best( best, candidate );
+		}
+	}
+	return best;
+}
 
 std::optional<m4_solver::settings> m4_solver::fine_tune_key( std::string_view message,
 															 const settings& settings,
@@ -272,20 +2108,47 @@ std::optional<m4_solver::settings> m4_solver::fine_tune_key( std::string_view me
 	return ::fine_tune_key( message, settings, reflector, plugs, score, validate );
 }
 
-std::vector<std::string> m4_solver::crack_key( std::string_view message,
-											   const std::array<rotor, 4>& rotors,
-											   const std::array<int, 4> ring_settings,
-											   reflector reflector,
-											   std::span<const char* const> plugs,
-											   std::string_view plaintext )
+std::vector<key> m4_solver::crack_key( std::string_view message,
+									   const std::array<rotor, 4>& rotors,
+									   const std::array<int, 4> ring_settings,
+									   reflector reflector,
+									   std::span<const char* const> plugs,
+									   std::string_view plaintext,
+									   kernel kernel )
 {
 	const auto target_score = partial_match_reference_score( message.size() );
-	const auto match_heuristic = [ plaintext, target_score ]( std::string_view candidate ) {
-		return partial_match_score( plaintext, candidate ) >= target_score;
-	};
+	key_matches keys;
+	brute_force_key( message, kernel, rotors, ring_settings, reflector, plugs, nullptr, plaintext, target_score, keys );
+	return { begin( keys ), end( keys ) };
+}
 
+std::vector<key> m4_solver::crack_key_with_crib( std::string_view message,
+												 const std::array<rotor, 4>& rotors,
+												 const std::array<int, 4> ring_settings,
+												 reflector reflector,
+												 std::span<const char* const> plugs,
+												 std::string_view crib,
+												 std::span<const std::size_t> crib_locations )
+{
+	if ( crib_locations.empty() )
+	{
+		return {};
+	}
+
+	const auto target_score = calibrate_with_crib( message, reflector, plugs, crib, crib_locations ).m_threshold;
+
+	const crib_attack attack( message, reflector, plugs, crib, crib_locations );
 	const m4_machine machine( rotors, ring_settings, reflector, plugs );
-	return brute_force_key( message, machine, match_heuristic );
+	key_matches matches;
+	attack.sweep( machine, target_score, matches );
+
+	std::vector<key> keys;
+	keys.reserve( matches.size() );
+	for ( const auto match : matches )
+	{
+		keys.push_back( attack.message_key( machine, match ) );
+	}
+	return keys;
 }
 
 namespace
@@ -303,6 +2166,68 @@ namespace
 	}
 }
 
+enigma::pattern_matcher::pattern_matcher( std::span<const std::string_view> patterns )
+{
+	// Trie of all patterns first
+	m_transitions.emplace_back();
+	m_transitions.front().fill( 0 );
+	std::vector<std::vector<std::uint32_t>> state_patterns( 1 );
+	for ( std::size_t pattern = 0; pattern < patterns.size(); ++pattern )
+	{
+		std::uint32_t state = 0;
+		for ( const char letter : patterns[ pattern ] )
+		{
+			if ( m_transitions[ state ][ letter - 'A' ] == 0 )
+			{
+				m_transitions[ state ][ letter - 'A' ] = static_cast<std::uint32_t>( m_transitions.size() );
+				m_transitions.emplace_back().fill( 0 );
+				state_patterns.emplace_back();
+			}
+			state = m_transitions[ state ][ letter - 'A' ];
+		}
+		state_patterns[ state ].push_back( static_cast<std::uint32_t>( pattern ) );
+		m_lengths.push_back( patterns[ pattern ].size() );
+	}
+
+	// Then failure links in breadth first order, missing transitions point to where the failure link would lead
+	std::vector<std::uint32_t> failure( m_transitions.size(), 0 );
+	std::vector<std::uint32_t> queue;
+	for ( const auto next : m_transitions.front() )
+	{
+		if ( next != 0 )
+		{
+			queue.push_back( next );
+		}
+	}
+	for ( std::size_t i = 0; i < queue.size(); ++i )
+	{
+		const auto state = queue[ i ];
+		const auto& fallback_patterns = state_patterns[ failure[ state ] ];
+		state_patterns[ state ].insert( end( state_patterns[ state ] ), begin( fallback_patterns ), end( fallback_patterns ) );
+
+		for ( std::size_t letter = 0; letter < 26; ++letter )
+		{
+			auto& next = m_transitions[ state ][ letter ];
+			if ( next != 0 )
+			{
+				failure[ next ] = m_transitions[ failure[ state ] ][ letter ];
+				queue.push_back( next );
+			}
+			else
+			{
+				next = m_transitions[ failure[ state ] ][ letter ];
+			}
+		}
+	}
+
+	for ( const auto& outputs : state_patterns )
+	{
+		const auto first = static_cast<std::uint32_t>( m_outputs.size() );
+		m_outputs.insert( end( m_outputs ), begin( outputs ), end( outputs ) );
+		m_state_outputs.emplace_back( first, static_cast<std::uint32_t>( m_outputs.size() ) );
+	}
+}
+
 std::vector<std::size_t> enigma::find_potential_crib_location( std::string_view cyphertext, std::string_view crib )
 {
 	std::vector<std::size_t> locations;
@@ -317,3 +2242,152 @@ std::vector<std::size_t> enigma::find_potential_crib_location( std::string_view
 
 	return locations;
 }
+
+crib_match_scorer::crib_match_scorer( std::string_view crib, std::span<const std::size_t> locations, std::size_t message_length )
+	: m_crib( crib )
+	, m_locations( begin( locations ), end( locations ) )
+	, m_words( ( message_length + 63 ) / 64 )
+	, m_match_planes( std::bit_width( crib.size() ) )
+	, m_score_planes( std::bit_width( crib.size() * crib.size() ) )
+	, m_first_word( 0 )
+	, m_bit_sliced( false )
+	, m_location_mask()
+{
+	std::erase_if( m_locations, [ & ]( std::size_t location ) { return location + crib.size() > message_length; } );
+
+	if ( m_words <= max_words && !m_locations.empty() )
+	{
+		for ( const auto location : m_locations )
+		{
+			m_location_mask[ location / 64 ] |= std::uint64_t( 1 ) << ( location % 64 );
+		}
+		m_first_word = *std::min_element( begin( m_locations ), end( m_locations ) ) / 64;
+
+		// Bit slicing costs about the same as scoring a few locations per 64 letters of message one by one
+		m_bit_sliced = m_crib.size() <= max_crib_size && m_locations.size() >= ( m_words - m_first_word ) * 8 + 16;
+	}
+}
+
+std::size_t crib_match_scorer::scalar_score( std::string_view candidate ) const
+{
+	std::size_t best_score = 0;
+	for ( const auto location : m_locations )
+	{
+		best_score = std::max( best_score, partial_match_score( m_crib, candidate.substr( location, m_crib.size() ) ) );
+	}
+	return best_score;
+}
+
+std::size_t crib_match_scorer::operator()( std::string_view candidate ) const
+{
+	if ( !m_bit_sliced )
+	{
+		return scalar_score( candidate );
+	}
+
+	// Where each crib letter appears in the candidate, one bit per position
+	std::array<std::array<std::uint64_t, max_words + 1>, 26> occurrences;
+	for ( auto& letter_occurrences : occurrences )
+	{
+		std::fill_n( begin( letter_occurrences ), m_words + 1, 0 );
+	}
+	const std::size_t end_position = std::min( candidate.size(), m_words * 64 );
+	for ( std::size_t position = m_first_word * 64; position < end_position; ++position )
+	{
+		occurrences[ candidate[ position ] - 'A' ][ position / 64 ] |= std::uint64_t( 1 ) << ( position % 64 );
+	}
+
+	// Score for each location, bit sliced (plane n holds bit n of the scores of 64 locations)
+	std::array<std::array<std::uint64_t, max_planes>, max_words> scores;
+
+	// Matches are dense enough that a fixed length carry chain is faster than stopping early
+	const auto add_match = [ planes = m_match_planes ]( std::array<std::uint64_t, max_planes>& counter, std::uint64_t bits ) {
+		for ( std::size_t plane = 0; plane < planes; ++plane )
+		{
+			const std::uint64_t carry = counter[ plane ] & bits;
+			counter[ plane ] ^= bits;
+			bits = carry;
+		}
+	};
+	const auto add_pair = [ planes = m_score_planes ]( std::array<std::uint64_t, max_planes>& counter, std::uint64_t bits ) {
+		for ( std::size_t plane = 0; bits != 0 && plane < planes; ++plane )
+		{
+			const std::uint64_t carry = counter[ plane ] & bits;
+			counter[ plane ] ^= bits;
+			bits = carry;
+		}
+	};
+
+	std::array<std::uint64_t, max_crib_size> matches;
+	for ( std::size_t word = m_first_word; word < m_words; ++word )
+	{
+		std::array<std::uint64_t, max_planes> single_matches = {};
+		std::array<std::uint64_t, max_planes> pairs = {};
+
+		for ( std::size_t i = 0; i < m_crib.size(); ++i )
+		{
+			// Locations where candidate[ location + i ] == crib[ i ]
+			const auto& letter_occurrences = occurrences[ m_crib[ i ] - 'A' ];
+			const std::size_t source_word = word + i / 64;
+			const std::size_t bit_shift = i % 64;
+			std::uint64_t bits = 0;
+			if ( source_word < m_words )
+			{
+				bits = letter_occurrences[ source_word ] >> bit_shift;
+				if ( bit_shift != 0 )
+				{
+					bits |= letter_occurrences[ source_word + 1 ] << ( 64 - bit_shift );
+				}
+			}
+			matches[ i ] = bits & m_location_mask[ word ];
+			add_match( single_matches, matches[ i ] );
+		}
+
+		// A run of n matches scores n^2 = n + 2 * (number of pairs of matches inside the run)
+		for ( std::size_t i = 0; i + 1 < m_crib.size(); ++i )
+		{
+			std::uint64_t chain = matches[ i ] & matches[ i + 1 ];
+			for ( std::size_t j = i + 2; chain != 0; ++j )
+			{
+				add_pair( pairs, chain );
+				if ( j == m_crib.size() )
+				{
+					break;
+				}
+				chain &= matches[ j ];
+			}
+		}
+
+		auto& score = scores[ word ];
+		std::uint64_t carry = 0;
+		for ( std::size_t plane = 0; plane < m_score_planes; ++plane )
+		{
+			const std::uint64_t doubled_pairs = plane == 0 ? 0 : pairs[ plane - 1 ];
+			const std::uint64_t partial_sum = single_matches[ plane ] ^ doubled_pairs;
+			score[ plane ] = partial_sum ^ carry;
+			carry = ( single_matches[ plane ] & doubled_pairs ) | ( carry & partial_sum );
+		}
+	}
+
+	// Highest score among all locations, from the most significant plane down
+	std::array<std::uint64_t, max_words> candidates = m_location_mask;
+	std::size_t best_score = 0;
+	for ( std::size_t plane = m_score_planes; plane-- > 0; )
+	{
+		std::uint64_t any = 0;
+		for ( std::size_t word = m_first_word; word < m_words; ++word )
+		{
+			any |= candidates[ word ] & scores[ word ][ plane ];
+		}
+		if ( any != 0 )
+		{
+			for ( std::size_t word = m_first_word; word < m_words; ++word )
+			{
+				candidates[ word ] &= scores[ word ][ plane ];
+			}
+			best_score |= std::size_t( 1 ) << plane;
+		}
+	}
+
+	return best_score;
+}
@@ -0,0 +1,200 @@
+#include "enigma/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+
+#if defined( _WIN32 )
+#define NOMINMAX
+#include <Windows.h>
+#elif defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using enigma::thread_pool;
+
+namespace
+{
+	// CPUs of a NUMA node (on Linux from /sys/devices/system/node/nodeN/cpulist, e.g. "0-7,16-23")
+	std::vector<int> numa_node_cpus( [[maybe_unused]] int node )
+	{
+		std::vector<int> cpus;
+#if defined( _WIN32 )
+		GROUP_AFFINITY affinity = {};
+		if ( GetNumaNodeProcessorMaskEx( static_cast<USHORT>( node ), &affinity ) )
+		{
+			for ( int cpu = 0; cpu < 64; ++cpu )
+			{
+				if ( affinity.Mask & ( KAFFINITY( 1 ) << cpu ) )
+				{
+					cpus.push_back( cpu );
+				}
+			}
+		}
+#elif defined( __linux__ )
+		std::ifstream file( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+		std::string range;
+		while ( std::getline( file, range, ',' ) )
+		{
+			const auto dash = range.find( '-' );
+			const int first = std::stoi( range );
+			const int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+			for ( int cpu = first; cpu <= last; ++cpu )
+			{
+				cpus.push_back( cpu );
+			}
+		}
+#endif
+		return cpus;
+	}
+
+	// Best effort, the pool still works if the platform refuses
+	void pin_thread( [[maybe_unused]] std::thread& thread, [[maybe_unused]] int cpu )
+	{
+#if defined( _WIN32 )
+		SetThreadAffinityMask( thread.native_handle(), DWORD_PTR( 1 ) << cpu );
+#elif defined( __linux__ )
+		cpu_set_t set;
+		CPU_ZERO( &set );
+		CPU_SET( cpu, &set );
+		pthread_setaffinity_np( thread.native_handle(), sizeof( set ), &set );
+#endif
+	}
+}
+
+struct thread_pool::loop
+{
+	std::size_t m_count;
+	const std::function<void( std::size_t )>* m_body;
+	std::atomic<std::size_t> m_next = 0;
+	// Workers currently running the loop, guarded by the pool mutex
+	std::size_t m_helpers = 0;
+	std::mutex m_exception_mutex;
+	std::exception_ptr m_exception;
+};
+
+thread_pool::thread_pool( const thread_pool_options& options )
+{
+	const std::size_t workers
+		= options.m_workers != 0 ? options.m_workers : std::max<std::size_t>( std::thread::hardware_concurrency(), 1 ) - 1;
+
+	auto cpus = options.m_cpus;
+	if ( cpus.empty() && options.m_numa_node )
+	{
+		cpus = numa_node_cpus( *options.m_numa_node );
+	}
+
+	m_workers.reserve( workers );
+	for ( std::size_t i = 0; i < workers; ++i )
+	{
+		m_workers.emplace_back( [ this ] { run_worker(); } );
+		if ( !cpus.empty() )
+		{
+			pin_thread( m_workers.back(), cpus[ i % cpus.size() ] );
+		}
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard lock( m_mutex );
+		m_stopping = true;
+	}
+	m_work_ready.notify_all();
+
+	for ( auto& worker : m_workers )
+	{
+		worker.join();
+	}
+}
+
+void thread_pool::parallel_for( std::size_t count, const std::function<void( std::size_t )>& body )
+{
+	if ( count == 0 )
+	{
+		return;
+	}
+
+	loop current_loop;
+	current_loop.m_count = count;
+	current_loop.m_body = &body;
+
+	if ( count > 1 && !m_workers.empty() )
+	{
+		{
+			std::lock_guard lock( m_mutex );
+			m_loops.push_back( &current_loop );
+		}
+		m_work_ready.notify_all();
+	}
+
+	run_loop( current_loop );
+
+	{
+		std::unique_lock lock( m_mutex );
+		std::erase( m_loops, &current_loop );
+		m_loop_done.wait( lock, [ & ] { return current_loop.m_helpers == 0; } );
+	}
+
+	if ( current_loop.m_exception )
+	{
+		std::rethrow_exception( current_loop.m_exception );
+	}
+}
+
+void thread_pool::run_worker()
+{
+	std::unique_lock lock( m_mutex );
+	while ( true )
+	{
+		m_work_ready.wait( lock, [ this ] { return m_stopping || !m_loops.empty(); } );
+		if ( m_loops.empty() )
+		{
+			return;
+		}
+
+		auto& current_loop = *m_loops.front();
+		++current_loop.m_helpers;
+		lock.unlock();
+
+		run_loop( current_loop );
+
+		lock.lock();
+		// Nothing left to pick up, let the next loop have the workers
+		std::erase( m_loops, &current_loop );
+		if ( --current_loop.m_helpers == 0 )
+		{
+			m_loop_done.notify_all();
+		}
+	}
+}
+
+void thread_pool::run_loop( loop& loop )
+{
+	for ( std::size_t i = loop.m_next++; i < loop.m_count; i = loop.m_next++ )
+	{
+		try
+		{
+			( *loop.m_body )( i );
+		}
+		catch ( ... )
+		{
+			std::lock_guard lock( loop.m_exception_mutex );
+			if ( !loop.m_exception )
+			{
+				loop.m_exception = std::current_exception();
+			}
+			// Skip what's left
+			loop.m_next = loop.m_count;
+		}
+	}
+}
+
+thread_pool& enigma::default_thread_pool()
+{
+	static thread_pool pool;
+	return pool;
+}
@@ -0,0 +1,134 @@
+#include "enigma/tiled.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using enigma::tiled_m4_machine;
+
+tiled_m4_machine::tiled_m4_machine( const std::array<rotor, 4>& rotors,
+									std::array<int, 4> ring_settings,
+									reflector reflector,
+									std::shared_ptr<const fast_rotor_tables> fast_tables )
+	: m_ring_settings( ring_settings )
+	, m_fast_tables( std::move( fast_tables ) )
+{
+	if ( !m_fast_tables || m_fast_tables->m_ring_settings != std::array { ring_settings[ 2 ], ring_settings[ 3 ] } )
+	{
+		throw std::invalid_argument( "fast rotor tables do not match the ring settings" );
+	}
+
+	for ( int greek_offset = 0; greek_offset < 26; ++greek_offset )
+	{
+		for ( int left_offset = 0; left_offset < 26; ++left_offset )
+		{
+			auto& folded = m_folds[ greek_offset * 26 + left_offset ];
+			for ( int contact = 0; contact < 26; ++contact )
+			{
+				auto input = rotors[ 1 ].m_wiring[ contact + left_offset + 26 ];
+				input = rotors[ 0 ].m_wiring[ input - 'A' + greek_offset - left_offset + 26 ];
+				input = reflector.m_wiring[ input - 'A' - greek_offset + 26 ];
+				input = rotors[ 0 ].m_reversed_wiring[ input - 'A' + greek_offset + 26 ];
+				input = rotors[ 1 ].m_reversed_wiring[ input - 'A' + left_offset - greek_offset + 26 ];
+				folded[ contact ] = static_cast<std::uint8_t>( ( input - 'A' - left_offset + 26 ) % 26 );
+			}
+		}
+	}
+}
+
+tiled_m4_machine::key_block tiled_m4_machine::partial_match( std::string_view message,
+															 key key,
+															 const key_block& block,
+															 std::string_view plaintext,
+															 std::size_t threshold ) const
+{
+	// partial_match_score adds the square of each run of matching letters, the run still open is carried along
+	struct key_state
+	{
+		std::uint32_t m_key;
+		std::uint32_t m_run;
+		std::uint64_t m_score;
+	};
+	std::array<key_state, 26 * 26> states;
+	std::size_t live = 0;
+	for ( std::size_t i = 0; i < block.size(); ++i )
+	{
+		if ( block.test( i ) )
+		{
+			states[ live++ ] = { static_cast<std::uint32_t>( i ), 0, 0 };
+		}
+	}
+
+	// Greek and left offsets are those of letters A, the other keys of the block are offset from them. The machine being
+	// reciprocal, a letter decodes to the plaintext when the contact its message letter comes back to is the one the
+	// plaintext letter goes in through.
+	const auto& tables = *m_fast_tables;
+	const int greek_offset = ( 26 - m_ring_settings[ 0 ] ) % 26;
+	int left_offset = ( 26 - m_ring_settings[ 1 ] ) % 26;
+	std::size_t index = ( key[ 2 ] - 'A' - m_ring_settings[ 2 ] + 26 ) % 26 * 26 + ( key[ 3 ] - 'A' - m_ring_settings[ 3 ] + 26 ) % 26;
+	std::array<std::uint8_t, chunk_length> message_contacts;
+	std::array<std::uint8_t, chunk_length> plaintext_contacts;
+	std::array<std::uint8_t, chunk_length> left_offsets;
+
+	const auto length = std::min( message.size(), plaintext.size() );
+	for ( std::size_t start = 0; start < length && live > 0; start += chunk_length )
+	{
+		const auto count = std::min( chunk_length, length - start );
+		for ( std::size_t i = 0; i < count; ++i )
+		{
+			const auto next = tables.m_next[ index ];
+			index = next & ~fast_rotor_tables::left_step;
+			if ( next & fast_rotor_tables::left_step )
+			{
+				left_offset = left_offset == 25 ? 0 : left_offset + 1;
+			}
+			message_contacts[ i ] = tables.m_inward[ index ][ message[ start + i ] - 'A' ];
+			plaintext_contacts[ i ] = tables.m_inward[ index ][ plaintext[ start + i ] - 'A' ];
+			left_offsets[ i ] = static_cast<std::uint8_t>( left_offset );
+		}
+
+		// Even a run through every letter left cannot get the others above threshold
+		const auto remaining = length - start - count;
+		std::size_t kept = 0;
+		for ( std::size_t s = 0; s < live; ++s )
+		{
+			auto state = states[ s ];
+			const auto greek = ( greek_offset + state.m_key / 26 ) % 26;
+			const auto left = state.m_key % 26;
+			const auto* folds = &m_folds[ greek * 26 ];
+
+			std::size_t run = state.m_run;
+			std::uint64_t score = state.m_score;
+			for ( std::size_t i = 0; i < count; ++i )
+			{
+				auto offset = left_offsets[ i ] + left;
+				offset -= offset >= 26 ? 26 : 0;
+				if ( folds[ offset ][ message_contacts[ i ] ] == plaintext_contacts[ i ] )
+				{
+					++run;
+				}
+				else
+				{
+					score += run * run;
+					run = 0;
+				}
+			}
+
+			if ( score + ( run + remaining ) * ( run + remaining ) >= threshold )
+			{
+				states[ kept++ ] = { state.m_key, static_cast<std::uint32_t>( run ), score };
+			}
+		}
+		live = kept;
+	}
+
+	key_block result;
+	for ( std::size_t s = 0; s < live; ++s )
+	{
+		if ( states[ s ].m_score + std::uint64_t( states[ s ].m_run ) * states[ s ].m_run >= threshold )
+		{
+			result.set( states[ s ].m_key );
+		}
+	}
+	return result;
+}
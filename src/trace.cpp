@@ -0,0 +1,128 @@
+#include "enigma/trace.h"
+
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+using enigma::trace_recorder;
+
+namespace
+{
+	void write_json_string( std::ostream& output, const char* text )
+	{
+		output << '"';
+		for ( ; *text; ++text )
+		{
+			if ( *text == '"' || *text == '\\' )
+			{
+				output << '\\';
+			}
+			output << *text;
+		}
+		output << '"';
+	}
+}
+
+trace_recorder::scope::scope( trace_recorder* recorder, const char* name )
+	: m_recorder( recorder )
+{
+	if ( m_recorder )
+	{
+		m_event = { name, m_recorder->now(), 0, { nullptr, nullptr }, { 0, 0 }, 0 };
+	}
+}
+
+trace_recorder::scope::~scope()
+{
+	if ( m_recorder )
+	{
+		m_event.m_end = m_recorder->now();
+		m_recorder->record( m_event );
+	}
+}
+
+void trace_recorder::scope::arg( const char* name, std::int64_t value )
+{
+	if ( m_recorder && m_args < m_event.m_arg_names.size() )
+	{
+		m_event.m_arg_names[ m_args ] = name;
+		m_event.m_arg_values[ m_args ] = value;
+		++m_args;
+	}
+}
+
+trace_recorder::trace_recorder()
+	: m_origin( std::chrono::steady_clock::now() )
+{
+}
+
+std::int64_t trace_recorder::now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - m_origin ).count();
+}
+
+void trace_recorder::record( const event& event )
+{
+	// First span of this thread for this recorder (or it was evicted by others), the thread gets a new number
+	auto& buffer = m_buffers.local( [ this ] {
+		thread_buffer buffer { {}, m_threads++ };
+		buffer.m_events.reserve( 1024 );
+		return buffer;
+	} );
+	buffer.m_events.push_back( event );
+	buffer.m_events.back().m_thread = buffer.m_thread;
+}
+
+std::vector<trace_recorder::event> trace_recorder::events() const
+{
+	std::vector<event> result;
+	m_buffers.for_each(
+		[ & ]( const thread_buffer& buffer ) { result.insert( end( result ), begin( buffer.m_events ), end( buffer.m_events ) ); } );
+	return result;
+}
+
+void trace_recorder::write_chrome_trace( std::ostream& output ) const
+{
+	output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	m_buffers.for_each( [ & ]( const thread_buffer& buffer ) {
+		output << ( first ? "" : "," ) << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.m_thread
+			   << ",\"args\":{\"name\":\"thread " << buffer.m_thread << "\"}}";
+		first = false;
+
+		for ( const auto& event : buffer.m_events )
+		{
+			// Timestamps in microseconds
+			output << ",\n{\"name\":";
+			write_json_string( output, event.m_name );
+			output << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.m_thread << ",\"ts\":" << event.m_start / 1000 << '.'
+				   << ( event.m_start % 1000 ) / 100 << ",\"dur\":" << ( event.m_end - event.m_start ) / 1000 << '.'
+				   << ( ( event.m_end - event.m_start ) % 1000 ) / 100;
+			if ( event.m_arg_names[ 0 ] )
+			{
+				output << ",\"args\":{";
+				for ( std::size_t i = 0; i < event.m_arg_names.size() && event.m_arg_names[ i ]; ++i )
+				{
+					output << ( i > 0 ? "," : "" );
+					write_json_string( output, event.m_arg_names[ i ] );
+					output << ':' << event.m_arg_values[ i ];
+				}
+				output << '}';
+			}
+			output << '}';
+		}
+	} );
+
+	output << "\n]}\n";
+}
+
+void trace_recorder::save_chrome_trace( const std::string& path ) const
+{
+	std::ofstream file( path );
+	if ( !file )
+	{
+		throw std::runtime_error( "Cannot open trace file " + path );
+	}
+	write_chrome_trace( file );
+}
@@ -1,8 +1,29 @@
+#include "enigma/archive.h"
+#include "enigma/async.h"
+#include "enigma/autotune.h"
+#include "enigma/bitsliced.h"
+#include "enigma/bounded_queue.h"
+#include "enigma/corpus.h"
+#include "enigma/hit_log.h"
 #include "enigma/m4.h"
+#include "enigma/perf_counters.h"
+#include "enigma/server.h"
 #include "enigma/solver.h"
+#include "enigma/thread_pool.h"
+#include "enigma/tiled.h"
+#include "enigma/trace.h"
 
 #include <catch.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
 using namespace enigma;
 
 constexpr std::string_view donitz_message = "LANOTCTOUARBBFPMHPHGCZXTDYGAHGUFXGEWKBLKGJWLQXXTGPJJAVTOYJFGSLPPQIHZFXOEBWIIEKFZLCLOAQJULJOYHS"
@@ -133,6 +154,42 @@ TEST_CASE( "Partially wrong settings give higher score than bad settings", "[m4]
 	}
 }
 
+TEST_CASE( "Calibrated threshold separates partially matched settings from wrong ones", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	const auto calibration = m4_solver::calibrate( donitz_message, reflectors::C, plugs, donitz_decoded_message );
+	REQUIRE( calibration.m_false_positive_rate <= 1e-6 );
+	REQUIRE( calibration.m_threshold > calibration.m_mean_score );
+
+	{
+		m4_machine machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
+		REQUIRE( partial_match_score( donitz_decoded_message, machine.decode( donitz_message, "YAAA" ) ) < calibration.m_threshold );
+		REQUIRE( partial_match_score( donitz_decoded_message, machine.decode( donitz_message, "YOOO" ) ) >= calibration.m_threshold );
+	}
+
+	const auto looser
+		= m4_solver::calibrate( donitz_message, reflectors::C, plugs, donitz_decoded_message, { .m_false_positive_rate = 1e-4 } );
+	REQUIRE( looser.m_threshold < calibration.m_threshold );
+	REQUIRE( looser.m_expected_false_positives > calibration.m_expected_false_positives );
+}
+
+TEST_CASE( "Calibration extrapolates the tail of coarse crib scores", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	// A two letter crib at many locations: the top percentile of random keys all match it fully and share the best score
+	std::vector<std::size_t> locations;
+	for ( std::size_t location = 0; location < 120; location += 10 )
+	{
+		locations.push_back( location );
+	}
+	const auto calibration = m4_solver::calibrate_with_crib( donitz_message, reflectors::C, plugs, "KR", locations );
+	REQUIRE( calibration.m_tail_start == 4 );
+	REQUIRE( calibration.m_false_positive_rate <= 1e-6 );
+}
+
 TEST_CASE( "Solver can fine tune partially matched settings", "[m4]" )
 {
 	const std::array<int, 4> wheels = { 9, 5, 6, 8 };
@@ -262,6 +319,60 @@ TEST_CASE( "Finding potential crib location", "[m4]" )
 	REQUIRE( std::find( begin( filtered_locations ), end( filtered_locations ), correct_location ) != end( filtered_locations ) );
 }
 
+TEST_CASE( "Crib scorer gives the best partial match score over all locations", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	for ( const std::string_view crib : { "REICHSMARSCHALLSJGOERINGJ", "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX", "EE" } )
+	{
+		const auto locations = find_potential_crib_location( donitz_message, crib );
+		const crib_match_scorer scorer( crib, locations, donitz_message.size() );
+
+		for ( const auto& [ ring_settings, key ] : { std::pair { std::array { 0, 0, 4, 11 }, "YOSZ" },
+													 std::pair { std::array { 0, 0, 0, 0 }, "YOOO" },
+													 std::pair { std::array { 0, 0, 0, 0 }, "AAAA" } } )
+		{
+			m4_machine machine( wheels, ring_settings, reflectors::C, plugs );
+			const auto result = machine.decode( donitz_message, key );
+
+			std::size_t expected_score = 0;
+			for ( const auto location : locations )
+			{
+				const auto window = std::string_view( result ).substr( location, crib.size() );
+				expected_score = std::max( expected_score, partial_match_score( crib, window ) );
+			}
+
+			REQUIRE( scorer( result ) == expected_score );
+		}
+	}
+}
+
+TEST_CASE( "Pattern matcher finds all cribs in one pass", "[m4]" )
+{
+	const std::array<std::string_view, 4> patterns = { "REICHS", "EICH", "MARSCHALL", "HSM" };
+	const pattern_matcher matcher( patterns );
+
+	std::vector<std::pair<std::size_t, std::size_t>> matches;
+	matcher.find( donitz_decoded_message,
+				  [ & ]( std::size_t pattern, std::size_t position ) { matches.emplace_back( pattern, position ); } );
+
+	std::vector<std::pair<std::size_t, std::size_t>> expected;
+	for ( std::size_t pattern = 0; pattern < patterns.size(); ++pattern )
+	{
+		for ( auto position = donitz_decoded_message.find( patterns[ pattern ] ); position != std::string_view::npos;
+			  position = donitz_decoded_message.find( patterns[ pattern ], position + 1 ) )
+		{
+			expected.emplace_back( pattern, position );
+		}
+	}
+
+	std::sort( begin( matches ), end( matches ) );
+	std::sort( begin( expected ), end( expected ) );
+	REQUIRE( expected.size() == 6 );
+	REQUIRE( matches == expected );
+}
+
 TEST_CASE( "M4 machine can roll back key strokes and return original key", "[m4]" )
 {
 	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
@@ -274,9 +385,357 @@ TEST_CASE( "M4 machine can roll back key strokes and return original key", "[m4]
 	REQUIRE( offset_key == "YQRL" );
 }
 
+TEST_CASE( "Packed keys convert to indices and split into ranges", "[m4]" )
+{
+	constexpr key yosz = "YOSZ";
+	static_assert( std::is_trivially_copyable_v<key> && sizeof( key ) == 4 );
+	static_assert( key::from_index( yosz.index() ) == yosz );
+	static_assert( key::from_index( 0 ) == "AAAA" && key::from_index( key::count - 1 ) == "ZZZZ" );
+
+	auto next = yosz;
+	REQUIRE( ++next == "YOTA" );
+	REQUIRE( next - yosz == 1 );
+	REQUIRE( key( "ZZZZ" ) + 1 == "AAAA" );
+	REQUIRE( yosz + -26 == "YORZ" );
+
+	const key_range all;
+	REQUIRE( all.size() == key::count );
+
+	// Parts follow each other and their keys come in index order
+	std::uint32_t expected_index = 0;
+	bool in_order = true;
+	for ( std::size_t part = 0; part < 7; ++part )
+	{
+		const auto range = all.split( part, 7 );
+		REQUIRE( range.first() == expected_index );
+		for ( const auto current : range )
+		{
+			in_order = in_order && current.index() == expected_index++;
+		}
+	}
+	REQUIRE( in_order );
+	REQUIRE( expected_index == key::count );
+}
+
+TEST_CASE( "M4 machine re-decodes only letters affected by ring settings", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	const m4_machine reference_machine( wheels, { 0, 0, 0, 0 }, reflectors::C, plugs );
+	std::vector<m4_machine::offsets> reference_trace( donitz_message.size() );
+	reference_machine.trace( "YOOO", reference_trace );
+	const auto reference = reference_machine.decode( donitz_message, "YOOO" );
+
+	// Same starting position relative to the rings, only turnovers differ
+	const m4_machine machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs );
+	std::vector<m4_machine::offsets> trace( donitz_message.size() );
+	machine.trace( "YOSZ", trace );
+	const auto shared = std::inner_product(
+		begin( trace ), end( trace ), begin( reference_trace ), std::size_t( 0 ), std::plus<>(), std::equal_to<>() );
+	REQUIRE( shared > 0 );
+	REQUIRE( shared < trace.size() );
+
+	std::string output( donitz_message.size(), 'A' );
+	machine.decode_trace( donitz_message, trace, reference_trace, reference, output );
+	REQUIRE( output == donitz_decoded_message );
+}
+
+TEST_CASE( "M4 machine counts coincidences of all right letters at once", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const m4_machine machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs );
+
+	bool same = true;
+	for ( const key prefix : { key( "YOSA" ), key( "AAAA" ), key( "QZYA" ) } )
+	{
+		std::array<float, 26> coincidences;
+		machine.coincidence_by_right_letter( donitz_message, prefix, coincidences );
+		for ( int letter = 0; letter < 26; ++letter )
+		{
+			auto key = prefix;
+			key[ 3 ] = static_cast<char>( 'A' + letter );
+			same = same && coincidences[ letter ] == index_of_coincidence( machine.decode( donitz_message, key ) );
+		}
+	}
+	REQUIRE( same );
+}
+
+TEST_CASE( "M4 machines sharing fast rotor tables decode the same", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto tables = std::make_shared<const fast_rotor_tables>( rotors[ 6 ], rotors[ 8 ], std::array { 4, 11 }, plugs );
+
+	// Orders differing in their greek and left rotors, the tables do not depend on those
+	bool same = true;
+	for ( const auto& order : { std::array { 9, 5, 6, 8 }, std::array { 10, 2, 6, 8 } } )
+	{
+		const std::array<rotor, 4> wheels = { rotors[ order[ 0 ] ], rotors[ order[ 1 ] ], rotors[ order[ 2 ] ], rotors[ order[ 3 ] ] };
+		const m4_machine machine( wheels, { 0, 3, 4, 11 }, reflectors::C, plugs );
+		const m4_machine shared( wheels, { 0, 3, 4, 11 }, reflectors::C, plugs, tables );
+		// Built for other rings, left out
+		const m4_machine mismatched( wheels, { 0, 3, 4, 12 }, reflectors::C, plugs, tables );
+		const m4_machine reference( wheels, { 0, 3, 4, 12 }, reflectors::C, plugs );
+
+		// Double steps and both middle rotor turnovers along the way
+		for ( const key key : { key( "YOSZ" ), key( "AAAA" ), key( "QZKL" ), key( "MMEF" ) } )
+		{
+			same = same && shared.decode( donitz_message, key ) == machine.decode( donitz_message, key );
+			same = same && mismatched.decode( donitz_message, key ) == reference.decode( donitz_message, key );
+
+			std::string expected( 40, 'A' );
+			std::string output( 40, 'A' );
+			machine.decode_from( donitz_message.substr( 100, 40 ), key, 100, expected );
+			shared.decode_from( donitz_message.substr( 100, 40 ), key, 100, output );
+			same = same && output == expected;
+		}
+	}
+	REQUIRE( same );
+}
+
+TEST_CASE( "Bit sliced machine decodes and scores like the scalar one", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const m4_machine machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs );
+	const bitsliced_m4_machine<4> bitsliced_machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs );
+
+	// Block containing YOSZ, with both middle rotors turning over along the way
+	constexpr key first_key = "YORX";
+	constexpr std::size_t count = 200;
+	std::vector<std::string> outputs( count );
+	bitsliced_machine.decode( donitz_message, first_key, count, outputs );
+
+	const auto threshold = partial_match_reference_score( donitz_message.size() );
+	const auto matches = bitsliced_machine.partial_match( donitz_message, first_key, count, donitz_decoded_message, threshold );
+
+	auto lane_key = first_key;
+	for ( std::size_t lane = 0; lane < count; ++lane, ++lane_key )
+	{
+		const auto expected = machine.decode( donitz_message, lane_key );
+		REQUIRE( outputs[ lane ] == expected );
+		REQUIRE( matches.test( lane ) == ( partial_match_score( donitz_decoded_message, expected ) >= threshold ) );
+	}
+	// YORX + 28 = YOSZ
+	REQUIRE( outputs[ 28 ] == donitz_decoded_message );
+	REQUIRE( matches.test( 28 ) );
+}
+
+TEST_CASE( "Kernel autotuner picks a validated kernel and caches it per host", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto message = donitz_message.substr( 0, 100 );
+	const auto plaintext = donitz_decoded_message.substr( 0, 100 );
+
+	const auto cache = std::filesystem::temp_directory_path() / "enigma_test_kernels" / "kernels";
+	std::filesystem::remove_all( cache.parent_path() );
+	const m4_solver::autotune_options options = { .m_sample_keys = 2048, .m_cache_path = cache.string() };
+
+	const auto tuned = m4_solver::autotune_kernel( message, reflectors::C, plugs, plaintext, options );
+	REQUIRE( !tuned.m_cached );
+	REQUIRE( std::ranges::all_of( tuned.m_seconds, []( double seconds ) { return seconds > 0; } ) );
+	REQUIRE( std::ranges::min_element( tuned.m_seconds ) - begin( tuned.m_seconds ) == static_cast<std::ptrdiff_t>( tuned.m_kernel ) );
+
+	const auto cache_size = std::filesystem::file_size( cache );
+	const auto cached = m4_solver::autotune_kernel( message, reflectors::C, plugs, plaintext, options );
+	REQUIRE( cached.m_cached );
+	REQUIRE( cached.m_kernel == tuned.m_kernel );
+	// Not written again
+	REQUIRE( std::filesystem::file_size( cache ) == cache_size );
+
+	// Bit sliced kernels need the plugboard
+	REQUIRE( m4_solver::autotune_kernel( message, reflectors::C, {}, plaintext, options ).m_kernel == m4_solver::kernel::scalar );
+
+	std::filesystem::remove_all( cache.parent_path() );
+}
+
+TEST_CASE( "Synthetic intercepts decode back to their plaintext", "[m4]" )
+{
+	const auto intercepts = corpus::generate( { .m_count = 20, .m_length = 150, .m_random_reflector = true } );
+	REQUIRE( intercepts.size() == 20 );
+
+	bool all_decode = true;
+	for ( const auto& intercept : intercepts )
+	{
+		const auto& order = intercept.m_settings.m_rotors;
+		const m4_machine machine( { rotors[ order[ 0 ] ], rotors[ order[ 1 ] ], rotors[ order[ 2 ] ], rotors[ order[ 3 ] ] },
+								  intercept.m_settings.m_ring_settings,
+								  intercept.m_reflector,
+								  intercept.plugs() );
+		all_decode &= intercept.m_plaintext.size() == 150 && intercept.m_plug_pairs.size() == 10
+			&& machine.decode( intercept.m_message, intercept.m_settings.m_key ) == intercept.m_plaintext;
+	}
+	REQUIRE( all_decode );
+
+	// German like text stands out from random letters
+	REQUIRE( index_of_coincidence( intercepts.front().m_plaintext ) > 1.4f );
+	REQUIRE( index_of_coincidence( intercepts.front().m_message ) < 1.4f );
+
+	const auto again = corpus::generate( { .m_count = 20, .m_length = 150, .m_random_reflector = true } );
+	REQUIRE( again.back().m_message == intercepts.back().m_message );
+}
+
+TEST_CASE( "Thread pool runs loops from several callers and reports errors", "[m4]" )
+{
+	thread_pool pool( { .m_workers = 3 } );
+	REQUIRE( pool.concurrency() == 4 );
+
+	std::array<std::atomic<int>, 2> sums = {};
+	std::array<std::thread, 2> callers;
+	for ( int caller = 0; caller < 2; ++caller )
+	{
+		callers[ caller ] = std::thread( [ &, caller ] {
+			for ( int repeat = 0; repeat < 10; ++repeat )
+			{
+				pool.parallel_for( 1000, [ & ]( std::size_t i ) { sums[ caller ] += static_cast<int>( i ); } );
+			}
+		} );
+	}
+	for ( auto& caller : callers )
+	{
+		caller.join();
+	}
+	REQUIRE( sums[ 0 ] == 10 * 999 * 1000 / 2 );
+	REQUIRE( sums[ 1 ] == 10 * 999 * 1000 / 2 );
+
+	REQUIRE_THROWS_AS( pool.parallel_for( 100,
+										  []( std::size_t i ) {
+											  if ( i == 42 )
+											  {
+												  throw std::runtime_error( "42" );
+											  }
+										  } ),
+					   std::runtime_error );
+}
+
+TEST_CASE( "Bounded queue hands every value over exactly once", "[m4]" )
+{
+	bounded_queue<int> queue( 5 );
+	REQUIRE( queue.capacity() == 8 );
+
+	int value = 0;
+	REQUIRE( !queue.try_pop( value ) );
+	for ( int i = 0; i < 8; ++i )
+	{
+		REQUIRE( queue.try_push( i ) );
+	}
+	REQUIRE( !queue.try_push( 8 ) );
+	REQUIRE( queue.try_pop( value ) );
+	REQUIRE( value == 0 );
+
+	bounded_queue<int> shared( 16 );
+	constexpr int per_producer = 10'000;
+	std::atomic<long long> sum = 0;
+	std::atomic<int> received = 0;
+	{
+		std::vector<std::jthread> threads;
+		for ( int producer = 0; producer < 2; ++producer )
+		{
+			threads.emplace_back( [ & ] {
+				for ( int i = 1; i <= per_producer; ++i )
+				{
+					while ( !shared.try_push( i ) )
+					{
+						std::this_thread::yield();
+					}
+				}
+			} );
+		}
+		for ( int consumer = 0; consumer < 2; ++consumer )
+		{
+			threads.emplace_back( [ & ] {
+				int next = 0;
+				while ( received < 2 * per_producer )
+				{
+					if ( shared.try_pop( next ) )
+					{
+						sum += next;
+						++received;
+					}
+					else
+					{
+						std::this_thread::yield();
+					}
+				}
+			} );
+		}
+	}
+	REQUIRE( received == 2 * per_producer );
+	REQUIRE( sum == 2LL * per_producer * ( per_producer + 1 ) / 2 );
+}
+
+TEST_CASE( "Trace recorder collects spans from all threads and exports them", "[m4]" )
+{
+	trace_recorder recorder;
+	thread_pool pool( { .m_workers = 3 } );
+	pool.parallel_for( 100, [ & ]( std::size_t i ) {
+		trace_recorder::scope span( &recorder, "work" );
+		span.arg( "item", static_cast<std::int64_t>( i ) );
+	} );
+	{
+		trace_recorder::scope ignored( nullptr, "ignored" );
+		ignored.arg( "item", 0 );
+	}
+
+	const auto events = recorder.events();
+	REQUIRE( events.size() == 100 );
+	REQUIRE( std::ranges::all_of( events, [ & ]( const auto& event ) {
+		return event.m_end >= event.m_start && event.m_thread < pool.concurrency();
+	} ) );
+	std::vector<std::int64_t> items;
+	for ( const auto& event : events )
+	{
+		items.push_back( event.m_arg_values[ 0 ] );
+	}
+	std::sort( begin( items ), end( items ) );
+	REQUIRE( items.front() == 0 );
+	REQUIRE( items.back() == 99 );
+	REQUIRE( std::adjacent_find( begin( items ), end( items ) ) == end( items ) );
+
+	std::ostringstream json;
+	recorder.write_chrome_trace( json );
+	REQUIRE( json.str().starts_with( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" ) );
+	REQUIRE( json.str().find( "\"name\":\"work\",\"ph\":\"X\"" ) != std::string::npos );
+	REQUIRE( json.str().find( "\"args\":{\"item\":99}" ) != std::string::npos );
+}
 
 #ifndef _DEBUG
 
+TEST_CASE( "Request handler decodes in batches and reports errors", "[m4]" )
+{
+	server::request_handler handler;
+	const std::string machine = "reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AE,BF,CM,DQ,HU,JN,LX,PR,SZ,VW";
+
+	REQUIRE( handler.handle( "DECODE " + machine + " key=YOSZ message=" + std::string( donitz_message ) )
+			 == "OK " + std::string( donitz_decoded_message ) );
+
+	const std::vector<std::string> requests = {
+		"BULK-DECODE " + machine + " messages=YOSZ:" + std::string( donitz_message.substr( 0, 10 ) ) + ",YOSZ:LANOT",
+		"DECODE reflector=C rotors=1,5,6,8 rings=0,0,4,11 key=YOSZ message=LANOT",
+		"DECODE " + machine + " key=yosz message=LANOT",
+		"STATUS job=1",
+		"DECODE " + machine + " key=YOSZ message=LANOT",
+	};
+	const auto responses = handler.handle_batch( requests );
+	REQUIRE( responses.size() == requests.size() );
+	REQUIRE( responses[ 0 ] == "OK " + std::string( donitz_decoded_message.substr( 0, 10 ) ) + ",KRKRA" );
+	REQUIRE( responses[ 1 ].starts_with( "ERROR" ) );
+	REQUIRE( responses[ 2 ] == "ERROR key must be uppercase letters" );
+	REQUIRE( responses[ 3 ] == "ERROR unknown job" );
+	REQUIRE( responses[ 4 ] == "OK KRKRA" );
+
+	REQUIRE( handler.handle( "DECODE reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AB,AC key=YOSZ message=LANOT" )
+			 == "ERROR plug letters must all be different" );
+	REQUIRE( handler.handle( "DECODE reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AB,CD,EF,GH,IJ,KL,MN,OP,QR,ST,UV,WX,YZ,AB key=YOSZ "
+							 "message=LANOT" )
+			 == "ERROR at most 13 plug pairs" );
+	REQUIRE( handler.handle( "ENCODE" ) == "ERROR unknown command ENCODE" );
+	REQUIRE( !handler.shutdown_requested() );
+	REQUIRE( handler.handle( "SHUTDOWN" ) == "OK" );
+	REQUIRE( handler.shutdown_requested() );
+}
+
 TEST_CASE( "Bruteforce Donitz message key", "[m4]" )
 {
 	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
@@ -285,6 +744,563 @@ TEST_CASE( "Bruteforce Donitz message key", "[m4]" )
 	const auto keys = m4_solver::crack_key( donitz_message, wheels, { 0, 0, 4, 11 }, reflectors::C, plugs, donitz_decoded_message );
 
 	REQUIRE( std::find( begin( keys ), end( keys ), "YOSZ" ) != std::end( keys ) );
+
+	const auto bitsliced_keys = m4_solver::crack_key(
+		donitz_message, wheels, { 0, 0, 4, 11 }, reflectors::C, plugs, donitz_decoded_message, m4_solver::kernel::bitsliced_256 );
+
+	REQUIRE( bitsliced_keys == keys );
+
+	// Longer than a chunk, keys carry their score over
+	REQUIRE( donitz_message.size() > tiled_m4_machine::chunk_length );
+	const auto tiled_keys = m4_solver::crack_key(
+		donitz_message, wheels, { 0, 0, 4, 11 }, reflectors::C, plugs, donitz_decoded_message, m4_solver::kernel::tiled );
+
+	REQUIRE( tiled_keys == keys );
+}
+
+TEST_CASE( "Bruteforce Donitz message key from crib windows", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	auto locations = find_potential_crib_location( donitz_message, crib );
+	std::erase_if( locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+
+	const auto keys = m4_solver::crack_key_with_crib( donitz_message, wheels, { 0, 0, 4, 11 }, reflectors::C, plugs, crib, locations );
+
+	REQUIRE( std::find( begin( keys ), end( keys ), "YOSZ" ) != std::end( keys ) );
+}
+
+TEST_CASE( "Crack Donitz message settings from several short cribs", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	// Too short to stand out alone, scored together they do
+	std::vector<m4_solver::crib> cribs = { { "XGEZXREICHSLEITE", {} }, { "KKJBORMANNJXX", {} } };
+	for ( auto& crib : cribs )
+	{
+		crib.m_locations = find_potential_crib_location( donitz_message, crib.m_text );
+		std::erase_if( crib.m_locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+	}
+
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 5, 6, 8 } };
+	const auto settings = m4_solver::crack_settings_with_cribs( donitz_message, reflectors::C, plugs, cribs, {}, options );
+
+	REQUIRE( settings );
+	REQUIRE( settings->m_rotors == std::array { 9, 5, 6, 8 } );
+
+	const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, settings->m_ring_settings, reflectors::C, plugs );
+	const auto decoded = machine.decode( donitz_message, settings->m_key );
+	for ( const auto& crib : cribs )
+	{
+		REQUIRE( decoded.find( crib.m_text ) == donitz_decoded_message.find( crib.m_text ) );
+	}
+}
+
+TEST_CASE( "Crack Donitz message settings with an unknown reflector", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	// B, C with two pairs rewired, and the right one
+	const std::array candidates = { reflectors::B, reflector( "DROAJNTKVEHMLFCWZBXGYIPSUQ" ), reflectors::C };
+
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+
+	// Letters matching the plaintext are the same as with a full decode
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	std::string matches( message.size() * candidates.size(), 'A' );
+	m4_machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs ).match_plaintext( message, plaintext, "YOSZ", candidates, matches );
+	bool same_matches = true;
+	for ( std::size_t r = 0; r < candidates.size(); ++r )
+	{
+		const auto decoded = m4_machine( wheels, { 0, 0, 4, 11 }, candidates[ r ], plugs ).decode( message, "YOSZ" );
+		for ( std::size_t i = 0; i < message.size(); ++i )
+		{
+			same_matches &= ( matches[ r * message.size() + i ] == plaintext[ i ] ) == ( decoded[ i ] == plaintext[ i ] );
+		}
+	}
+	REQUIRE( same_matches );
+	REQUIRE( std::string_view( matches ).substr( 2 * message.size() ) == plaintext );
+
+	trace_recorder recorder;
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 5, 6, 8 } };
+	options.m_trace = &recorder;
+	const auto result = m4_solver::crack_settings( message, candidates, plugs, plaintext, {}, options );
+
+	REQUIRE( result );
+	const auto events = recorder.events();
+	REQUIRE( std::ranges::count_if( events, []( const auto& event ) { return event.m_name == std::string_view( "rotor order" ); } ) == 1 );
+	REQUIRE( std::ranges::count_if( events, []( const auto& event ) { return event.m_name == std::string_view( "fine_tune_key" ); } )
+			 >= 1 );
+	REQUIRE( result->m_reflector == 2 );
+	REQUIRE( result->m_settings.m_rotors == std::array { 9, 5, 6, 8 } );
+
+	const m4_machine machine( wheels, result->m_settings.m_ring_settings, reflectors::C, plugs );
+	REQUIRE( machine.decode( message, result->m_settings.m_key ) == plaintext );
+}
+
+TEST_CASE( "Rotor orders with the best prescreen score are searched first", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+
+	trace_recorder recorder;
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 10, 1, 2, 3 }, { 9, 5, 6, 8 } };
+	options.m_priorities.m_prescreen_length = 12;
+	// Prescreen scores come first, weights only break ties
+	options.m_priorities.m_rotor_order_weights = { { { 10, 1, 2, 3 }, 10.0 } };
+	options.m_trace = &recorder;
+	const auto settings = m4_solver::crack_settings( message, reflectors::C, plugs, plaintext, {}, options );
+
+	REQUIRE( settings );
+	REQUIRE( settings->m_rotors == std::array { 9, 5, 6, 8 } );
+
+	// Orders are numbered by search order, the first one searched is the one giving candidates
+	const auto events = recorder.events();
+	REQUIRE( std::ranges::count_if( events, []( const auto& event ) { return event.m_name == std::string_view( "prescreen" ); } ) == 3 );
+	const auto first_order = std::ranges::find_if( events, []( const auto& event ) {
+		return event.m_name == std::string_view( "rotor order" ) && event.m_arg_values[ 0 ] == 0;
+	} );
+	REQUIRE( first_order != end( events ) );
+	REQUIRE( first_order->m_arg_values[ 1 ] > 0 );
+}
+
+TEST_CASE( "Verifier threads check candidates while the sweep goes on", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+
+	// Threshold low enough to get a few hundred false positives
+	auto calibration = m4_solver::calibrate( message, reflectors::C, plugs, plaintext );
+	calibration.m_threshold = static_cast<std::size_t>( calibration.m_mean_score + 3 * calibration.m_score_deviation );
+
+	// Room for every candidate, sweeping threads never have to verify one themselves
+	trace_recorder recorder;
+	std::atomic<std::size_t> candidates = 0;
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 } };
+	options.m_calibration = calibration;
+	options.m_verify_threads = 2;
+	options.m_verify_queue_size = 1 << 15;
+	options.m_trace = &recorder;
+	options.m_on_candidate = [ & ]( const m4_solver::settings& ) { ++candidates; };
+	const auto settings = m4_solver::crack_settings( message, reflectors::C, plugs, plaintext, {}, options );
+
+	REQUIRE( settings );
+	REQUIRE( settings->m_rotors == std::array { 9, 5, 6, 8 } );
+	const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, settings->m_ring_settings, reflectors::C, plugs );
+	REQUIRE( machine.decode( message, settings->m_key ) == plaintext );
+	// Every candidate of the right rotor order is handed over, whether found first or not
+	REQUIRE( candidates > 100 );
+
+	// At least the confirming verification ran, and only on threads that never screened
+	const auto events = recorder.events();
+	std::set<std::size_t> sweeping_threads;
+	for ( const auto& event : events )
+	{
+		if ( event.m_name == std::string_view( "screening" ) )
+		{
+			sweeping_threads.insert( event.m_thread );
+		}
+	}
+	const auto is_verify = []( const auto& event ) { return event.m_name == std::string_view( "fine_tune_key" ); };
+	REQUIRE( std::ranges::count_if( events, is_verify ) > 0 );
+	REQUIRE( std::ranges::none_of(
+		events, [ & ]( const auto& event ) { return is_verify( event ) && sweeping_threads.contains( event.m_thread ); } ) );
+}
+
+TEST_CASE( "Multiplexed hardware counters are scaled over the interval counted", "[m4]" )
+{
+	// Scaling each total on its own would give 1100 * 400 / 300 - 1000 * 200 / 100 < 0
+	REQUIRE( perf_counters::scaled_delta( { 1000, 200, 100 }, { 1100, 400, 300 } ) == 100 );
+	// Counting half of the time it was enabled
+	REQUIRE( perf_counters::scaled_delta( { 0, 0, 0 }, { 500, 1000, 500 } ) == 1000 );
+	REQUIRE( perf_counters::scaled_delta( { 10, 100, 100 }, { 20, 200, 200 } ) == 10 );
+	// Never scheduled in between
+	REQUIRE( perf_counters::scaled_delta( { 10, 100, 50 }, { 10, 200, 50 } ) == 0 );
+}
+
+TEST_CASE( "Hardware counters add up each solver phase over threads", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+
+	perf_counters counters;
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 } };
+	options.m_perf_counters = &counters;
+	const auto settings = m4_solver::crack_settings( message, reflectors::C, plugs, plaintext, {}, options );
+	REQUIRE( settings );
+
+	const auto screening = counters.phase_totals( perf_counters::phase::screening );
+	REQUIRE( screening.m_scopes >= 1 );
+	REQUIRE( screening.m_keys == screening.m_scopes * 26 * 26 * 26 * 26 );
+	REQUIRE( counters.phase_totals( perf_counters::phase::calibration ).m_scopes == 1 );
+	REQUIRE( counters.phase_totals( perf_counters::phase::fine_tune ).m_scopes >= 1 );
+	// Either counted or reported as such, sandboxes and most containers refuse perf_event_open
+	REQUIRE( ( !counters.available( perf_counters::event::cycles ) || screening.m_events[ 0 ] > 0 ) );
+
+	std::ostringstream report;
+	counters.write_report( report );
+	REQUIRE( ( report.str().find( "screening" ) != std::string::npos || report.str().starts_with( "Hardware counters unavailable" ) ) );
+}
+
+TEST_CASE( "Hit log keeps every candidate with its outcome for offline analysis", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+	const auto path = ( std::filesystem::temp_directory_path() / "enigma_test_hits" ).string();
+
+	std::size_t logged = 0;
+	{
+		hit_log hits( path );
+		m4_solver::options options;
+		options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 } };
+		// Loose enough to let wrong keys through
+		options.m_calibration = m4_solver::calibrate( message, reflectors::C, plugs, plaintext, { .m_false_positive_rate = 1e-4 } );
+		options.m_hit_log = &hits;
+		REQUIRE( m4_solver::crack_settings( message, reflectors::C, plugs, plaintext, {}, options ) );
+		logged = hits.size();
+	}
+
+	const hit_log_reader reader( path );
+	const auto hits = reader.hits();
+	REQUIRE( hits.size() == logged );
+	REQUIRE( std::ranges::all_of( hits, []( const hit_log::hit& hit ) { return hit.m_stage == hit_log::stage::plaintext; } ) );
+	REQUIRE( std::ranges::any_of( hits, []( const hit_log::hit& hit ) { return hit.m_outcome == hit_log::outcome::rejected; } ) );
+
+	const auto confirmed = std::ranges::find( hits, hit_log::outcome::confirmed, &hit_log::hit::m_outcome );
+	REQUIRE( confirmed != hits.end() );
+	REQUIRE( confirmed->m_rotors == std::array<std::uint8_t, 4> { 9, 5, 6, 8 } );
+	const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, { 0, 0, 0, 0 }, reflectors::C, plugs );
+	REQUIRE( confirmed->m_score == partial_match_score( plaintext, machine.decode( message, key::from_index( confirmed->m_key ) ) ) );
+
+	std::ostringstream report;
+	write_hit_report( hits, report );
+	REQUIRE( report.str().find( "plaintext" ) != std::string::npos );
+
+	std::filesystem::remove( path );
+	REQUIRE_THROWS_AS( hit_log_reader( path ), std::runtime_error );
+}
+
+TEST_CASE( "Intercept archives are read in place and round trip through text", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const auto path = ( std::filesystem::temp_directory_path() / "enigma_test_archive" ).string();
+	const auto copy_path = path + "_copy";
+	const auto crib_location = donitz_decoded_message.find( "REICHSMARSCHALL" );
+
+	{
+		archive_writer archive( path );
+		const std::array cribs = { archived_crib { "Reichsmarschall", crib_location }, archived_crib { "KRKR" } };
+		archive.add( donitz_message, "Triton", 19450501, cribs );
+		// Normalized on the way in
+		std::string lower_case( donitz_message.substr( 0, 20 ) );
+		std::ranges::transform( lower_case, lower_case.begin(), []( char c ) { return static_cast<char>( c - 'A' + 'a' ); } );
+		archive.add( lower_case.substr( 0, 10 ) + " 1 2 " + lower_case.substr( 10 ), {}, 0 );
+		archive.add( "ABCDEF", "Triton", 19450502 );
+		const std::array too_long = { archived_crib { "ABC", 4 } };
+		REQUIRE_THROWS_AS( archive.add( "ABCDEF", "Triton", 0, too_long ), std::invalid_argument );
+		archive.close();
+	}
+
+	std::string text;
+	{
+		const intercept_archive archive( path );
+		REQUIRE( archive.size() == 3 );
+		const auto donitz = archive[ 0 ];
+		REQUIRE( donitz.message() == donitz_message );
+		REQUIRE( donitz.net() == "Triton" );
+		REQUIRE( donitz.date() == 19450501 );
+		REQUIRE( donitz.crib_count() == 2 );
+		REQUIRE( donitz.crib( 0 ).m_text == "REICHSMARSCHALL" );
+		REQUIRE( archive[ 1 ].message() == donitz_message.substr( 0, 20 ) );
+		REQUIRE( archive[ 1 ].net().empty() );
+		REQUIRE( archive[ 2 ].net() == "Triton" );
+
+		const auto cribs = solver_cribs( donitz );
+		REQUIRE( cribs[ 0 ].m_locations == std::vector { crib_location } );
+		REQUIRE( cribs[ 1 ].m_locations == find_potential_crib_location( donitz_message, "KRKR" ) );
+
+		// Decoded straight from the mapping
+		const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, { 0, 0, 4, 11 }, reflectors::C, plugs );
+		const std::vector intercepts = { archive[ 0 ], archive[ 1 ] };
+		const std::array keys = { key( "YOSZ" ), key( "YOSZ" ) };
+		std::string output( donitz_message.size() + 20, ' ' );
+		decode_intercepts( machine, intercepts, keys, output );
+		REQUIRE( output == std::string( donitz_decoded_message ) + std::string( donitz_decoded_message.substr( 0, 20 ) ) );
+
+		std::ostringstream exported;
+		export_intercepts( archive, exported );
+		text = exported.str();
+		REQUIRE( text.starts_with( "Triton 1945-05-01 " + std::string( donitz_message ) + " REICHSMARSCHALL@" ) );
+	}
+
+	{
+		archive_writer copy( copy_path );
+		std::istringstream input( "# net date message cribs\n\n" + text );
+		REQUIRE( import_intercepts( input, copy ) == 3 );
+		std::istringstream malformed( "Triton 1945-13-01 ABC\n" );
+		REQUIRE_THROWS_AS( import_intercepts( malformed, copy ), std::runtime_error );
+	}
+	std::ostringstream exported_copy;
+	export_intercepts( intercept_archive( copy_path ), exported_copy );
+	REQUIRE( exported_copy.str() == text );
+
+	std::filesystem::resize_file( path, std::filesystem::file_size( path ) - 8 );
+	REQUIRE_THROWS_AS( intercept_archive( path ), std::runtime_error );
+	std::filesystem::remove( path );
+	std::filesystem::remove( copy_path );
+}
+
+TEST_CASE( "Right rotor positions ranked first only leave a few keys to sweep", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	auto locations = find_potential_crib_location( donitz_message, crib );
+	std::erase_if( locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+
+	const auto path = ( std::filesystem::temp_directory_path() / "enigma_test_crib_hits" ).string();
+	trace_recorder recorder;
+	perf_counters counters;
+	std::optional<m4_solver::settings> settings;
+	{
+		hit_log hits( path );
+		m4_solver::options options;
+		options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 4, 7, 5 }, { 9, 5, 6, 8 } };
+		options.m_right_rotor_first = true;
+		options.m_trace = &recorder;
+		options.m_perf_counters = &counters;
+		options.m_hit_log = &hits;
+		settings = m4_solver::crack_settings_with_crib( donitz_message, reflectors::C, plugs, crib, locations, {}, options );
+	}
+
+	REQUIRE( settings );
+	REQUIRE( settings->m_rotors == std::array { 9, 5, 6, 8 } );
+	const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, settings->m_ring_settings, reflectors::C, plugs );
+	REQUIRE( machine.decode( donitz_message, settings->m_key ).find( crib ) == donitz_decoded_message.find( crib ) );
+
+	// Logged with the message key (at rings 0), not the key at the first crib location
+	{
+		const hit_log_reader reader( path );
+		const auto hits = reader.hits();
+		const auto confirmed = std::ranges::find( hits, hit_log::outcome::confirmed, &hit_log::hit::m_outcome );
+		REQUIRE( confirmed != hits.end() );
+		REQUIRE( confirmed->m_stage == hit_log::stage::crib_staged );
+		const auto logged_key = key::from_index( confirmed->m_key );
+		REQUIRE( logged_key[ 3 ] == 'A' + ( settings->m_key[ 3 ] - 'A' - settings->m_ring_settings[ 3 ] + 26 ) % 26 );
+	}
+	std::filesystem::remove( path );
+
+	// At most a couple of right letters out of 26 survive for each rotor order
+	const auto events = recorder.events();
+	REQUIRE( std::ranges::count_if( events, []( const auto& event ) { return event.m_name == std::string_view( "right rotor" ); } ) == 3 );
+	REQUIRE( std::ranges::all_of( events, []( const auto& event ) {
+		return event.m_name != std::string_view( "right rotor" ) || event.m_arg_values[ 0 ] <= 2;
+	} ) );
+
+	// Only keys with a surviving right letter count as screened
+	std::uint64_t survivors = 0;
+	for ( const auto& event : events )
+	{
+		if ( event.m_name == std::string_view( "right rotor" ) )
+		{
+			survivors += event.m_arg_values[ 0 ];
+		}
+	}
+	REQUIRE( counters.phase_totals( perf_counters::phase::screening ).m_keys == survivors * 26 * 26 * 26 );
+}
+
+TEST_CASE( "Ciphertext only screening ranks the right rotor order first", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	// Rings at 0 like the screen assumes: with others, turnovers move and only parts of the decode come out right
+	const m4_machine machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] }, { 0, 0, 0, 0 }, reflectors::C, plugs );
+	const auto message = machine.decode( donitz_decoded_message, "YOOO" );
+
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 }, { 10, 3, 7, 4 } };
+	const auto candidates = m4_solver::screen_by_coincidence( message, reflectors::C, plugs, 5, options );
+
+	REQUIRE( candidates.size() == 5 );
+	REQUIRE( std::ranges::is_sorted( candidates, std::greater<>(), &m4_solver::coincidence_candidate::m_index ) );
+	REQUIRE( candidates.front().m_settings.m_rotors == std::array { 9, 5, 6, 8 } );
+	REQUIRE( candidates.front().m_settings.m_key == key( "YOOO" ) );
+	REQUIRE( candidates.front().m_index > 1.5f );
+}
+
+TEST_CASE( "Crack day key from several messages", "[m4]" )
+{
+	const std::array<rotor, 4> wheels = { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] };
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const m4_machine machine( wheels, { 0, 0, 4, 11 }, reflectors::C, plugs );
+
+	// Same day key, other message keys (the machine is reciprocal so decoding plaintext enciphers it)
+	const auto short_message = machine.decode( "VONVONBEFEHLSHABERDERUBOOTEXXGELEITZUGINQUADRATANGREIFENX", "QBFM" );
+	constexpr std::string_view uncribbed_plaintext = "DERFUEHRERISTTOTXDERKAMPFGEHTWEITERXICHHABEDASKOMMANDOUEBERALLETEILEDERWEHRMACHT"
+													 "UEBERNOMMENXMITDEMWILLENDENKAMPFGEGENDIEBOLSCHEWISTENFORTZUSETZENX";
+	const auto uncribbed_message = machine.decode( uncribbed_plaintext, "DKUA" );
+
+	constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	auto locations = find_potential_crib_location( donitz_message, crib );
+	std::erase_if( locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+
+	const std::array<m4_solver::intercept, 3> intercepts = { m4_solver::intercept { donitz_message, crib, locations },
+															 { short_message, "VONVONBEFEHLSHABER", { 0 } },
+															 { uncribbed_message, {}, {} } };
+
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 }, { 10, 5, 6, 8 } };
+	const auto day_key = m4_solver::crack_day_key( intercepts, reflectors::C, plugs, {}, options );
+
+	REQUIRE( day_key );
+	REQUIRE( day_key->m_rotors == std::array { 9, 5, 6, 8 } );
+	REQUIRE( day_key->m_keys.size() == 3 );
+	REQUIRE( std::ranges::all_of( day_key->m_keys, []( const auto& key ) { return key.has_value(); } ) );
+
+	const m4_machine day_machine( wheels, day_key->m_ring_settings, reflectors::C, plugs );
+	REQUIRE( day_machine.decode( donitz_message, *day_key->m_keys[ 0 ] ) == donitz_decoded_message );
+	REQUIRE( day_machine.decode( short_message, *day_key->m_keys[ 1 ] ).starts_with( "VONVONBEFEHLSHABER" ) );
+	REQUIRE( day_machine.decode( uncribbed_message, *day_key->m_keys[ 2 ] ) == uncribbed_plaintext );
+}
+
+TEST_CASE( "Crack a batch of messages sent with different day keys", "[m4]" )
+{
+	const std::array donitz_plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+	const std::array other_plugs = { "AK", "BZ", "CR", "DG", "EW", "FO", "HX", "IQ", "LT", "MV" };
+
+	constexpr std::string_view plaintext = "VONVONBEFEHLSHABERDERUBOOTEXXGELEITZUGINQUADRATANGREIFENX";
+	const m4_machine machine( { rotors[ 10 ], rotors[ 4 ], rotors[ 2 ], rotors[ 7 ] }, { 0, 0, 5, 9 }, reflectors::C, other_plugs );
+	const auto other_message = machine.decode( plaintext, "KQDA" );
+
+	constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	auto locations = find_potential_crib_location( donitz_message, crib );
+	std::erase_if( locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+
+	const std::array<m4_solver::batch_intercept, 3> intercepts = {
+		m4_solver::batch_intercept { donitz_message, donitz_plugs, { { crib, locations } } },
+		{ other_message, other_plugs, { { "VONVONBEFEHLSHABER", { 0 } } } },
+		{ other_message, other_plugs, {} }
+	};
+
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 }, { 10, 4, 2, 7 } };
+	const auto results = m4_solver::crack_batch_with_cribs( intercepts, reflectors::C, {}, options );
+
+	REQUIRE( results.size() == 3 );
+	REQUIRE( results[ 0 ] );
+	REQUIRE( results[ 0 ]->m_rotors == std::array { 9, 5, 6, 8 } );
+	const m4_machine donitz_machine( { rotors[ 9 ], rotors[ 5 ], rotors[ 6 ], rotors[ 8 ] },
+									 results[ 0 ]->m_ring_settings,
+									 reflectors::C,
+									 donitz_plugs );
+	REQUIRE( donitz_machine.decode( donitz_message, results[ 0 ]->m_key ).find( crib ) == donitz_decoded_message.find( crib ) );
+
+	REQUIRE( results[ 1 ] );
+	REQUIRE( results[ 1 ]->m_rotors == std::array { 10, 4, 2, 7 } );
+	const m4_machine other_machine( { rotors[ 10 ], rotors[ 4 ], rotors[ 2 ], rotors[ 7 ] },
+									results[ 1 ]->m_ring_settings,
+									reflectors::C,
+									other_plugs );
+	REQUIRE( other_machine.decode( other_message, results[ 1 ]->m_key ).starts_with( "VONVONBEFEHLSHABER" ) );
+
+	// Without a crib it is left out
+	REQUIRE( !results[ 2 ] );
+}
+
+TEST_CASE( "Crack jobs run in the background and stream candidates", "[m4]" )
+{
+	const std::array plugs = { "AE", "BF", "CM", "DQ", "HU", "JN", "LX", "PR", "SZ", "VW" };
+
+	constexpr std::string_view crib = "XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX";
+	auto locations = find_potential_crib_location( donitz_message, crib );
+	std::erase_if( locations, []( std::size_t location ) { return location < donitz_message.size() * 0.75f; } );
+
+	m4_solver::executor executor( 2 );
+
+	m4_solver::options options;
+	options.m_rotor_orders = { { 9, 5, 6, 8 } };
+	auto job = m4_solver::crack_settings_with_crib_async( executor, donitz_message, reflectors::C, plugs, crib, locations, options );
+	auto cancelled_job = m4_solver::crack_settings_async( executor, donitz_message, reflectors::C, plugs, donitz_decoded_message );
+	cancelled_job.cancel();
+
+	std::vector<m4_solver::settings> candidates;
+	while ( auto candidate = job.next_candidate() )
+	{
+		candidates.push_back( *candidate );
+	}
+
+	const auto settings = job.get();
+	REQUIRE( settings );
+	REQUIRE( settings->m_rotors == std::array { 9, 5, 6, 8 } );
+	REQUIRE( !candidates.empty() );
+	REQUIRE( std::ranges::all_of( candidates, []( const auto& candidate ) { return candidate.m_rotors == std::array { 9, 5, 6, 8 }; } ) );
+
+	REQUIRE( !cancelled_job.get() );
+	REQUIRE( cancelled_job.ready() );
+
+	// Candidates nobody reads only pile up to candidate_capacity
+	const auto plaintext = donitz_decoded_message.substr( 0, 120 );
+	const auto message = donitz_message.substr( 0, 120 );
+	auto calibration = m4_solver::calibrate( message, reflectors::C, plugs, plaintext );
+	calibration.m_threshold = static_cast<std::size_t>( calibration.m_mean_score + 3 * calibration.m_score_deviation );
+	std::atomic<std::size_t> found = 0;
+	options.m_rotor_orders = { { 9, 1, 2, 3 }, { 9, 5, 6, 8 } };
+	options.m_calibration = calibration;
+	options.m_on_candidate = [ & ]( const m4_solver::settings& ) { ++found; };
+	auto unread_job = m4_solver::crack_settings_async( executor, message, reflectors::C, plugs, plaintext, options );
+	REQUIRE( unread_job.get() );
+
+	std::size_t unread = 0;
+	while ( unread_job.next_candidate() )
+	{
+		++unread;
+	}
+	REQUIRE( unread == std::min( found.load(), m4_solver::crack_job::candidate_capacity ) );
+	REQUIRE( unread + unread_job.dropped_candidates() == found );
+}
+
+
+TEST_CASE( "Server cracks jobs and answers over a Unix socket", "[m4]" )
+{
+	using namespace std::chrono_literals;
+
+	server::request_handler handler;
+	const auto path = ( std::filesystem::temp_directory_path() / "enigma_test.sock" ).string();
+	server::unix_socket_server server( path, handler );
+	std::thread server_thread( [ & ] { server.run(); } );
+
+	const auto job = server::send_request( path,
+										   "CRACK reflector=C plugs=AE,BF,CM,DQ,HU,JN,LX,PR,SZ,VW message=" + std::string( donitz_message )
+											   + " crib=XGEZXREICHSLEITEIKKTULPEKKJBORMANNJXX crib_start=279 orders=9/5/6/8 priority=1" );
+	REQUIRE( job == "OK job=1" );
+
+	REQUIRE( server::send_request(
+				 path, "DECODE reflector=C rotors=9,5,6,8 rings=0,0,4,11 plugs=AE,BF,CM,DQ,HU,JN,LX,PR,SZ,VW key=YOSZ message=LANOT" )
+			 == "OK KRKRA" );
+
+	std::string status = "OK running";
+	for ( int attempt = 0; attempt < 600 && status == "OK running"; ++attempt )
+	{
+		std::this_thread::sleep_for( 100ms );
+		status = server::send_request( path, "STATUS job=1" );
+	}
+	REQUIRE( status.starts_with( "OK found rotors=9,5,6,8" ) );
+	// Forgotten once its outcome was collected
+	REQUIRE( server::send_request( path, "STATUS job=1" ) == "ERROR unknown job" );
+
+	REQUIRE( server::send_request( path, "SHUTDOWN" ) == "OK" );
+	server_thread.join();
 }
 
 #endif
\ No newline at end of file